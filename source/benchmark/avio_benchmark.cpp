@@ -0,0 +1,151 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ffmpeg_helpers.hpp"
+#include "movie_reader.hpp"
+#include "movie_writer.hpp"
+
+// Writes and reads movies through a temporary file with AVIO buffers from 64KB to 64MB, and with the
+// size avioBufferSize picks, for a 720p proxy, a 4K and a 100MB+ 8K frame. Reports throughput and the
+// number of MovieFile callbacks per frame.
+
+namespace {
+
+struct MovieShape
+{
+    const char *name;
+    int width;
+    int height;
+    int encodedBytesPerFrame;
+    int frames;
+};
+
+const MovieShape MovieShapes[] = {
+    { "proxy_720p", 1280,  720, 1280 * 720 / 2, 64 },
+    { "4K",         3840, 2160, 3840 * 2160,    16 },
+    { "8K",         7680, 4320, 7680 * 4320 * 4, 2 },
+};
+
+const VideoFormat Format{ 'H', 'a', 'p', '1' };
+
+VideoDef videoDef(const MovieShape& shape)
+{
+    return VideoDef{ shape.width, shape.height, Format, "avio benchmark", 32, Rational{ 24, 1 }, shape.frames };
+}
+
+std::string moviePath(const MovieShape& shape)
+{
+    return (fs::temp_directory_path() / (std::string("avio_benchmark_") + shape.name + ".mov")).string();
+}
+
+// as the stdio reader in createMovieReader
+MovieFile openMovieFile(const std::string& path)
+{
+    std::shared_ptr<FILE> file(std::fopen(path.c_str(), "rb"), [](FILE* f) { if (f) std::fclose(f); });
+    if (!file)
+        throw std::runtime_error("could not open " + path);
+
+    MovieFile movieFile;
+    std::fseek(file.get(), 0, SEEK_END);
+    movieFile.fileSize = std::ftell(file.get());
+    std::rewind(file.get());
+    movieFile.onRead = [=](uint8_t* buffer, int size) {
+        return std::fread(buffer, 1, size, file.get());
+    };
+    movieFile.onSeek = [=](int64_t offset, int whence) {
+        return std::fseek(file.get(), (long)offset, whence) == 0 ? 0 : -1;
+    };
+    movieFile.onClose = []() {
+        return 0;
+    };
+    return movieFile;
+}
+
+// counts the calls made by libavformat through the file
+MovieFile countedMovieFile(MovieFile file, std::shared_ptr<int64_t> calls)
+{
+    auto onWrite = file.onWrite;
+    auto onRead = file.onRead;
+    if (onWrite)
+        file.onWrite = [=](const uint8_t* buffer, int size) { ++*calls; return onWrite(buffer, size); };
+    if (onRead)
+        file.onRead = [=](uint8_t* buffer, int size) { ++*calls; return onRead(buffer, size); };
+    return file;
+}
+
+void writeMovie(const MovieShape& shape, size_t bufferSize, const std::vector<uint8_t>& frame, std::shared_ptr<int64_t> calls)
+{
+    MovieWriter writer(0, countedMovieFile(createMovieFile(moviePath(shape)), calls), videoDef(shape), std::nullopt, false, bufferSize);
+    writer.writeHeader();
+    for (int i = 0; i < shape.frames; ++i)
+        writer.writeVideoFrame(frame.data(), frame.size());
+    writer.writeTrailer();
+    writer.close();
+}
+
+void setLabel(benchmark::State& state, const MovieShape& shape, size_t bufferSize, bool forReading)
+{
+    if (!bufferSize)
+        state.SetLabel(std::string("auto=") + std::to_string(avioBufferSize(videoDef(shape), avioConfiguration(), forReading)));
+}
+
+void reportThroughput(benchmark::State& state, const MovieShape& shape, int64_t calls)
+{
+    int64_t frames = (int64_t)state.iterations() * shape.frames;
+    state.SetBytesProcessed(frames * shape.encodedBytesPerFrame);
+    state.counters["callbacksPerFrame"] = (double)calls / (double)frames;
+}
+
+void BM_WriteMovie(benchmark::State& state)
+{
+    const MovieShape& shape = MovieShapes[state.range(0)];
+    size_t bufferSize = (size_t)state.range(1);
+    std::vector<uint8_t> frame(shape.encodedBytesPerFrame, 0x5a);
+    auto calls = std::make_shared<int64_t>(0);
+
+    for (auto _ : state)
+        writeMovie(shape, bufferSize, frame, calls);
+
+    std::remove(moviePath(shape).c_str());
+    setLabel(state, shape, bufferSize, false);
+    reportThroughput(state, shape, *calls);
+}
+
+void BM_ReadMovie(benchmark::State& state)
+{
+    const MovieShape& shape = MovieShapes[state.range(0)];
+    size_t bufferSize = (size_t)state.range(1);
+    std::vector<uint8_t> frame(shape.encodedBytesPerFrame, 0x5a);
+    writeMovie(shape, 0, frame, std::make_shared<int64_t>(0));
+
+    auto calls = std::make_shared<int64_t>(0);
+    for (auto _ : state) {
+        auto file = countedMovieFile(openMovieFile(moviePath(shape)), calls);
+        MovieReader reader(Format, file, bufferSize);
+        for (int i = 0; i < shape.frames; ++i)
+            reader.readVideoFrame(i, frame);
+    }
+
+    std::remove(moviePath(shape).c_str());
+    setLabel(state, shape, bufferSize, true);
+    reportThroughput(state, shape, *calls);
+}
+
+void bufferSizeSweep(benchmark::internal::Benchmark* b)
+{
+    for (int shape = 0; shape < (int)(sizeof(MovieShapes) / sizeof(MovieShapes[0])); ++shape) {
+        for (int64_t size = 64 << 10; size <= (64 << 20); size *= 4)
+            b->Args({ shape, size });
+        b->Args({ shape, 0 });
+    }
+}
+
+}
+
+BENCHMARK(BM_WriteMovie)->Apply(bufferSizeSweep)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_ReadMovie)->Apply(bufferSizeSweep)->Unit(benchmark::kMillisecond)->UseRealTime();
@@ -0,0 +1,30 @@
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+// as BENCHMARK_MAIN, but results are also written as JSON to <executable>.json unless --benchmark_out is
+// given, so runs can be compared before and after a change with tools/compare.py from Google Benchmark
+int main(int argc, char** argv)
+{
+    std::vector<char *> args(argv, argv + argc);
+
+    bool hasOut = false;
+    for (int i = 1; i < argc; ++i)
+        hasOut = hasOut || (std::strncmp(argv[i], "--benchmark_out=", 16) == 0);
+
+    std::string out = std::string("--benchmark_out=") + argv[0] + ".json";
+    std::string outFormat = "--benchmark_out_format=json";
+    if (!hasOut) {
+        args.push_back(&out[0]);
+        args.push_back(&outFormat[0]);
+    }
+
+    int count = (int)args.size();
+    benchmark::Initialize(&count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(count, args.data()))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,405 @@
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "util.hpp"
+
+// Every host format handled by the four convert* functions, at 1080p, 4K, 8K and an odd size whose
+// stride is padded, and premultiplying and unpremultiplying each at 1080p and the odd size. Each
+// conversion is first checked against a scalar reference on a small frame with odd dimensions and
+// padded stride; a mismatch fails that conversion's benchmarks. Frames converting alpha have fully
+// transparent and opaque pixels, and the opaque ones must come out exactly as they do without.
+
+namespace {
+
+struct HostFormat
+{
+    const char *name;
+    FrameFormat format;
+};
+
+const HostFormat HostFormats[] = {
+    { "BGRA_BottomLeft_U8",     ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8 },
+    { "BGRA_BottomLeft_U16_32k", ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U16_32k },
+    { "BGRA_BottomLeft_F16",    ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16 },
+    { "BGRA_BottomLeft_F32",    ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32 },
+    { "ARGB_TopLeft_U8",        ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8 },
+    { "ARGB_TopLeft_U16_32k",   ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U16_32k },
+    { "ARGB_TopLeft_F16",       ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F16 },
+    { "ARGB_TopLeft_F32",       ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F32 },
+};
+
+struct FrameShape
+{
+    int width;
+    int height;
+    int stridePaddingPixels;
+};
+
+const FrameShape FrameShapes[] = {
+    { 1920, 1080, 0 },
+    { 3840, 2160, 0 },
+    { 7680, 4320, 0 },
+    { 1997, 1079, 3 },
+};
+
+const FrameShape CheckShape = { 67, 23, 5 };
+
+// how colour relates to alpha on either side of the conversion
+struct AlphaCase
+{
+    FrameAlpha hostAlpha;
+    FrameAlpha rgbaAlpha;
+};
+
+const AlphaCase AlphaCases[] = {
+    { FrameAlpha_Straight,      FrameAlpha_Straight },
+    { FrameAlpha_Straight,      FrameAlpha_Premultiplied },
+    { FrameAlpha_Premultiplied, FrameAlpha_Straight },
+};
+
+const char *alphaName(FrameAlpha alpha)
+{
+    return (alpha == FrameAlpha_Premultiplied) ? "premultiplied" : "straight";
+}
+
+enum class Direction { HostToU8, HostToU16, U8ToHost, U16ToHost };
+
+const char *directionName(Direction direction)
+{
+    switch (direction) {
+    case Direction::HostToU8:  return "HostToRGBA_U8";
+    case Direction::HostToU16: return "HostToRGBA_U16";
+    case Direction::U8ToHost:  return "RGBA_U8ToHost";
+    case Direction::U16ToHost: return "RGBA_U16ToHost";
+    }
+    return "";
+}
+
+bool toHost(Direction direction)
+{
+    return direction == Direction::U8ToHost || direction == Direction::U16ToHost;
+}
+
+size_t rgbaChannelSize(Direction direction)
+{
+    return (direction == Direction::HostToU8 || direction == Direction::U8ToHost) ? 1 : 2;
+}
+
+// half <-> float for the reference; values used here are normal or zero, and smaller ones are written as zero
+float halfToFloat(uint16_t half)
+{
+    if ((half & 0x7fff) == 0)
+        return 0.f;
+    int exponent = (half >> 10) & 0x1f;
+    float mantissa = 1.f + (half & 0x3ff) / 1024.f;
+    return ((half & 0x8000) ? -1.f : 1.f) * std::ldexp(mantissa, exponent - 15);
+}
+
+uint16_t floatToHalf(float value)
+{
+    if (value < 6.103515625e-5f)  // the smallest normal half
+        return 0;
+    int exponent;
+    float mantissa = std::frexp(value, &exponent);  // [0.5, 1)
+    return (uint16_t)(((exponent - 1 + 15) << 10) | (((int)(mantissa * 2048.f)) & 0x3ff));
+}
+
+// host channel holding each RGBA channel
+int hostChannel(const FrameDef& def, int rgbaChannel)
+{
+    static const int bgra[] = { 2, 1, 0, 3 };
+    static const int argb[] = { 1, 2, 3, 0 };
+    return (def.channelLayout() == ChannelLayout_BGRA) ? bgra[rgbaChannel] : argb[rgbaChannel];
+}
+
+float hostUnit(ChannelFormat format)
+{
+    switch (format) {
+    case ChannelFormat_U8:      return 255.f;
+    case ChannelFormat_U16_32k: return 32768.f;
+    default:                    return 1.f;
+    }
+}
+
+// the largest value an integer host channel holds, in its units
+float hostMax(ChannelFormat format)
+{
+    switch (format) {
+    case ChannelFormat_U8:      return 255.f;
+    case ChannelFormat_U16_32k: return 65535.f;
+    default:                    return std::numeric_limits<float>::infinity();
+    }
+}
+
+double readHost(const uint8_t *pixel, ChannelFormat format, int channel)
+{
+    switch (format) {
+    case ChannelFormat_U8:      return pixel[channel] / 255.0;
+    case ChannelFormat_U16_32k: return ((const uint16_t *)pixel)[channel] / 32768.0;
+    case ChannelFormat_F16:     return halfToFloat(((const uint16_t *)pixel)[channel]);
+    case ChannelFormat_F32:     return ((const float *)pixel)[channel];
+    default:                    return 0.0;
+    }
+}
+
+void writeHost(uint8_t *pixel, ChannelFormat format, int channel, float value)
+{
+    switch (format) {
+    case ChannelFormat_U8:      pixel[channel] = (uint8_t)(value * 255.f); break;
+    case ChannelFormat_U16_32k: ((uint16_t *)pixel)[channel] = (uint16_t)(value * 32768.f); break;
+    case ChannelFormat_F16:     ((uint16_t *)pixel)[channel] = floatToHalf(value); break;
+    case ChannelFormat_F32:     ((float *)pixel)[channel] = value; break;
+    default: break;
+    }
+}
+
+// every fourth pixel is fully transparent, and the one after it opaque
+bool transparentPixel(size_t pixel) { return pixel % 4 == 0; }
+bool opaquePixel(size_t pixel) { return pixel % 4 == 1; }
+
+struct Frame
+{
+    Frame(Direction direction_, FrameFormat format, const AlphaCase& alpha, const FrameShape& shape)
+        : direction(direction_),
+          def(FrameSize{ shape.width, shape.height }, format, alpha.hostAlpha),
+          rgbaAlpha(alpha.rgbaAlpha),
+          hostStride((shape.width + shape.stridePaddingPixels) * def.bytesPerPixel()),
+          host(hostStride * shape.height),
+          rgba((size_t)shape.width * shape.height * 4 * rgbaChannelSize(direction))
+    {
+        if (toHost(direction)) {
+            for (size_t i = 0; i < rgba.size(); ++i)
+                rgba[i] = (uint8_t)(i * 7 + (i >> 9));
+        }
+        else {
+            // in range values, so every conversion is well defined
+            size_t channels = host.size() / (def.bytesPerPixel() / 4);
+            for (size_t i = 0; i < channels; ++i) {
+                float value = (float)((i * 7 + (i >> 9)) % 1024) / 1023.f;
+                writeHost(host.data(), def.channelFormat(), (int)i, value);
+            }
+        }
+
+        if (def.alpha != rgbaAlpha)
+            makeAlpha();
+    }
+
+    FrameAlpha sourceAlpha() const { return toHost(direction) ? rgbaAlpha : def.alpha; }
+    FrameAlpha destAlpha() const { return toHost(direction) ? def.alpha : rgbaAlpha; }
+    float rgbaUnit() const { return (rgbaChannelSize(direction) == 1) ? 255.f : 65535.f; }
+
+    const uint8_t *hostPixel(int x, int y) const
+    {
+        int hostRow = (def.origin() == FrameOrigin_BottomLeft) ? def.size.height - 1 - y : y;
+        return host.data() + hostRow * hostStride + x * def.bytesPerPixel();
+    }
+    uint8_t *hostPixel(int x, int y) { return const_cast<uint8_t *>(static_cast<const Frame&>(*this).hostPixel(x, y)); }
+
+    // RGBA channel c of pixel (x, y) of the RGBA frame, and of the host frame, as a fraction of opaque
+    double rgbaValue(int x, int y, int c) const
+    {
+        size_t i = ((size_t)y * def.size.width + x) * 4 + c;
+        return ((rgbaChannelSize(direction) == 1) ? rgba[i] : ((const uint16_t *)rgba.data())[i]) / rgbaUnit();
+    }
+    double hostValue(int x, int y, int c) const { return readHost(hostPixel(x, y), def.channelFormat(), hostChannel(def, c)); }
+
+    // gives the source transparent and opaque pixels, with colour no more than alpha where it is premultiplied
+    void makeAlpha()
+    {
+        const bool premultiplied = (sourceAlpha() == FrameAlpha_Premultiplied);
+        for (int y = 0; y < def.size.height; ++y) {
+            for (int x = 0; x < def.size.width; ++x) {
+                size_t pixel = (size_t)y * def.size.width + x;
+                float value[4];
+                for (int c = 0; c < 4; ++c)
+                    value[c] = (float)(toHost(direction) ? rgbaValue(x, y, c) : hostValue(x, y, c));
+                if (transparentPixel(pixel))
+                    value[3] = 0.f;
+                else if (opaquePixel(pixel))
+                    value[3] = 1.f;
+                for (int c = 0; c < 3 && premultiplied; ++c)
+                    value[c] *= value[3];
+
+                for (int c = 0; c < 4; ++c) {
+                    if (!toHost(direction)) {
+                        writeHost(hostPixel(x, y), def.channelFormat(), hostChannel(def, c), value[c]);
+                        continue;
+                    }
+                    size_t i = (pixel * 4) + c;
+                    if (rgbaChannelSize(direction) == 1)
+                        rgba[i] = (uint8_t)(value[c] * 255.f);
+                    else
+                        ((uint16_t *)rgba.data())[i] = (uint16_t)(value[c] * 65535.f);
+                }
+            }
+        }
+    }
+
+    void convert()
+    {
+        const size_t rgbaStride = def.size.width * 4 * rgbaChannelSize(direction);
+        switch (direction) {
+        case Direction::HostToU8:
+            convertHostFrameTo_RGBA_Top_Left_U8(host.data(), hostStride, def, rgba.data(), rgbaStride, rgbaAlpha);
+            break;
+        case Direction::HostToU16:
+            convertHostFrameTo_RGBA_Top_Left_U16(host.data(), hostStride, def, (uint16_t *)rgba.data(), rgbaStride, rgbaAlpha);
+            break;
+        case Direction::U8ToHost:
+            convertRGBA_Top_Left_U8_ToHostFrame(rgba.data(), host.data(), hostStride, def, rgbaAlpha);
+            break;
+        case Direction::U16ToHost:
+            convertRGBA_Top_Left_U16_ToHostFrame((const uint16_t *)rgba.data(), host.data(), hostStride, def, rgbaAlpha);
+            break;
+        }
+    }
+
+    // compares the result of convert() with a scalar reference; returns a description of the first mismatch
+    std::string check() const
+    {
+        const ChannelFormat format = def.channelFormat();
+
+        for (int y = 0; y < def.size.height; ++y) {
+            for (int x = 0; x < def.size.width; ++x) {
+                // the reference works in fractions of opaque, and in double so as not to add error of its own
+                double source[4];
+                for (int c = 0; c < 4; ++c)
+                    source[c] = toHost(direction) ? rgbaValue(x, y, c) : hostValue(x, y, c);
+                double factor = 1.0;
+                if (sourceAlpha() != destAlpha())
+                    factor = (destAlpha() == FrameAlpha_Premultiplied) ? source[3] : (source[3] > 0.0 ? 1.0 / source[3] : 0.0);
+
+                for (int c = 0; c < 4; ++c) {
+                    double value = (c < 3) ? source[c] * factor : source[c];
+
+                    float expected, actual, tolerance;
+                    if (toHost(direction)) {
+                        expected = (float)std::min(value * hostUnit(format), (double)hostMax(format));
+                        actual = (float)(hostValue(x, y, c) * hostUnit(format));
+                        tolerance = (format == ChannelFormat_F16) ? 1e-3f : (format == ChannelFormat_F32) ? 1e-6f : 1.f;
+                    }
+                    else {
+                        expected = (float)std::min(value * rgbaUnit(), (double)rgbaUnit());
+                        actual = (float)(rgbaValue(x, y, c) * rgbaUnit());
+                        tolerance = 1.f;
+                    }
+                    if (std::fabs(expected - actual) > tolerance)
+                        return "pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") channel " + std::to_string(c)
+                            + " is " + std::to_string(actual) + ", expected " + std::to_string(expected);
+                }
+            }
+        }
+        return std::string();
+    }
+
+    // compares the opaque pixels converted with those of the same frame converted without alpha conversion
+    std::string checkOpaque(const Frame& plain) const
+    {
+        const size_t rgbaPixelSize = 4 * rgbaChannelSize(direction);
+        for (int y = 0; y < def.size.height; ++y) {
+            for (int x = 0; x < def.size.width; ++x) {
+                size_t pixel = (size_t)y * def.size.width + x;
+                if (!opaquePixel(pixel))
+                    continue;
+                bool same = toHost(direction)
+                    ? std::memcmp(hostPixel(x, y), plain.hostPixel(x, y), def.bytesPerPixel()) == 0
+                    : std::memcmp(&rgba[pixel * rgbaPixelSize], &plain.rgba[pixel * rgbaPixelSize], rgbaPixelSize) == 0;
+                if (!same)
+                    return "opaque pixel (" + std::to_string(x) + ", " + std::to_string(y) + ") differs from the conversion without alpha";
+            }
+        }
+        return std::string();
+    }
+
+    Direction direction;
+    FrameDef def;
+    FrameAlpha rgbaAlpha;
+    size_t hostStride;
+    std::vector<uint8_t> host;
+    std::vector<uint8_t> rgba;
+};
+
+std::string checkConversion(Direction direction, FrameFormat format, AlphaCase alpha)
+{
+    Frame frame(direction, format, alpha, CheckShape);
+    Frame plain(direction, format, AlphaCase{ alpha.hostAlpha, alpha.hostAlpha }, CheckShape);
+    plain.host = frame.host;
+    plain.rgba = frame.rgba;
+    try {
+        frame.convert();
+        plain.convert();
+    }
+    catch (std::exception& e) {
+        return e.what();
+    }
+    std::string error = frame.check();
+    if (error.empty() && alpha.hostAlpha != alpha.rgbaAlpha)
+        error = frame.checkOpaque(plain);
+    return error;
+}
+
+void BM_Convert(benchmark::State& state, Direction direction, FrameFormat format, AlphaCase alpha, FrameShape shape)
+{
+    static std::map<std::tuple<Direction, FrameFormat, FrameAlpha, FrameAlpha>, std::string> errors;
+    auto key = std::make_tuple(direction, format, alpha.hostAlpha, alpha.rgbaAlpha);
+    if (errors.find(key) == errors.end())
+        errors[key] = checkConversion(direction, format, alpha);
+    if (!errors[key].empty()) {
+        state.SkipWithError(errors[key].c_str());
+        return;
+    }
+
+    Frame frame(direction, format, alpha, shape);
+    for (auto _ : state) {
+        frame.convert();
+        benchmark::ClobberMemory();
+    }
+
+    // bytes read plus bytes written
+    size_t hostBytes = (size_t)shape.width * shape.height * frame.def.bytesPerPixel();
+    state.SetBytesProcessed((int64_t)state.iterations() * (hostBytes + frame.rgba.size()));
+    state.counters["pixels_per_second"] = benchmark::Counter((double)state.iterations() * shape.width * shape.height, benchmark::Counter::kIsRate);
+}
+
+// decoders only produce bottom-left BGRA host frames
+bool handled(Direction direction, FrameFormat format)
+{
+    return !toHost(direction) || ((format & (ChannelLayoutMask | FrameOriginMask)) == (ChannelLayout_BGRA | FrameOrigin_BottomLeft));
+}
+
+const int registered = [] {
+    for (Direction direction : { Direction::HostToU8, Direction::HostToU16, Direction::U8ToHost, Direction::U16ToHost }) {
+        for (const HostFormat& hostFormat : HostFormats) {
+            if (!handled(direction, hostFormat.format))
+                continue;
+            for (const AlphaCase& alpha : AlphaCases) {
+                bool convertsAlpha = (alpha.hostAlpha != alpha.rgbaAlpha);
+                for (const FrameShape& shape : FrameShapes) {
+                    if (convertsAlpha && shape.width != 1920 && !shape.stridePaddingPixels)
+                        continue;
+                    std::string name = std::string(directionName(direction)) + "/" + hostFormat.name + "/"
+                        + std::to_string(shape.width) + "x" + std::to_string(shape.height);
+                    if (shape.stridePaddingPixels)
+                        name += "/padded_stride";
+                    if (convertsAlpha) {
+                        FrameAlpha from = toHost(direction) ? alpha.rgbaAlpha : alpha.hostAlpha;
+                        FrameAlpha to = toHost(direction) ? alpha.hostAlpha : alpha.rgbaAlpha;
+                        name += std::string("/") + alphaName(from) + "_to_" + alphaName(to);
+                    }
+                    benchmark::RegisterBenchmark(name.c_str(), BM_Convert, direction, hostFormat.format, alpha, shape)
+                        ->Unit(benchmark::kMicrosecond);
+                }
+            }
+        }
+    }
+    return 0;
+}();
+
+}
@@ -0,0 +1,241 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "util.hpp"
+
+// Block-compressed encoders want 4x4 blocks. Compare converting to linear RGBA and then gathering
+// blocks, as an encoder otherwise has to, against converting straight into blocks.
+
+namespace {
+
+const int BlockDim = 4;
+
+template<typename CHANNEL_TYPE>
+void gatherBlocks(const CHANNEL_TYPE *linear, const FrameSize& size, CHANNEL_TYPE *blocks)
+{
+    const int blocksWide = (size.width + BlockDim - 1) / BlockDim;
+    const int blocksHigh = (size.height + BlockDim - 1) / BlockDim;
+    for (int blockY = 0; blockY < blocksHigh; ++blockY) {
+        for (int blockX = 0; blockX < blocksWide; ++blockX) {
+            CHANNEL_TYPE *block = blocks + (blockY * blocksWide + blockX) * BlockDim * BlockDim * 4;
+            for (int row = 0; row < BlockDim; ++row) {
+                int y = std::min(blockY * BlockDim + row, size.height - 1);
+                for (int column = 0; column < BlockDim; ++column) {
+                    int x = std::min(blockX * BlockDim + column, size.width - 1);
+                    std::memcpy(block + (row * BlockDim + column) * 4, linear + ((size_t)y * size.width + x) * 4, 4 * sizeof(CHANNEL_TYPE));
+                }
+            }
+        }
+    }
+}
+
+struct HostFrame
+{
+    HostFrame(FrameFormat format, int width, int height)
+        : def(FrameSize{ width, height }, format),
+          stride(width * def.bytesPerPixel()),
+          data(stride * height)
+    {
+        for (size_t i = 0; i < data.size(); ++i)
+            data[i] = (uint8_t)(i * 7);
+        if (def.channelFormat() == ChannelFormat_F32) {
+            float *channels = (float *)data.data();
+            for (size_t i = 0; i < data.size() / sizeof(float); ++i)
+                channels[i] = (float)(i % 251) / 251.f;
+        }
+    }
+
+    FrameDef def;
+    size_t stride;
+    std::vector<uint8_t> data;
+};
+
+void setBytesProcessed(benchmark::State& state, const HostFrame& host)
+{
+    state.SetBytesProcessed((int64_t)state.iterations() * host.data.size());
+}
+
+void BM_U8_LinearThenGather(benchmark::State& state, FrameFormat format)
+{
+    HostFrame host(format, (int)state.range(0), (int)state.range(1));
+    std::vector<uint8_t> linear(host.def.size.width * host.def.size.height * 4);
+    std::vector<uint8_t> blocks(blockLinearSizeInBytes(host.def.size, 4));
+
+    for (auto _ : state) {
+        convertHostFrameTo_RGBA_Top_Left_U8(host.data.data(), host.stride, host.def, linear.data(), host.def.size.width * 4);
+        gatherBlocks(linear.data(), host.def.size, blocks.data());
+        benchmark::ClobberMemory();
+    }
+    setBytesProcessed(state, host);
+}
+
+void BM_U8_Blocks(benchmark::State& state, FrameFormat format)
+{
+    HostFrame host(format, (int)state.range(0), (int)state.range(1));
+    std::vector<uint8_t> blocks(blockLinearSizeInBytes(host.def.size, 4));
+
+    // must match the two pass result
+    {
+        std::vector<uint8_t> linear(host.def.size.width * host.def.size.height * 4);
+        std::vector<uint8_t> expected(blocks.size());
+        convertHostFrameTo_RGBA_Top_Left_U8(host.data.data(), host.stride, host.def, linear.data(), host.def.size.width * 4);
+        gatherBlocks(linear.data(), host.def.size, expected.data());
+        convertHostFrameTo_RGBA_Top_Left_U8_Blocks(host.data.data(), host.stride, host.def, blocks.data());
+        if (blocks != expected) {
+            state.SkipWithError("block output differs from linear output");
+            return;
+        }
+    }
+
+    for (auto _ : state) {
+        convertHostFrameTo_RGBA_Top_Left_U8_Blocks(host.data.data(), host.stride, host.def, blocks.data());
+        benchmark::ClobberMemory();
+    }
+    setBytesProcessed(state, host);
+}
+
+void BM_U16_LinearThenGather(benchmark::State& state, FrameFormat format)
+{
+    HostFrame host(format, (int)state.range(0), (int)state.range(1));
+    std::vector<uint16_t> linear(host.def.size.width * host.def.size.height * 4);
+    std::vector<uint16_t> blocks(blockLinearSizeInBytes(host.def.size, 8) / sizeof(uint16_t));
+
+    for (auto _ : state) {
+        convertHostFrameTo_RGBA_Top_Left_U16(host.data.data(), host.stride, host.def, linear.data(), host.def.size.width * 8);
+        gatherBlocks(linear.data(), host.def.size, blocks.data());
+        benchmark::ClobberMemory();
+    }
+    setBytesProcessed(state, host);
+}
+
+void BM_U16_Blocks(benchmark::State& state, FrameFormat format)
+{
+    HostFrame host(format, (int)state.range(0), (int)state.range(1));
+    std::vector<uint16_t> blocks(blockLinearSizeInBytes(host.def.size, 8) / sizeof(uint16_t));
+
+    for (auto _ : state) {
+        convertHostFrameTo_RGBA_Top_Left_U16_Blocks(host.data.data(), host.stride, host.def, blocks.data());
+        benchmark::ClobberMemory();
+    }
+    setBytesProcessed(state, host);
+}
+
+// Large frames are written with non-temporal stores. Compare conversion throughput with and without,
+// and the cost of reading back a cache-sized working set afterwards, which is what the stores protect.
+
+class StreamingStores
+{
+public:
+    StreamingStores(bool enabled)
+        : previous_(streamingStoreThreshold())
+    {
+        setStreamingStoreThreshold(enabled ? 0 : SIZE_MAX);
+    }
+    ~StreamingStores() { setStreamingStoreThreshold(previous_); }
+
+private:
+    size_t previous_;
+};
+
+void BM_U16_Streaming(benchmark::State& state, FrameFormat format)
+{
+    StreamingStores streaming(state.range(2) != 0);
+    HostFrame host(format, (int)state.range(0), (int)state.range(1));
+    std::vector<uint16_t> linear(host.def.size.width * host.def.size.height * 4);
+
+    for (auto _ : state) {
+        convertHostFrameTo_RGBA_Top_Left_U16(host.data.data(), host.stride, host.def, linear.data(), host.def.size.width * 8);
+        benchmark::ClobberMemory();
+    }
+    setBytesProcessed(state, host);
+}
+
+void BM_WorkingSetAfterU16Convert(benchmark::State& state, FrameFormat format)
+{
+    StreamingStores streaming(state.range(2) != 0);
+    HostFrame host(format, (int)state.range(0), (int)state.range(1));
+    std::vector<uint16_t> linear(host.def.size.width * host.def.size.height * 4);
+    std::vector<uint64_t> workingSet((2 << 20) / sizeof(uint64_t), 1);
+
+    // time only the read back of the working set, so iterations are fixed rather than timed
+    uint64_t sum = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (auto& value : workingSet)
+            sum += value;
+        convertHostFrameTo_RGBA_Top_Left_U16(host.data.data(), host.stride, host.def, linear.data(), host.def.size.width * 8);
+        benchmark::ClobberMemory();
+        state.ResumeTiming();
+        for (auto& value : workingSet)
+            sum += value;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetBytesProcessed((int64_t)state.iterations() * workingSet.size() * sizeof(uint64_t));
+}
+
+// Proxies are made from the host frame with a 2x2 box filter, for each size from the size before.
+
+void BM_DownscaleByHalf(benchmark::State& state, FrameFormat format)
+{
+    HostFrame host(format, (int)state.range(0), (int)state.range(1));
+    FrameDef halfDef(halfFrameSize(host.def.size), format);
+    std::vector<uint8_t> half(halfDef.stride() * halfDef.size.height);
+
+    // 8 bit output must be the rounded mean of each 2x2 block
+    if (host.def.channelFormat() == ChannelFormat_U8) {
+        downscaleHostFrameByHalf(host.data.data(), host.stride, host.def, half.data(), halfDef.stride());
+        for (int y = 0; y < halfDef.size.height; ++y) {
+            const uint8_t *top = host.data.data() + 2 * y * host.stride;
+            const uint8_t *bottom = top + host.stride;
+            for (int i = 0; i < halfDef.size.width * 4; ++i) {
+                int x = (i / 4) * 8 + i % 4;
+                if (half[y * halfDef.stride() + i] != (top[x] + top[x + 4] + bottom[x] + bottom[x + 4] + 2) / 4) {
+                    state.SkipWithError("downscaled output differs from box filter");
+                    return;
+                }
+            }
+        }
+    }
+
+    for (auto _ : state) {
+        downscaleHostFrameByHalf(host.data.data(), host.stride, host.def, half.data(), halfDef.stride());
+        benchmark::ClobberMemory();
+    }
+    setBytesProcessed(state, host);
+}
+
+const FrameFormat BGRA_BottomLeft_U8 = ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8;
+const FrameFormat ARGB_TopLeft_U8 = ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8;
+const FrameFormat BGRA_BottomLeft_F32 = ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32;
+
+void frameSizes(benchmark::internal::Benchmark *benchmark)
+{
+    benchmark->Args({ 1920, 1080 })->Args({ 3840, 2160 })->Args({ 1998, 1078 })->Unit(benchmark::kMicrosecond);
+}
+
+}
+
+BENCHMARK_CAPTURE(BM_U8_LinearThenGather, BGRA_BottomLeft_U8, BGRA_BottomLeft_U8)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_U8_Blocks, BGRA_BottomLeft_U8, BGRA_BottomLeft_U8)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_U8_LinearThenGather, ARGB_TopLeft_U8, ARGB_TopLeft_U8)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_U8_Blocks, ARGB_TopLeft_U8, ARGB_TopLeft_U8)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_U8_LinearThenGather, BGRA_BottomLeft_F32, BGRA_BottomLeft_F32)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_U8_Blocks, BGRA_BottomLeft_F32, BGRA_BottomLeft_F32)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_U16_LinearThenGather, BGRA_BottomLeft_F32, BGRA_BottomLeft_F32)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_U16_Blocks, BGRA_BottomLeft_F32, BGRA_BottomLeft_F32)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_DownscaleByHalf, BGRA_BottomLeft_U8, BGRA_BottomLeft_U8)->Apply(frameSizes);
+BENCHMARK_CAPTURE(BM_DownscaleByHalf, BGRA_BottomLeft_F32, BGRA_BottomLeft_F32)->Apply(frameSizes);
+
+void streamingFrameSizes(benchmark::internal::Benchmark *benchmark)
+{
+    benchmark->ArgNames({ "width", "height", "streaming" })->Unit(benchmark::kMicrosecond);
+    for (int streaming : { 0, 1 })
+        benchmark->Args({ 3840, 2160, streaming })->Args({ 7680, 4320, streaming });
+}
+
+BENCHMARK_CAPTURE(BM_U16_Streaming, BGRA_BottomLeft_F32, BGRA_BottomLeft_F32)->Apply(streamingFrameSizes);
+BENCHMARK_CAPTURE(BM_WorkingSetAfterU16Convert, BGRA_BottomLeft_F32, BGRA_BottomLeft_F32)->Apply(streamingFrameSizes)->Iterations(32);
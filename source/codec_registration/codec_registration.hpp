@@ -4,6 +4,7 @@
 #include <array>
 #include <functional>
 #include <map>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -63,16 +64,25 @@ enum FrameOrigin : uint32_t
     FrameOrigin_TopLeft    = 0x020000,
 };
 
+// how colour relates to alpha in a frame; kept apart from FrameFormat, which codecs match exactly
+enum FrameAlpha : uint32_t
+{
+    FrameAlpha_Straight      = 0,   // colour independent of alpha; the default
+    FrameAlpha_Premultiplied = 1,   // colour already multiplied by alpha
+};
+
 
 struct FrameDef
 {
     FrameDef(FrameSize size_,
-             FrameFormat format_)
-        : size(size_), format(format_)
+             FrameFormat format_,
+             FrameAlpha alpha_ = FrameAlpha_Straight)
+        : size(size_), format(format_), alpha(alpha_)
     { }
 
     FrameSize size;
     FrameFormat format;
+    FrameAlpha alpha;
 
     ChannelFormat channelFormat() const { return (ChannelFormat) (format & ChannelFormatMask); }
     ChannelLayout channelLayout() const{ return (ChannelLayout) (format & ChannelLayoutMask); }
@@ -84,8 +94,8 @@ struct FrameDef
     size_t stride() const {
         return size.width * bytesPerPixel();
     }
-    bool operator==(const FrameDef& rhs) const { return size == rhs.size && format == rhs.format; }
-    bool operator!=(const FrameDef& rhs) const { return size != rhs.size || format != rhs.format; }
+    bool operator==(const FrameDef& rhs) const { return size == rhs.size && format == rhs.format && alpha == rhs.alpha; }
+    bool operator!=(const FrameDef& rhs) const { return !(*this == rhs); }
 };
 
 struct EncodeOutput
@@ -165,6 +175,18 @@ public:
             format);
     }
 
+    //   as above, for frames that may be premultiplied, as given by frameDef.alpha
+    void copyExternalToLocal(
+        const uint8_t *data,
+        size_t stride,
+        const FrameDef& frameDef)
+    {
+        doCopyExternalToLocalWithAlpha(
+            data,
+            stride,
+            frameDef);
+    }
+
     // encode operation, performed in a job-thread
     void encode(EncodeOutput& out)
     {
@@ -178,8 +200,17 @@ private:
         size_t stride,
         FrameFormat format) = 0;
 
+    // derived EncoderJob classes that take premultiplied frames override this, passing frameDef on to
+    // the converters; by default premultiplied frames are converted to straight first (see util.cpp)
+    virtual void doCopyExternalToLocalWithAlpha(
+        const uint8_t *data,
+        size_t stride,
+        const FrameDef& frameDef);
+
     virtual void doEncode(EncodeOutput& out) = 0;
 
+    std::vector<uint8_t> straight_;  // premultiplied frames converted for doCopyExternalToLocal
+
     EncoderJob(const EncoderJob& rhs) = delete;
     EncoderJob& operator=(const EncoderJob& rhs) = delete;
 };
@@ -14,8 +14,10 @@
 #define NOMINMAX
 #include <Windows.h>
 #include "StackWalker.h"
-#else
+#elif defined(__APPLE__)
 #include <os/log.h>
+#else
+#include <syslog.h>
 #endif
 
 using namespace std::chrono_literals;
@@ -164,8 +166,10 @@ private:
             out.flush();
 #ifdef WIN32
             OutputDebugString(full.str().c_str());
-#else
+#elif defined(__APPLE__)
             os_log_debug(OS_LOG_DEFAULT, "%s - %s", FOUNDATION_CODEC_NAME, full.str().c_str());
+#else
+            syslog(LOG_DEBUG, "%s - %s", FOUNDATION_CODEC_NAME, full.str().c_str());
 #endif
         }
     }
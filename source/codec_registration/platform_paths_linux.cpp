@@ -0,0 +1,22 @@
+#include <cstdlib>
+#include <stdexcept>
+
+#include "platform_paths.hpp"
+
+namespace fdn {
+
+// alongside other applications' configuration, as on macOS: $XDG_CONFIG_HOME, or ~/.config
+PathType getConfigurationPath()
+{
+    const char *configHome = std::getenv("XDG_CONFIG_HOME");
+    if (configHome && *configHome)
+        return PathType(configHome) / "CodecFoundation";
+
+    const char *home = std::getenv("HOME");
+    if (home && *home)
+        return PathType(home) / ".config" / "CodecFoundation";
+
+    throw std::runtime_error("could not get home directory");
+}
+
+} // namespace fdn
@@ -1,5 +1,122 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FDN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// msvc allows intrinsics from any instruction set; gcc and clang need the function tagged
+#if defined(FDN_X86) && !defined(_MSC_VER)
+#define FDN_TARGET_AVX2_F16C __attribute__((target("avx2,f16c")))
+#else
+#define FDN_TARGET_AVX2_F16C
+#endif
+
 #include "util.hpp"
 
+// runtime check, as the host cpu may predate the instructions
+static bool hasAvx2AndF16c()
+{
+    static const bool supported = []() {
+#if defined(FDN_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        bool f16c = (info[2] & (1 << 29)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!f16c || !avx || !osxsave || ((_xgetbv(0) & 6) != 6))
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#elif defined(FDN_X86)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+#else
+        return false;
+#endif
+    }();
+    return supported;
+}
+
+// IEEE 754 half <-> float, matching vcvtph2ps / vcvtps2ph with round to nearest even
+static inline float halfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // subnormal; normalise it
+            exponent = 127 - 15 + 1;
+            while (!(mantissa & 0x400)) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff)  // inf, nan
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    if (exponent >= 0x1f)               // overflow to inf
+        return (uint16_t)(sign | 0x7c00);
+    if (exponent <= 0) {
+        if (exponent < -10)             // underflow to 0
+            return (uint16_t)sign;
+        // subnormal
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+            ++half;
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        ++half;  // a carry into the exponent is the correct result
+    return (uint16_t)half;
+}
+
 template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
     typename SRC_CHANNEL_TYPE, typename STRIDET,
     typename WIDTHT, typename HEIGHTT,
@@ -100,7 +217,535 @@ template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DE
 }
 
 
-void convertHostFrameTo_RGBA_Top_Left_U16(const uint8_t *data, size_t stride, const FrameDef& frameDef, uint16_t *dest, size_t destStrideInBytes)
+// half float host frames
+//   rows are converted 4 pixels at a time with F16C where available; the scalar path handles
+//   any remainder, and the whole frame on older cpus. Both clamp to the destination range and
+//   truncate, so results are identical either way.
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    typename DST_CHANNEL_TYPE>
+    void convertRowFromF16_scalar(const uint16_t *sourceRow, DST_CHANNEL_TYPE *destRow, size_t width, float toDestScale)
+{
+    const float maxValue = (float)std::numeric_limits<DST_CHANNEL_TYPE>::max();
+    auto toDest = [&](uint16_t half) {
+        // same ordering as maxps / minps so nan -> 0, as per the simd path
+        float value = halfToFloat(half) * toDestScale;
+        value = (value > 0.f) ? value : 0.f;
+        value = (value < maxValue) ? value : maxValue;
+        return (DST_CHANNEL_TYPE)value;
+    };
+
+    size_t widthX4 = width * 4;
+    for (size_t i = 0; i < widthX4; i += 4) {
+        destRow[i]     = toDest(sourceRow[i + SRC_FOR_DEST0]);
+        destRow[i + 1] = toDest(sourceRow[i + SRC_FOR_DEST1]);
+        destRow[i + 2] = toDest(sourceRow[i + SRC_FOR_DEST2]);
+        destRow[i + 3] = toDest(sourceRow[i + SRC_FOR_DEST3]);
+    }
+}
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    typename SRC_CHANNEL_TYPE>
+    void convertRowToF16_scalar(const SRC_CHANNEL_TYPE *sourceRow, uint16_t *destRow, size_t width, float toDestScale)
+{
+    size_t widthX4 = width * 4;
+    for (size_t i = 0; i < widthX4; i += 4) {
+        destRow[i]     = floatToHalf((float)sourceRow[i + SRC_FOR_DEST0] * toDestScale);
+        destRow[i + 1] = floatToHalf((float)sourceRow[i + SRC_FOR_DEST1] * toDestScale);
+        destRow[i + 2] = floatToHalf((float)sourceRow[i + SRC_FOR_DEST2] * toDestScale);
+        destRow[i + 3] = floatToHalf((float)sourceRow[i + SRC_FOR_DEST3] * toDestScale);
+    }
+}
+
+#ifdef FDN_X86
+// 2 pixels of halfs -> swizzled, scaled and clamped 32 bit integers
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3>
+FDN_TARGET_AVX2_F16C
+static inline __m256i halfPixelsToInt32(__m128i halfs, __m256 toDestScale, __m256 maxValue)
+{
+    __m256 value = _mm256_cvtph_ps(halfs);
+    value = _mm256_shuffle_ps(value, value, _MM_SHUFFLE(SRC_FOR_DEST3, SRC_FOR_DEST2, SRC_FOR_DEST1, SRC_FOR_DEST0));
+    value = _mm256_mul_ps(value, toDestScale);
+    value = _mm256_min_ps(_mm256_max_ps(value, _mm256_setzero_ps()), maxValue);
+    return _mm256_cvttps_epi32(value);
+}
+
+// returns number of pixels converted
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    typename DST_CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+    size_t convertRowFromF16_avx2(const uint16_t *sourceRow, DST_CHANNEL_TYPE *destRow, size_t width, float toDestScale)
+{
+    const __m256 scale = _mm256_set1_ps(toDestScale);
+    const __m256 maxValue = _mm256_set1_ps((float)std::numeric_limits<DST_CHANNEL_TYPE>::max());
+
+    size_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i halfs01 = _mm_loadu_si128((const __m128i *)(sourceRow + x * 4));
+        __m128i halfs23 = _mm_loadu_si128((const __m128i *)(sourceRow + x * 4 + 8));
+        __m256i pixels01 = halfPixelsToInt32<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3>(halfs01, scale, maxValue);
+        __m256i pixels23 = halfPixelsToInt32<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3>(halfs23, scale, maxValue);
+
+        // packs are per 128-bit lane, so reorder the 64-bit pixels afterwards
+        __m256i u16 = _mm256_packus_epi32(pixels01, pixels23);
+        u16 = _mm256_permute4x64_epi64(u16, _MM_SHUFFLE(3, 1, 2, 0));
+        if constexpr (std::is_same_v<DST_CHANNEL_TYPE, uint16_t>) {
+            _mm256_storeu_si256((__m256i *)(destRow + x * 4), u16);
+        }
+        else {
+            static_assert(std::is_same_v<DST_CHANNEL_TYPE, uint8_t>, "unhandled destination type");
+            __m256i u8 = _mm256_packus_epi16(u16, u16);
+            u8 = _mm256_permute4x64_epi64(u8, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i *)(destRow + x * 4), _mm256_castsi256_si128(u8));
+        }
+    }
+    return x;
+}
+
+// returns number of pixels converted
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    typename SRC_CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+    size_t convertRowToF16_avx2(const SRC_CHANNEL_TYPE *sourceRow, uint16_t *destRow, size_t width, float toDestScale)
+{
+    const __m256 scale = _mm256_set1_ps(toDestScale);
+
+    size_t x = 0;
+    for (; x + 2 <= width; x += 2) {
+        __m256i pixels;
+        if constexpr (std::is_same_v<SRC_CHANNEL_TYPE, uint16_t>) {
+            pixels = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(sourceRow + x * 4)));
+        }
+        else {
+            static_assert(std::is_same_v<SRC_CHANNEL_TYPE, uint8_t>, "unhandled source type");
+            pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(sourceRow + x * 4)));
+        }
+        __m256 value = _mm256_cvtepi32_ps(pixels);
+        value = _mm256_shuffle_ps(value, value, _MM_SHUFFLE(SRC_FOR_DEST3, SRC_FOR_DEST2, SRC_FOR_DEST1, SRC_FOR_DEST0));
+        value = _mm256_mul_ps(value, scale);
+        _mm_storeu_si128((__m128i *)(destRow + x * 4), _mm256_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+    }
+    return x;
+}
+#endif
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    bool FLIP, typename DST_CHANNEL_TYPE>
+    void copy_from_f16_scaled(const uint16_t *src, size_t stride, int width, int height,
+        DST_CHANNEL_TYPE *dest, size_t destStride, float toDestScale)
+{
+    bool useF16c = hasAvx2AndF16c();
+    for (size_t row = 0; row < (size_t)height; row++)
+    {
+        const uint16_t *sourceRow = (const uint16_t *)((const uint8_t*)src + row * stride);
+        DST_CHANNEL_TYPE *destRow = (DST_CHANNEL_TYPE *)((uint8_t*)dest + (FLIP ? (height - row - 1) : row) * destStride);
+
+        size_t converted = 0;
+#ifdef FDN_X86
+        if (useF16c)
+            converted = convertRowFromF16_avx2<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3>(sourceRow, destRow, width, toDestScale);
+#endif
+        convertRowFromF16_scalar<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3>(
+            sourceRow + converted * 4, destRow + converted * 4, width - converted, toDestScale);
+    }
+}
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    bool FLIP, typename SRC_CHANNEL_TYPE>
+    void copy_to_f16_scaled(const SRC_CHANNEL_TYPE *src, size_t stride, int width, int height,
+        uint16_t *dest, size_t destStride, float toDestScale)
+{
+    bool useF16c = hasAvx2AndF16c();
+    for (size_t row = 0; row < (size_t)height; row++)
+    {
+        const SRC_CHANNEL_TYPE *sourceRow = (const SRC_CHANNEL_TYPE *)((const uint8_t*)src + row * stride);
+        uint16_t *destRow = (uint16_t *)((uint8_t*)dest + (FLIP ? (height - row - 1) : row) * destStride);
+
+        size_t converted = 0;
+#ifdef FDN_X86
+        if (useF16c)
+            converted = convertRowToF16_avx2<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3>(sourceRow, destRow, width, toDestScale);
+#endif
+        convertRowToF16_scalar<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3>(
+            sourceRow + converted * 4, destRow + converted * 4, width - converted, toDestScale);
+    }
+}
+
+
+// alpha conversion
+//   converts, swizzles and flips as copy_*_scaled does, premultiplying or unpremultiplying the colour
+//   in the same pass. Rows are converted a pixel per register with AVX2 where available, and by the
+//   scalar path on older cpus. Both scale in the precision of toDestScale with the same operations in
+//   the same order, and clamp and truncate integer destinations as the converters without alpha
+//   conversion do, so results are identical either way. The factor is taken in the source's units,
+//   where srcUnit is the value of an opaque alpha, so that it is exactly 1 for an opaque pixel, which
+//   comes out just as it would without alpha conversion. ALPHA is the destination channel of alpha.
+
+struct Half { uint16_t bits; };  // tags half float channels
+
+enum class AlphaConversion { Premultiply, Unpremultiply };
+
+template<typename T> static inline T channelValue(uint8_t channel) { return (T)channel; }
+template<typename T> static inline T channelValue(uint16_t channel) { return (T)channel; }
+template<typename T> static inline T channelValue(float channel) { return (T)channel; }
+template<typename T> static inline T channelValue(Half channel) { return (T)halfToFloat(channel.bits); }
+
+template<typename DST_CHANNEL_TYPE, typename T>
+static inline DST_CHANNEL_TYPE destChannel(T value)
+{
+    if constexpr (std::is_same_v<DST_CHANNEL_TYPE, Half>) {
+        return Half{ floatToHalf((float)value) };
+    }
+    else if constexpr (std::is_floating_point_v<DST_CHANNEL_TYPE>) {
+        return (DST_CHANNEL_TYPE)value;
+    }
+    else {
+        // same ordering as maxpd / minpd so nan -> 0, as per the simd path
+        const T maxValue = (T)std::numeric_limits<DST_CHANNEL_TYPE>::max();
+        value = (value > 0) ? value : 0;
+        value = (value < maxValue) ? value : maxValue;
+        return (DST_CHANNEL_TYPE)value;
+    }
+}
+
+template<AlphaConversion CONVERSION, typename T>
+static inline T alphaFactor(T alpha, T srcUnit)
+{
+    if constexpr (CONVERSION == AlphaConversion::Premultiply)
+        return alpha / srcUnit;
+    else
+        return (alpha > 0) ? srcUnit / alpha : 0;  // fully transparent pixels have no recoverable colour
+}
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    int ALPHA, AlphaConversion CONVERSION,
+    typename SRC_CHANNEL_TYPE, typename DST_CHANNEL_TYPE, typename T>
+    void convertAlphaRow_scalar(const SRC_CHANNEL_TYPE *sourceRow, DST_CHANNEL_TYPE *destRow, size_t width, T toDestScale, T srcUnit)
+{
+    constexpr int srcForDest[4] = { SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3 };
+
+    size_t widthX4 = width * 4;
+    for (size_t i = 0; i < widthX4; i += 4) {
+        T factor = alphaFactor<CONVERSION>(channelValue<T>(sourceRow[i + srcForDest[ALPHA]]), srcUnit);
+        for (int channel = 0; channel < 4; channel++) {
+            T value = channelValue<T>(sourceRow[i + srcForDest[channel]]) * toDestScale;
+            destRow[i + channel] = destChannel<DST_CHANNEL_TYPE>((channel == ALPHA) ? value : value * factor);
+        }
+    }
+}
+
+#ifdef FDN_X86
+// one pixel, in double precision
+template<typename SRC_CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+static inline __m256d loadPixelPd(const SRC_CHANNEL_TYPE *pixel)
+{
+    if constexpr (std::is_same_v<SRC_CHANNEL_TYPE, uint8_t>) {
+        int32_t packed;
+        std::memcpy(&packed, pixel, sizeof(packed));
+        return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+    }
+    else if constexpr (std::is_same_v<SRC_CHANNEL_TYPE, uint16_t>) {
+        return _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)pixel)));
+    }
+    else {
+        static_assert(std::is_same_v<SRC_CHANNEL_TYPE, float>, "unhandled source type");
+        return _mm256_cvtps_pd(_mm_loadu_ps(pixel));
+    }
+}
+
+template<typename DST_CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+static inline void storePixelPd(DST_CHANNEL_TYPE *pixel, __m256d value)
+{
+    if constexpr (std::is_same_v<DST_CHANNEL_TYPE, float>) {
+        _mm_storeu_ps(pixel, _mm256_cvtpd_ps(value));
+    }
+    else {
+        const __m256d maxValue = _mm256_set1_pd((double)std::numeric_limits<DST_CHANNEL_TYPE>::max());
+        value = _mm256_min_pd(_mm256_max_pd(value, _mm256_setzero_pd()), maxValue);
+        __m128i u16 = _mm_packus_epi32(_mm256_cvttpd_epi32(value), _mm_setzero_si128());
+        if constexpr (std::is_same_v<DST_CHANNEL_TYPE, uint16_t>) {
+            _mm_storel_epi64((__m128i *)pixel, u16);
+        }
+        else {
+            static_assert(std::is_same_v<DST_CHANNEL_TYPE, uint8_t>, "unhandled destination type");
+            int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(u16, u16));
+            std::memcpy(pixel, &packed, sizeof(packed));
+        }
+    }
+}
+
+// one pixel, in single precision, for half float sources and destinations
+template<typename SRC_CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+static inline __m128 loadPixelPs(const SRC_CHANNEL_TYPE *pixel)
+{
+    if constexpr (std::is_same_v<SRC_CHANNEL_TYPE, Half>) {
+        return _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)pixel));
+    }
+    else if constexpr (std::is_same_v<SRC_CHANNEL_TYPE, uint8_t>) {
+        int32_t packed;
+        std::memcpy(&packed, pixel, sizeof(packed));
+        return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+    }
+    else {
+        static_assert(std::is_same_v<SRC_CHANNEL_TYPE, uint16_t>, "unhandled source type");
+        return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)pixel)));
+    }
+}
+
+template<typename DST_CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+static inline void storePixelPs(DST_CHANNEL_TYPE *pixel, __m128 value)
+{
+    if constexpr (std::is_same_v<DST_CHANNEL_TYPE, Half>) {
+        _mm_storel_epi64((__m128i *)pixel, _mm_cvtps_ph(value, _MM_FROUND_TO_NEAREST_INT));
+    }
+    else {
+        const __m128 maxValue = _mm_set1_ps((float)std::numeric_limits<DST_CHANNEL_TYPE>::max());
+        value = _mm_min_ps(_mm_max_ps(value, _mm_setzero_ps()), maxValue);
+        __m128i u16 = _mm_packus_epi32(_mm_cvttps_epi32(value), _mm_setzero_si128());
+        if constexpr (std::is_same_v<DST_CHANNEL_TYPE, uint16_t>) {
+            _mm_storel_epi64((__m128i *)pixel, u16);
+        }
+        else {
+            static_assert(std::is_same_v<DST_CHANNEL_TYPE, uint8_t>, "unhandled destination type");
+            int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(u16, u16));
+            std::memcpy(pixel, &packed, sizeof(packed));
+        }
+    }
+}
+
+// returns number of pixels converted
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    int ALPHA, AlphaConversion CONVERSION,
+    typename SRC_CHANNEL_TYPE, typename DST_CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+    size_t convertAlphaRow_avx2(const SRC_CHANNEL_TYPE *sourceRow, DST_CHANNEL_TYPE *destRow, size_t width, double toDestScale, double srcUnit)
+{
+    const __m256d scale = _mm256_set1_pd(toDestScale);
+    const __m256d unit = _mm256_set1_pd(srcUnit);
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    for (size_t x = 0; x < width; x++) {
+        __m256d value = loadPixelPd(sourceRow + x * 4);
+        value = _mm256_permute4x64_pd(value, _MM_SHUFFLE(SRC_FOR_DEST3, SRC_FOR_DEST2, SRC_FOR_DEST1, SRC_FOR_DEST0));
+
+        __m256d alpha = _mm256_permute4x64_pd(value, _MM_SHUFFLE(ALPHA, ALPHA, ALPHA, ALPHA));
+        __m256d factor;
+        if constexpr (CONVERSION == AlphaConversion::Premultiply)
+            factor = _mm256_div_pd(alpha, unit);
+        else
+            factor = _mm256_and_pd(_mm256_div_pd(unit, alpha), _mm256_cmp_pd(alpha, _mm256_setzero_pd(), _CMP_GT_OQ));
+        factor = _mm256_blend_pd(factor, one, 1 << ALPHA);
+
+        storePixelPd(destRow + x * 4, _mm256_mul_pd(_mm256_mul_pd(value, scale), factor));
+    }
+    return width;
+}
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    int ALPHA, AlphaConversion CONVERSION,
+    typename SRC_CHANNEL_TYPE, typename DST_CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+    size_t convertAlphaRow_avx2(const SRC_CHANNEL_TYPE *sourceRow, DST_CHANNEL_TYPE *destRow, size_t width, float toDestScale, float srcUnit)
+{
+    const __m128 scale = _mm_set1_ps(toDestScale);
+    const __m128 unit = _mm_set1_ps(srcUnit);
+    const __m128 one = _mm_set1_ps(1.f);
+
+    for (size_t x = 0; x < width; x++) {
+        __m128 value = loadPixelPs(sourceRow + x * 4);
+        value = _mm_shuffle_ps(value, value, _MM_SHUFFLE(SRC_FOR_DEST3, SRC_FOR_DEST2, SRC_FOR_DEST1, SRC_FOR_DEST0));
+
+        __m128 alpha = _mm_shuffle_ps(value, value, _MM_SHUFFLE(ALPHA, ALPHA, ALPHA, ALPHA));
+        __m128 factor;
+        if constexpr (CONVERSION == AlphaConversion::Premultiply)
+            factor = _mm_div_ps(alpha, unit);
+        else
+            factor = _mm_and_ps(_mm_div_ps(unit, alpha), _mm_cmpgt_ps(alpha, _mm_setzero_ps()));
+        factor = _mm_blend_ps(factor, one, 1 << ALPHA);
+
+        storePixelPs(destRow + x * 4, _mm_mul_ps(_mm_mul_ps(value, scale), factor));
+    }
+    return width;
+}
+#endif
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    bool FLIP, int ALPHA, AlphaConversion CONVERSION,
+    typename SRC_CHANNEL_TYPE, typename DST_CHANNEL_TYPE, typename TO_DST_SCALET>
+    void copy_alpha_scaled(const SRC_CHANNEL_TYPE *src, size_t stride, int width, int height,
+        DST_CHANNEL_TYPE *dest, size_t destStride, TO_DST_SCALET toDestScale, TO_DST_SCALET srcUnit)
+{
+    bool useAvx2 = hasAvx2AndF16c();
+    for (size_t row = 0; row < (size_t)height; row++)
+    {
+        const SRC_CHANNEL_TYPE *sourceRow = (const SRC_CHANNEL_TYPE *)((const uint8_t*)src + row * stride);
+        DST_CHANNEL_TYPE *destRow = (DST_CHANNEL_TYPE *)((uint8_t*)dest + (FLIP ? (height - row - 1) : row) * destStride);
+
+        size_t converted = 0;
+#ifdef FDN_X86
+        if (useAvx2)
+            converted = convertAlphaRow_avx2<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3, ALPHA, CONVERSION>(
+                sourceRow, destRow, width, toDestScale, srcUnit);
+#endif
+        convertAlphaRow_scalar<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3, ALPHA, CONVERSION>(
+            sourceRow + converted * 4, destRow + converted * 4, width - converted, toDestScale, srcUnit);
+    }
+}
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3,
+    bool FLIP, int ALPHA = 3, typename SRC_CHANNEL_TYPE, typename DST_CHANNEL_TYPE, typename TO_DST_SCALET>
+    void copy_alpha_scaled(const SRC_CHANNEL_TYPE *src, size_t stride, int width, int height,
+        DST_CHANNEL_TYPE *dest, size_t destStride, TO_DST_SCALET toDestScale, TO_DST_SCALET srcUnit, AlphaConversion conversion)
+{
+    if (conversion == AlphaConversion::Premultiply)
+        copy_alpha_scaled<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3, FLIP, ALPHA, AlphaConversion::Premultiply>(
+            src, stride, width, height, dest, destStride, toDestScale, srcUnit);
+    else
+        copy_alpha_scaled<SRC_FOR_DEST0, SRC_FOR_DEST1, SRC_FOR_DEST2, SRC_FOR_DEST3, FLIP, ALPHA, AlphaConversion::Unpremultiply>(
+            src, stride, width, height, dest, destStride, toDestScale, srcUnit);
+}
+
+static AlphaConversion alphaConversion(FrameAlpha from, FrameAlpha to)
+{
+    if (from == FrameAlpha_Straight && to == FrameAlpha_Premultiplied)
+        return AlphaConversion::Premultiply;
+    if (from == FrameAlpha_Premultiplied && to == FrameAlpha_Straight)
+        return AlphaConversion::Unpremultiply;
+    throw std::runtime_error("unhandled alpha conversion");
+}
+
+
+// first host row holding output rows [y, y + rows), whichever way up the host frame is
+static const uint8_t *hostStripRows(const uint8_t *data, size_t stride, const FrameDef& frameDef, int y, int rows)
+{
+    int hostRow = (frameDef.origin() == FrameOrigin_BottomLeft) ? frameDef.size.height - y - rows : y;
+    return data + hostRow * stride;
+}
+
+static uint8_t *hostStripRows(uint8_t *data, size_t stride, const FrameDef& frameDef, int y, int rows)
+{
+    return const_cast<uint8_t *>(hostStripRows((const uint8_t *)data, stride, frameDef, y, rows));
+}
+
+// streaming stores
+//   frames whose output is larger than the threshold are converted a band of rows at a time into a
+//   buffer that stays in cache, and the band is then written out with non-temporal stores, so that
+//   converting a large frame doesn't evict everything else from the cache.
+
+static std::atomic<size_t> streamingStoreThreshold_{ 16 << 20 };
+
+size_t streamingStoreThreshold()
+{
+    return streamingStoreThreshold_;
+}
+
+void setStreamingStoreThreshold(size_t bytes)
+{
+    streamingStoreThreshold_ = bytes;
+}
+
+static bool streamsOutput(size_t outputSize)
+{
+    return outputSize > streamingStoreThreshold_;
+}
+
+// non-temporal copy; the caller fences once all copies are issued with streamFence
+//   SSE2 streaming stores are x86 only; elsewhere this is a plain copy
+static void streamCopy(uint8_t *dest, const uint8_t *source, size_t size)
+{
+#ifdef FDN_X86
+    size_t unaligned = std::min(size, (size_t)(-(uintptr_t)dest & 15));
+    std::memcpy(dest, source, unaligned);
+    dest += unaligned;
+    source += unaligned;
+    size -= unaligned;
+
+    for (; size >= 64; size -= 64, dest += 64, source += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)source);
+        __m128i b = _mm_loadu_si128((const __m128i *)(source + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(source + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(source + 48));
+        _mm_stream_si128((__m128i *)dest, a);
+        _mm_stream_si128((__m128i *)(dest + 16), b);
+        _mm_stream_si128((__m128i *)(dest + 32), c);
+        _mm_stream_si128((__m128i *)(dest + 48), d);
+    }
+    for (; size >= 16; size -= 16, dest += 16, source += 16)
+        _mm_stream_si128((__m128i *)dest, _mm_loadu_si128((const __m128i *)source));
+#endif
+    std::memcpy(dest, source, size);
+}
+
+// orders streamCopy's stores before any that follow
+static void streamFence()
+{
+#ifdef FDN_X86
+    _mm_sfence();
+#endif
+}
+
+void copyFrameData(uint8_t *dest, const uint8_t *source, size_t size)
+{
+    if (streamsOutput(size)) {
+        streamCopy(dest, source, size);
+        streamFence();
+    }
+    else
+        std::memcpy(dest, source, size);
+}
+
+static const size_t StreamingBandSize = 256 << 10;
+
+static int streamingBandRows(size_t rowSize)
+{
+    return (int)std::max((size_t)1, StreamingBandSize / rowSize);
+}
+
+// host frame -> RGBA, which has rows of destRowSize bytes
+template<typename DST_CHANNEL_TYPE, typename CONVERT>
+static void convertToStreamedBands(const uint8_t *data, size_t stride, const FrameDef& frameDef,
+    DST_CHANNEL_TYPE *dest, size_t destStrideInBytes, CONVERT convert)
+{
+    const int height = frameDef.size.height;
+    const size_t destRowSize = frameDef.size.width * 4 * sizeof(DST_CHANNEL_TYPE);
+    const int bandRows = streamingBandRows(destRowSize);
+    std::vector<DST_CHANNEL_TYPE> band(bandRows * destRowSize / sizeof(DST_CHANNEL_TYPE));
+
+    for (int y = 0; y < height; y += bandRows) {
+        const int rows = std::min(bandRows, height - y);
+        convert(hostStripRows(data, stride, frameDef, y, rows), stride, FrameDef(FrameSize{ frameDef.size.width, rows }, frameDef.format, frameDef.alpha),
+                band.data(), destRowSize);
+        for (int row = 0; row < rows; ++row)
+            streamCopy((uint8_t *)dest + (y + row) * destStrideInBytes, (const uint8_t *)band.data() + row * destRowSize, destRowSize);
+    }
+    streamFence();
+}
+
+// RGBA -> host frame; host rows are banded in host order
+template<typename SRC_CHANNEL_TYPE, typename CONVERT>
+static void convertFromStreamedBands(const SRC_CHANNEL_TYPE *source, uint8_t *data, size_t stride, const FrameDef& frameDef, CONVERT convert)
+{
+    const int height = frameDef.size.height;
+    const size_t hostRowSize = frameDef.size.width * frameDef.bytesPerPixel();
+    const int bandRows = streamingBandRows(hostRowSize);
+    std::vector<uint8_t> band(bandRows * hostRowSize);
+
+    for (int y = 0; y < height; y += bandRows) {
+        const int rows = std::min(bandRows, height - y);
+        convert(source + (size_t)y * frameDef.size.width * 4, band.data(), hostRowSize, FrameDef(FrameSize{ frameDef.size.width, rows }, frameDef.format, frameDef.alpha));
+        uint8_t *hostRows = hostStripRows(data, stride, frameDef, y, rows);
+        for (int row = 0; row < rows; ++row)
+            streamCopy(hostRows + row * stride, band.data() + row * hostRowSize, hostRowSize);
+    }
+    streamFence();
+}
+
+
+static void convertHostFrameTo_RGBA_Top_Left_U16_Cached(const uint8_t *data, size_t stride, const FrameDef& frameDef, uint16_t *dest, size_t destStrideInBytes)
 {
     auto size = frameDef.size;
     switch (frameDef.format)
@@ -115,20 +760,26 @@ void convertHostFrameTo_RGBA_Top_Left_U16(const uint8_t *data, size_t stride, co
             copy_flip_scaled<2, 1, 0, 3>((float *)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.0);
             break;
         case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F32:
-            copy_noflip_scaled<2, 1, 0, 3>((float *)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.0);
+            copy_noflip_scaled<1, 2, 3, 0>((float *)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.0);
+            break;
+        case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+            copy_from_f16_scaled<2, 1, 0, 3, true>((const uint16_t *)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.f);
+            break;
+        case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F16:
+            copy_from_f16_scaled<1, 2, 3, 0, false>((const uint16_t *)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.f);
             break;
         case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
-            copy_flip_scaled<2, 1, 0, 3>((uint8_t *)data, stride, size.width, size.height, dest, destStrideInBytes, 256.0);
+            copy_flip_scaled<2, 1, 0, 3>((uint8_t *)data, stride, size.width, size.height, dest, destStrideInBytes, 257.0);
             break;
         case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8:
-            copy_noflip_scaled<1, 2, 3, 0>((uint8_t *)data, stride, size.width, size.height, dest, destStrideInBytes, 256.0);
+            copy_noflip_scaled<1, 2, 3, 0>((uint8_t *)data, stride, size.width, size.height, dest, destStrideInBytes, 257.0);
             break;
         default:
             throw std::runtime_error("unhandled host format");
     }
 }
 
-void convertRGBA_Top_Left_U16_ToHostFrame(const uint16_t* source, uint8_t *data, size_t stride, const FrameDef& frameDef)
+static void convertRGBA_Top_Left_U16_ToHostFrame_Cached(const uint16_t* source, uint8_t *data, size_t stride, const FrameDef& frameDef)
 {
     auto size = frameDef.size;
     switch (frameDef.format)
@@ -139,6 +790,9 @@ void convertRGBA_Top_Left_U16_ToHostFrame(const uint16_t* source, uint8_t *data,
     case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32:
         copy_flip_scaled<2, 1, 0, 3>((uint16_t *)source, size.width * 8, size.width, size.height, (float*)data, stride, 1.0 / 65535.0);
         break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+        copy_to_f16_scaled<2, 1, 0, 3, true>(source, size.width * 8, size.width, size.height, (uint16_t*)data, stride, 1.f / 65535.f);
+        break;
     case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
         copy_flip_scaled<2, 1, 0, 3>((uint16_t *)source, size.width * 8, size.width, size.height, (uint8_t*)data, stride, 1.0/256.0);
         break;
@@ -148,7 +802,7 @@ void convertRGBA_Top_Left_U16_ToHostFrame(const uint16_t* source, uint8_t *data,
 }
 
 
-void convertHostFrameTo_RGBA_Top_Left_U8(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStrideInBytes)
+static void convertHostFrameTo_RGBA_Top_Left_U8_Cached(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStrideInBytes)
 {
     auto size = frameDef.size;
     switch (frameDef.format)
@@ -163,7 +817,13 @@ void convertHostFrameTo_RGBA_Top_Left_U8(const uint8_t* data, size_t stride, con
         copy_flip_scaled<2, 1, 0, 3>((float*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.0);
         break;
     case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F32:
-        copy_noflip_scaled<2, 1, 0, 3>((float*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.0);
+        copy_noflip_scaled<1, 2, 3, 0>((float*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.0);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+        copy_from_f16_scaled<2, 1, 0, 3, true>((const uint16_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.f);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F16:
+        copy_from_f16_scaled<1, 2, 3, 0, false>((const uint16_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.f);
         break;
     case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
         copy_flip_scaled<2, 1, 0, 3>((uint8_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 1.0);
@@ -176,19 +836,668 @@ void convertHostFrameTo_RGBA_Top_Left_U8(const uint8_t* data, size_t stride, con
     }
 }
 
+static void convertRGBA_Top_Left_U8_ToHostFrame_Cached(const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef)
+{
+    auto size = frameDef.size;
+    switch (frameDef.format)
+    {
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U16_32k:
+        copy_flip_scaled<2, 1, 0, 3>(source, size.width * 4, size.width, size.height, (uint16_t*)data, stride, 32768.0 / 255.0);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32:
+        copy_flip_scaled<2, 1, 0, 3>(source, size.width * 4, size.width, size.height, (float*)data, stride, 1.0 / 255.0);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+        copy_to_f16_scaled<2, 1, 0, 3, true>(source, size.width * 4, size.width, size.height, (uint16_t*)data, stride, 1.f / 255.f);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
+        copy_flip_scaled<2, 1, 0, 3>(source, size.width * 4, size.width, size.height, (uint8_t*)data, stride, 1.0);
+        break;
+    default:
+        throw std::runtime_error("unhandled host format");
+    }
+}
+
+
+static void convertHostFrameTo_RGBA_Top_Left_U16_Cached(const uint8_t *data, size_t stride, const FrameDef& frameDef, uint16_t *dest, size_t destStrideInBytes, FrameAlpha destAlpha)
+{
+    if (frameDef.alpha == destAlpha)
+    {
+        convertHostFrameTo_RGBA_Top_Left_U16_Cached(data, stride, frameDef, dest, destStrideInBytes);
+        return;
+    }
+
+    AlphaConversion conversion = alphaConversion(frameDef.alpha, destAlpha);
+    auto size = frameDef.size;
+    switch (frameDef.format)
+    {
+        case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U16_32k:
+            copy_alpha_scaled<2, 1, 0, 3, true>((const uint16_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.0 / 32768.0, 32768.0, conversion);
+            break;
+        case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U16_32k:
+            copy_alpha_scaled<1, 2, 3, 0, false>((const uint16_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.0 / 32768.0, 32768.0, conversion);
+            break;
+        case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32:
+            copy_alpha_scaled<2, 1, 0, 3, true>((const float*)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.0, 1.0, conversion);
+            break;
+        case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F32:
+            copy_alpha_scaled<1, 2, 3, 0, false>((const float*)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.0, 1.0, conversion);
+            break;
+        case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+            copy_alpha_scaled<2, 1, 0, 3, true>((const Half*)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.f, 1.f, conversion);
+            break;
+        case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F16:
+            copy_alpha_scaled<1, 2, 3, 0, false>((const Half*)data, stride, size.width, size.height, dest, destStrideInBytes, 65535.f, 1.f, conversion);
+            break;
+        case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
+            copy_alpha_scaled<2, 1, 0, 3, true>((const uint8_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 257.0, 255.0, conversion);
+            break;
+        case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8:
+            copy_alpha_scaled<1, 2, 3, 0, false>((const uint8_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 257.0, 255.0, conversion);
+            break;
+        default:
+            throw std::runtime_error("unhandled host format");
+    }
+}
+
+static void convertRGBA_Top_Left_U16_ToHostFrame_Cached(const uint16_t* source, uint8_t *data, size_t stride, const FrameDef& frameDef, FrameAlpha sourceAlpha)
+{
+    if (frameDef.alpha == sourceAlpha)
+    {
+        convertRGBA_Top_Left_U16_ToHostFrame_Cached(source, data, stride, frameDef);
+        return;
+    }
+
+    AlphaConversion conversion = alphaConversion(sourceAlpha, frameDef.alpha);
+    auto size = frameDef.size;
+    switch (frameDef.format)
+    {
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U16_32k:
+        copy_alpha_scaled<2, 1, 0, 3, true>(source, size.width * 8, size.width, size.height, (uint16_t*)data, stride, 32768.0 / 65535.0, 65535.0, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32:
+        copy_alpha_scaled<2, 1, 0, 3, true>(source, size.width * 8, size.width, size.height, (float*)data, stride, 1.0 / 65535.0, 65535.0, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+        copy_alpha_scaled<2, 1, 0, 3, true>(source, size.width * 8, size.width, size.height, (Half*)data, stride, 1.f / 65535.f, 65535.f, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
+        copy_alpha_scaled<2, 1, 0, 3, true>(source, size.width * 8, size.width, size.height, (uint8_t*)data, stride, 1.0 / 256.0, 65535.0, conversion);
+        break;
+    default:
+        throw std::runtime_error("unhandled host format");
+    }
+}
+
+static void convertHostFrameTo_RGBA_Top_Left_U8_Cached(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStrideInBytes, FrameAlpha destAlpha)
+{
+    if (frameDef.alpha == destAlpha)
+    {
+        convertHostFrameTo_RGBA_Top_Left_U8_Cached(data, stride, frameDef, dest, destStrideInBytes);
+        return;
+    }
+
+    AlphaConversion conversion = alphaConversion(frameDef.alpha, destAlpha);
+    auto size = frameDef.size;
+    switch (frameDef.format)
+    {
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U16_32k:
+        copy_alpha_scaled<2, 1, 0, 3, true>((const uint16_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.0 / 32768.0, 32768.0, conversion);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U16_32k:
+        copy_alpha_scaled<1, 2, 3, 0, false>((const uint16_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.0 / 32768.0, 32768.0, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32:
+        copy_alpha_scaled<2, 1, 0, 3, true>((const float*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.0, 1.0, conversion);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F32:
+        copy_alpha_scaled<1, 2, 3, 0, false>((const float*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.0, 1.0, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+        copy_alpha_scaled<2, 1, 0, 3, true>((const Half*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.f, 1.f, conversion);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F16:
+        copy_alpha_scaled<1, 2, 3, 0, false>((const Half*)data, stride, size.width, size.height, dest, destStrideInBytes, 255.f, 1.f, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
+        copy_alpha_scaled<2, 1, 0, 3, true>((const uint8_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 1.0, 255.0, conversion);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8:
+        copy_alpha_scaled<1, 2, 3, 0, false>((const uint8_t*)data, stride, size.width, size.height, dest, destStrideInBytes, 1.0, 255.0, conversion);
+        break;
+    default:
+        throw std::runtime_error("unhandled host format");
+    }
+}
+
+static void convertRGBA_Top_Left_U8_ToHostFrame_Cached(const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef, FrameAlpha sourceAlpha)
+{
+    if (frameDef.alpha == sourceAlpha)
+    {
+        convertRGBA_Top_Left_U8_ToHostFrame_Cached(source, data, stride, frameDef);
+        return;
+    }
+
+    AlphaConversion conversion = alphaConversion(sourceAlpha, frameDef.alpha);
+    auto size = frameDef.size;
+    switch (frameDef.format)
+    {
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U16_32k:
+        copy_alpha_scaled<2, 1, 0, 3, true>(source, size.width * 4, size.width, size.height, (uint16_t*)data, stride, 32768.0 / 255.0, 255.0, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32:
+        copy_alpha_scaled<2, 1, 0, 3, true>(source, size.width * 4, size.width, size.height, (float*)data, stride, 1.0 / 255.0, 255.0, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+        copy_alpha_scaled<2, 1, 0, 3, true>(source, size.width * 4, size.width, size.height, (Half*)data, stride, 1.f / 255.f, 255.f, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
+        copy_alpha_scaled<2, 1, 0, 3, true>(source, size.width * 4, size.width, size.height, (uint8_t*)data, stride, 1.0, 255.0, conversion);
+        break;
+    default:
+        throw std::runtime_error("unhandled host format");
+    }
+}
+
+
+void convertHostFrameTo_RGBA_Top_Left_U16(const uint8_t *data, size_t stride, const FrameDef& frameDef, uint16_t *dest, size_t destStrideInBytes)
+{
+    convertHostFrameTo_RGBA_Top_Left_U16(data, stride, frameDef, dest, destStrideInBytes, frameDef.alpha);
+}
+
+void convertRGBA_Top_Left_U16_ToHostFrame(const uint16_t* source, uint8_t *data, size_t stride, const FrameDef& frameDef)
+{
+    convertRGBA_Top_Left_U16_ToHostFrame(source, data, stride, frameDef, frameDef.alpha);
+}
+
+void convertHostFrameTo_RGBA_Top_Left_U8(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStrideInBytes)
+{
+    convertHostFrameTo_RGBA_Top_Left_U8(data, stride, frameDef, dest, destStrideInBytes, frameDef.alpha);
+}
+
 void convertRGBA_Top_Left_U8_ToHostFrame(const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef)
+{
+    convertRGBA_Top_Left_U8_ToHostFrame(source, data, stride, frameDef, frameDef.alpha);
+}
+
+void convertHostFrameTo_RGBA_Top_Left_U16(const uint8_t *data, size_t stride, const FrameDef& frameDef, uint16_t *dest, size_t destStrideInBytes, FrameAlpha destAlpha)
+{
+    auto convert = [=](const uint8_t *data, size_t stride, const FrameDef& frameDef, uint16_t *dest, size_t destStrideInBytes) {
+        convertHostFrameTo_RGBA_Top_Left_U16_Cached(data, stride, frameDef, dest, destStrideInBytes, destAlpha);
+    };
+    if (streamsOutput(frameDef.size.height * destStrideInBytes))
+        convertToStreamedBands(data, stride, frameDef, dest, destStrideInBytes, convert);
+    else
+        convert(data, stride, frameDef, dest, destStrideInBytes);
+}
+
+void convertRGBA_Top_Left_U16_ToHostFrame(const uint16_t* source, uint8_t *data, size_t stride, const FrameDef& frameDef, FrameAlpha sourceAlpha)
+{
+    auto convert = [=](const uint16_t* source, uint8_t *data, size_t stride, const FrameDef& frameDef) {
+        convertRGBA_Top_Left_U16_ToHostFrame_Cached(source, data, stride, frameDef, sourceAlpha);
+    };
+    if (streamsOutput(frameDef.size.height * stride))
+        convertFromStreamedBands(source, data, stride, frameDef, convert);
+    else
+        convert(source, data, stride, frameDef);
+}
+
+void convertHostFrameTo_RGBA_Top_Left_U8(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStrideInBytes, FrameAlpha destAlpha)
+{
+    auto convert = [=](const uint8_t *data, size_t stride, const FrameDef& frameDef, uint8_t *dest, size_t destStrideInBytes) {
+        convertHostFrameTo_RGBA_Top_Left_U8_Cached(data, stride, frameDef, dest, destStrideInBytes, destAlpha);
+    };
+    if (streamsOutput(frameDef.size.height * destStrideInBytes))
+        convertToStreamedBands(data, stride, frameDef, dest, destStrideInBytes, convert);
+    else
+        convert(data, stride, frameDef, dest, destStrideInBytes);
+}
+
+void convertRGBA_Top_Left_U8_ToHostFrame(const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef, FrameAlpha sourceAlpha)
+{
+    auto convert = [=](const uint8_t* source, uint8_t *data, size_t stride, const FrameDef& frameDef) {
+        convertRGBA_Top_Left_U8_ToHostFrame_Cached(source, data, stride, frameDef, sourceAlpha);
+    };
+    if (streamsOutput(frameDef.size.height * stride))
+        convertFromStreamedBands(source, data, stride, frameDef, convert);
+    else
+        convert(source, data, stride, frameDef);
+}
+
+
+void convertHostFrameAlpha(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStride, FrameAlpha destAlpha)
 {
     auto size = frameDef.size;
+    if (frameDef.alpha == destAlpha)
+    {
+        for (int row = 0; row < size.height; row++)
+            std::memcpy(dest + row * destStride, data + row * stride, frameDef.stride());
+        return;
+    }
+
+    AlphaConversion conversion = alphaConversion(frameDef.alpha, destAlpha);
     switch (frameDef.format)
     {
     case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U16_32k:
-        copy_flip_scaled<2, 1, 0, 3>((uint16_t*)source, size.width * 4, size.width, size.height, (uint16_t*)data, stride, 32768.0 / 255.0);
+        copy_alpha_scaled<0, 1, 2, 3, false, 3>((const uint16_t*)data, stride, size.width, size.height, (uint16_t*)dest, destStride, 1.0, 32768.0, conversion);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U16_32k:
+        copy_alpha_scaled<0, 1, 2, 3, false, 0>((const uint16_t*)data, stride, size.width, size.height, (uint16_t*)dest, destStride, 1.0, 32768.0, conversion);
         break;
     case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32:
-        copy_flip_scaled<2, 1, 0, 3>((uint16_t*)source, size.width * 4, size.width, size.height, (float*)data, stride, 1.0 / 255.0);
+        copy_alpha_scaled<0, 1, 2, 3, false, 3>((const float*)data, stride, size.width, size.height, (float*)dest, destStride, 1.0, 1.0, conversion);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F32:
+        copy_alpha_scaled<0, 1, 2, 3, false, 0>((const float*)data, stride, size.width, size.height, (float*)dest, destStride, 1.0, 1.0, conversion);
+        break;
+    case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16:
+        copy_alpha_scaled<0, 1, 2, 3, false, 3>((const Half*)data, stride, size.width, size.height, (Half*)dest, destStride, 1.f, 1.f, conversion);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F16:
+        copy_alpha_scaled<0, 1, 2, 3, false, 0>((const Half*)data, stride, size.width, size.height, (Half*)dest, destStride, 1.f, 1.f, conversion);
         break;
     case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
-        copy_flip_scaled<2, 1, 0, 3>((uint16_t*)source, size.width * 4, size.width, size.height, (uint8_t*)data, stride, 1.0);
+        copy_alpha_scaled<0, 1, 2, 3, false, 3>((const uint8_t*)data, stride, size.width, size.height, dest, destStride, 1.0, 255.0, conversion);
+        break;
+    case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8:
+        copy_alpha_scaled<0, 1, 2, 3, false, 0>((const uint8_t*)data, stride, size.width, size.height, dest, destStride, 1.0, 255.0, conversion);
+        break;
+    default:
+        throw std::runtime_error("unhandled host format");
+    }
+}
+
+// codecs that don't override this are given straight frames
+void EncoderJob::doCopyExternalToLocalWithAlpha(const uint8_t *data, size_t stride, const FrameDef& frameDef)
+{
+    if (frameDef.alpha == FrameAlpha_Straight)
+    {
+        doCopyExternalToLocal(data, stride, frameDef.format);
+        return;
+    }
+
+    straight_.resize(frameDef.size.height * frameDef.stride());
+    convertHostFrameAlpha(data, stride, frameDef, straight_.data(), frameDef.stride(), FrameAlpha_Straight);
+    doCopyExternalToLocal(straight_.data(), frameDef.stride(), frameDef.format);
+}
+
+
+// block-linear layout
+//   frames are handled a strip of 4 rows at a time. Host rows are converted into a small linear
+//   strip that stays in cache and are then moved into / out of blocks, so the frame itself is
+//   only traversed once. 8 bit BGRA and ARGB host frames are swizzled straight into blocks.
+
+static const int BlockDim = 4;
+
+size_t blockLinearSizeInBytes(const FrameSize& size, size_t bytesPerPixel)
+{
+    size_t blocksWide = (size.width + BlockDim - 1) / BlockDim;
+    size_t blocksHigh = (size.height + BlockDim - 1) / BlockDim;
+    return blocksWide * blocksHigh * BlockDim * BlockDim * bytesPerPixel;
+}
+
+template<typename CHANNEL_TYPE>
+static void stripToBlocks(CHANNEL_TYPE *strip, size_t stripWidth, int width, int rows, int firstBlock, CHANNEL_TYPE *blockRow)
+{
+    const size_t pixelSize = 4 * sizeof(CHANNEL_TYPE);
+
+    // pad the bottom and right edges by repetition
+    for (int row = rows; row < BlockDim; ++row)
+        std::memcpy(strip + row * stripWidth * 4, strip + (rows - 1) * stripWidth * 4, stripWidth * pixelSize);
+    for (int row = 0; row < BlockDim; ++row) {
+        CHANNEL_TYPE *stripRow = strip + row * stripWidth * 4;
+        for (size_t x = width; x < stripWidth; ++x)
+            std::memcpy(stripRow + x * 4, stripRow + (width - 1) * 4, pixelSize);
+    }
+
+    const int blocksWide = (int)(stripWidth / BlockDim);
+    for (int block = 0; block < blocksWide; ++block) {
+        CHANNEL_TYPE *destBlock = blockRow + (firstBlock + block) * BlockDim * BlockDim * 4;
+        for (int row = 0; row < BlockDim; ++row)
+            std::memcpy(destBlock + row * BlockDim * 4, strip + (row * stripWidth + block * BlockDim) * 4, BlockDim * pixelSize);
+    }
+}
+
+template<typename CHANNEL_TYPE>
+static void blocksToStrip(const CHANNEL_TYPE *blockRow, int firstBlock, int width, int rows, CHANNEL_TYPE *strip)
+{
+    const size_t pixelSize = 4 * sizeof(CHANNEL_TYPE);
+    for (int x = 0; x < width; x += BlockDim) {
+        const CHANNEL_TYPE *sourceBlock = blockRow + (firstBlock + x / BlockDim) * BlockDim * BlockDim * 4;
+        int pixels = std::min(BlockDim, width - x);
+        for (int row = 0; row < rows; ++row)
+            std::memcpy(strip + (row * width + x) * 4, sourceBlock + row * BlockDim * 4, pixels * pixelSize);
+    }
+}
+
+// converts output rows [y, y + rows) from column firstBlock * 4 onwards into blocks, via the linear converter
+template<typename DST_CHANNEL_TYPE, typename CONVERT_LINEAR>
+static void convertStripToBlocks(const uint8_t *data, size_t stride, const FrameDef& frameDef, int y, int rows, int firstBlock,
+    std::vector<DST_CHANNEL_TYPE>& strip, DST_CHANNEL_TYPE *blockRow, CONVERT_LINEAR convertLinear)
+{
+    const int x = firstBlock * BlockDim;
+    const int width = frameDef.size.width - x;
+    if (width <= 0)
+        return;
+    const size_t stripWidth = (width + BlockDim - 1) / BlockDim * BlockDim;
+    strip.resize(stripWidth * BlockDim * 4);
+
+    FrameDef stripDef(FrameSize{ width, rows }, frameDef.format);
+    convertLinear(hostStripRows(data, stride, frameDef, y, rows) + x * frameDef.bytesPerPixel(), stride, stripDef,
+                  strip.data(), stripWidth * 4 * sizeof(DST_CHANNEL_TYPE));
+    stripToBlocks(strip.data(), stripWidth, width, rows, firstBlock, blockRow);
+}
+
+template<typename SRC_CHANNEL_TYPE, typename CONVERT_LINEAR>
+static void convertBlocksToStrip(const SRC_CHANNEL_TYPE *blockRow, uint8_t *data, size_t stride, const FrameDef& frameDef, int y, int rows, int firstBlock,
+    std::vector<SRC_CHANNEL_TYPE>& strip, CONVERT_LINEAR convertLinear)
+{
+    const int x = firstBlock * BlockDim;
+    const int width = frameDef.size.width - x;
+    if (width <= 0)
+        return;
+    strip.resize(width * BlockDim * 4);
+
+    blocksToStrip(blockRow, firstBlock, width, rows, strip.data());
+    FrameDef stripDef(FrameSize{ width, rows }, frameDef.format);
+    convertLinear(strip.data(), hostStripRows(data, stride, frameDef, y, rows) + x * frameDef.bytesPerPixel(), stride, stripDef);
+}
+
+#ifdef FDN_X86
+// 8 bit host <-> 8 bit RGBA blocks, 4 rows of 4 pixels per block with a byte shuffle each
+//   returns the number of whole blocks converted. The shuffle is SSSE3, which every cpu with the
+//   AVX2 and F16C of the other kernels has, so these are dispatched on the same check
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3>
+FDN_TARGET_AVX2_F16C
+static int swizzleU8ToBlocks(const uint8_t *firstRow, ptrdiff_t rowStep, int width, uint8_t *blockRow)
+{
+    const __m128i shuffle = _mm_setr_epi8(
+        SRC_FOR_DEST0,      SRC_FOR_DEST1,      SRC_FOR_DEST2,      SRC_FOR_DEST3,
+        SRC_FOR_DEST0 + 4,  SRC_FOR_DEST1 + 4,  SRC_FOR_DEST2 + 4,  SRC_FOR_DEST3 + 4,
+        SRC_FOR_DEST0 + 8,  SRC_FOR_DEST1 + 8,  SRC_FOR_DEST2 + 8,  SRC_FOR_DEST3 + 8,
+        SRC_FOR_DEST0 + 12, SRC_FOR_DEST1 + 12, SRC_FOR_DEST2 + 12, SRC_FOR_DEST3 + 12);
+
+    const int blocksWide = width / BlockDim;
+    for (int block = 0; block < blocksWide; ++block) {
+        __m128i *destBlock = (__m128i *)(blockRow + block * BlockDim * BlockDim * 4);
+        for (int row = 0; row < BlockDim; ++row) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(firstRow + row * rowStep + block * BlockDim * 4));
+            _mm_storeu_si128(destBlock + row, _mm_shuffle_epi8(pixels, shuffle));
+        }
+    }
+    return blocksWide;
+}
+
+template<int SRC_FOR_DEST0, int SRC_FOR_DEST1, int SRC_FOR_DEST2, int SRC_FOR_DEST3>
+FDN_TARGET_AVX2_F16C
+static int swizzleBlocksToU8(const uint8_t *blockRow, int width, uint8_t *firstRow, ptrdiff_t rowStep)
+{
+    const __m128i shuffle = _mm_setr_epi8(
+        SRC_FOR_DEST0,      SRC_FOR_DEST1,      SRC_FOR_DEST2,      SRC_FOR_DEST3,
+        SRC_FOR_DEST0 + 4,  SRC_FOR_DEST1 + 4,  SRC_FOR_DEST2 + 4,  SRC_FOR_DEST3 + 4,
+        SRC_FOR_DEST0 + 8,  SRC_FOR_DEST1 + 8,  SRC_FOR_DEST2 + 8,  SRC_FOR_DEST3 + 8,
+        SRC_FOR_DEST0 + 12, SRC_FOR_DEST1 + 12, SRC_FOR_DEST2 + 12, SRC_FOR_DEST3 + 12);
+
+    const int blocksWide = width / BlockDim;
+    for (int block = 0; block < blocksWide; ++block) {
+        const __m128i *sourceBlock = (const __m128i *)(blockRow + block * BlockDim * BlockDim * 4);
+        for (int row = 0; row < BlockDim; ++row) {
+            __m128i pixels = _mm_loadu_si128(sourceBlock + row);
+            _mm_storeu_si128((__m128i *)(firstRow + row * rowStep + block * BlockDim * 4), _mm_shuffle_epi8(pixels, shuffle));
+        }
+    }
+    return blocksWide;
+}
+#endif
+
+// output row y of a host frame, and the step to the next output row
+static const uint8_t *hostOutputRow(const uint8_t *data, ptrdiff_t stride, const FrameDef& frameDef, int y, ptrdiff_t& rowStep)
+{
+    if (frameDef.origin() == FrameOrigin_BottomLeft) {
+        rowStep = -stride;
+        return data + (frameDef.size.height - 1 - y) * stride;
+    }
+    rowStep = stride;
+    return data + y * stride;
+}
+
+void convertHostFrameTo_RGBA_Top_Left_U8_Blocks(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest)
+{
+    auto convertLinear = [](const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStrideInBytes) {
+        convertHostFrameTo_RGBA_Top_Left_U8_Cached(data, stride, frameDef, dest, destStrideInBytes);
+    };
+
+    const int height = frameDef.size.height;
+    const size_t blockRowSize = blockLinearSizeInBytes(FrameSize{ frameDef.size.width, BlockDim }, 4);
+    const bool streaming = streamsOutput(blockLinearSizeInBytes(frameDef.size, 4));
+    std::vector<uint8_t> strip;
+    std::vector<uint8_t> streamedBlockRow(streaming ? blockRowSize : 0);
+    bool useSwizzle = hasAvx2AndF16c();
+    for (int y = 0; y < height; y += BlockDim)
+    {
+        const int rows = std::min(BlockDim, height - y);
+        uint8_t *blockRow = streaming ? streamedBlockRow.data() : dest + (y / BlockDim) * blockRowSize;
+
+        int converted = 0;
+#ifdef FDN_X86
+        if (useSwizzle && rows == BlockDim)
+        {
+            ptrdiff_t rowStep;
+            const uint8_t *firstRow = hostOutputRow(data, stride, frameDef, y, rowStep);
+            switch (frameDef.format)
+            {
+            case ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8:
+                converted = swizzleU8ToBlocks<2, 1, 0, 3>(firstRow, rowStep, frameDef.size.width, blockRow);
+                break;
+            case ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8:
+                converted = swizzleU8ToBlocks<1, 2, 3, 0>(firstRow, rowStep, frameDef.size.width, blockRow);
+                break;
+            }
+        }
+#endif
+        convertStripToBlocks(data, stride, frameDef, y, rows, converted, strip, blockRow, convertLinear);
+        if (streaming)
+            streamCopy(dest + (y / BlockDim) * blockRowSize, blockRow, blockRowSize);
+    }
+    if (streaming)
+        streamFence();
+}
+
+void convertRGBA_Top_Left_U8_Blocks_ToHostFrame(const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef)
+{
+    auto convertLinear = [](const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef) {
+        convertRGBA_Top_Left_U8_ToHostFrame_Cached(source, data, stride, frameDef);
+    };
+
+    const int height = frameDef.size.height;
+    const size_t blockRowSize = blockLinearSizeInBytes(FrameSize{ frameDef.size.width, BlockDim }, 4);
+    std::vector<uint8_t> strip;
+    bool useSwizzle = hasAvx2AndF16c();
+    for (int y = 0; y < height; y += BlockDim)
+    {
+        const int rows = std::min(BlockDim, height - y);
+        const uint8_t *blockRow = source + (y / BlockDim) * blockRowSize;
+
+        int converted = 0;
+#ifdef FDN_X86
+        if (useSwizzle && rows == BlockDim && frameDef.format == (ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8))
+        {
+            ptrdiff_t rowStep;
+            uint8_t *firstRow = const_cast<uint8_t *>(hostOutputRow(data, stride, frameDef, y, rowStep));
+            converted = swizzleBlocksToU8<2, 1, 0, 3>(blockRow, frameDef.size.width, firstRow, rowStep);
+        }
+#endif
+        convertBlocksToStrip(blockRow, data, stride, frameDef, y, rows, converted, strip, convertLinear);
+    }
+}
+
+void convertHostFrameTo_RGBA_Top_Left_U16_Blocks(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint16_t* dest)
+{
+    auto convertLinear = [](const uint8_t* data, size_t stride, const FrameDef& frameDef, uint16_t* dest, size_t destStrideInBytes) {
+        convertHostFrameTo_RGBA_Top_Left_U16_Cached(data, stride, frameDef, dest, destStrideInBytes);
+    };
+
+    const int height = frameDef.size.height;
+    const size_t blockRowSize = blockLinearSizeInBytes(FrameSize{ frameDef.size.width, BlockDim }, 8) / sizeof(uint16_t);
+    const bool streaming = streamsOutput(blockLinearSizeInBytes(frameDef.size, 8));
+    std::vector<uint16_t> strip;
+    std::vector<uint16_t> streamedBlockRow(streaming ? blockRowSize : 0);
+    for (int y = 0; y < height; y += BlockDim)
+    {
+        uint16_t *blockRow = streaming ? streamedBlockRow.data() : dest + (y / BlockDim) * blockRowSize;
+        convertStripToBlocks(data, stride, frameDef, y, std::min(BlockDim, height - y), 0, strip, blockRow, convertLinear);
+        if (streaming)
+            streamCopy((uint8_t *)(dest + (y / BlockDim) * blockRowSize), (const uint8_t *)blockRow, blockRowSize * sizeof(uint16_t));
+    }
+    if (streaming)
+        streamFence();
+}
+
+void convertRGBA_Top_Left_U16_Blocks_ToHostFrame(const uint16_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef)
+{
+    auto convertLinear = [](const uint16_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef) {
+        convertRGBA_Top_Left_U16_ToHostFrame_Cached(source, data, stride, frameDef);
+    };
+
+    const int height = frameDef.size.height;
+    const size_t blockRowSize = blockLinearSizeInBytes(FrameSize{ frameDef.size.width, BlockDim }, 8) / sizeof(uint16_t);
+    std::vector<uint16_t> strip;
+    for (int y = 0; y < height; y += BlockDim)
+        convertBlocksToStrip(source + (y / BlockDim) * blockRowSize, data, stride, frameDef, y, std::min(BlockDim, height - y), 0, strip, convertLinear);
+}
+
+// 2x2 box filter, for proxies
+//   each destination pixel is the mean of a 2x2 block of source pixels, channel by channel, so the
+//   frame keeps its layout, origin and alpha mode. Integer channels are rounded to nearest; float
+//   channels are summed down the columns first, in the same order by both paths.
+
+FrameSize halfFrameSize(const FrameSize& size)
+{
+    return FrameSize{ size.width / 2, size.height / 2 };
+}
+
+template<typename CHANNEL_TYPE>
+static void downscaleRowByHalf_scalar(const CHANNEL_TYPE *row0, const CHANNEL_TYPE *row1, CHANNEL_TYPE *destRow, size_t width)
+{
+    size_t widthX4 = width * 4;
+    for (size_t i = 0; i < widthX4; ++i) {
+        size_t x = (i / 4) * 8 + i % 4;
+        if constexpr (std::is_same_v<CHANNEL_TYPE, float>) {
+            destRow[i] = ((row0[x] + row1[x]) + (row0[x + 4] + row1[x + 4])) * 0.25f;
+        }
+        else if constexpr (std::is_same_v<CHANNEL_TYPE, Half>) {
+            float left = halfToFloat(row0[x].bits) + halfToFloat(row1[x].bits);
+            float right = halfToFloat(row0[x + 4].bits) + halfToFloat(row1[x + 4].bits);
+            destRow[i].bits = floatToHalf((left + right) * 0.25f);
+        }
+        else {
+            uint32_t sum = (uint32_t)row0[x] + row1[x] + row0[x + 4] + row1[x + 4];
+            destRow[i] = (CHANNEL_TYPE)((sum + 2) >> 2);
+        }
+    }
+}
+
+#ifdef FDN_X86
+// returns number of destination pixels written; half floats are left to the scalar path
+template<typename CHANNEL_TYPE>
+FDN_TARGET_AVX2_F16C
+static size_t downscaleRowByHalf_avx2(const CHANNEL_TYPE *row0, const CHANNEL_TYPE *row1, CHANNEL_TYPE *destRow, size_t width)
+{
+    size_t x = 0;
+    if constexpr (std::is_same_v<CHANNEL_TYPE, uint8_t>) {
+        const __m256i rounding = _mm256_set1_epi16(2);
+        for (; x + 4 <= width; x += 4) {
+            __m256i top = _mm256_loadu_si256((const __m256i *)(row0 + x * 8));
+            __m256i bottom = _mm256_loadu_si256((const __m256i *)(row1 + x * 8));
+
+            // source pixels 0-3 and 4-7 widened to 16 bits and summed down the columns
+            __m256i left = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(top)),
+                                            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bottom)));
+            __m256i right = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(top, 1)),
+                                             _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bottom, 1)));
+
+            // then across pairs of pixels, which are the 64-bit halves of each lane, leaving
+            // destination pixels 0, 2 in the low lane and 1, 3 in the high lane
+            __m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(left, right), _mm256_unpackhi_epi64(left, right));
+            sum = _mm256_srli_epi16(_mm256_add_epi16(sum, rounding), 2);
+            sum = _mm256_permute4x64_epi64(sum, _MM_SHUFFLE(3, 1, 2, 0));
+
+            __m256i u8 = _mm256_packus_epi16(sum, sum);
+            u8 = _mm256_permute4x64_epi64(u8, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i *)(destRow + x * 4), _mm256_castsi256_si128(u8));
+        }
+    }
+    else if constexpr (std::is_same_v<CHANNEL_TYPE, uint16_t>) {
+        const __m256i rounding = _mm256_set1_epi32(2);
+        for (; x + 2 <= width; x += 2) {
+            __m256i top = _mm256_loadu_si256((const __m256i *)(row0 + x * 8));
+            __m256i bottom = _mm256_loadu_si256((const __m256i *)(row1 + x * 8));
+
+            // source pixels 0 | 1 and 2 | 3 widened to 32 bits and summed down the columns
+            __m256i left = _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(top)),
+                                            _mm256_cvtepu16_epi32(_mm256_castsi256_si128(bottom)));
+            __m256i right = _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(top, 1)),
+                                             _mm256_cvtepu16_epi32(_mm256_extracti128_si256(bottom, 1)));
+
+            __m256i sum = _mm256_add_epi32(_mm256_permute2x128_si256(left, right, 0x20),
+                                           _mm256_permute2x128_si256(left, right, 0x31));
+            sum = _mm256_srli_epi32(_mm256_add_epi32(sum, rounding), 2);
+
+            // packs are per 128-bit lane, so reorder the 64-bit pixels afterwards
+            __m256i u16 = _mm256_packus_epi32(sum, sum);
+            u16 = _mm256_permute4x64_epi64(u16, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i *)(destRow + x * 4), _mm256_castsi256_si128(u16));
+        }
+    }
+    else if constexpr (std::is_same_v<CHANNEL_TYPE, float>) {
+        const __m256 quarter = _mm256_set1_ps(0.25f);
+        for (; x + 2 <= width; x += 2) {
+            __m256 left = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8), _mm256_loadu_ps(row1 + x * 8));
+            __m256 right = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8 + 8), _mm256_loadu_ps(row1 + x * 8 + 8));
+            __m256 sum = _mm256_add_ps(_mm256_permute2f128_ps(left, right, 0x20),
+                                       _mm256_permute2f128_ps(left, right, 0x31));
+            _mm256_storeu_ps(destRow + x * 4, _mm256_mul_ps(sum, quarter));
+        }
+    }
+    return x;
+}
+#endif
+
+template<typename CHANNEL_TYPE>
+static void downscaleByHalf(const uint8_t *data, size_t stride, FrameSize destSize, uint8_t *dest, size_t destStride)
+{
+    bool useAvx2 = hasAvx2AndF16c();
+    for (size_t y = 0; y < (size_t)destSize.height; ++y)
+    {
+        const CHANNEL_TYPE *row0 = (const CHANNEL_TYPE *)(data + 2 * y * stride);
+        const CHANNEL_TYPE *row1 = (const CHANNEL_TYPE *)(data + (2 * y + 1) * stride);
+        CHANNEL_TYPE *destRow = (CHANNEL_TYPE *)(dest + y * destStride);
+
+        size_t converted = 0;
+#ifdef FDN_X86
+        if (useAvx2)
+            converted = downscaleRowByHalf_avx2(row0, row1, destRow, destSize.width);
+#endif
+        downscaleRowByHalf_scalar(row0 + converted * 8, row1 + converted * 8, destRow + converted * 4, destSize.width - converted);
+    }
+}
+
+void downscaleHostFrameByHalf(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStride)
+{
+    FrameSize destSize = halfFrameSize(frameDef.size);
+    switch (frameDef.channelFormat()) {
+    case ChannelFormat_U8:
+        downscaleByHalf<uint8_t>(data, stride, destSize, dest, destStride);
+        break;
+    case ChannelFormat_U16:
+    case ChannelFormat_U16_32k:
+        downscaleByHalf<uint16_t>(data, stride, destSize, dest, destStride);
+        break;
+    case ChannelFormat_F16:
+        downscaleByHalf<Half>(data, stride, destSize, dest, destStride);
+        break;
+    case ChannelFormat_F32:
+        downscaleByHalf<float>(data, stride, destSize, dest, destStride);
         break;
     default:
         throw std::runtime_error("unhandled host format");
@@ -8,3 +8,33 @@ void convertHostFrameTo_RGBA_Top_Left_U8(const uint8_t* data, size_t stride, con
 void convertRGBA_Top_Left_U8_ToHostFrame(const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef);
 void convertHostFrameTo_RGBA_Top_Left_U16(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint16_t* dest, size_t destStrideInBytes);
 void convertRGBA_Top_Left_U16_ToHostFrame(const uint16_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef);
+
+// as above, additionally converting from the host frame's alpha (frameDef.alpha) to destAlpha,
+// or from sourceAlpha to the host frame's alpha, in the same pass
+void convertHostFrameTo_RGBA_Top_Left_U8(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStrideInBytes, FrameAlpha destAlpha);
+void convertRGBA_Top_Left_U8_ToHostFrame(const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef, FrameAlpha sourceAlpha);
+void convertHostFrameTo_RGBA_Top_Left_U16(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint16_t* dest, size_t destStrideInBytes, FrameAlpha destAlpha);
+void convertRGBA_Top_Left_U16_ToHostFrame(const uint16_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef, FrameAlpha sourceAlpha);
+
+// host frame -> host frame of the same format, converted from frameDef.alpha to destAlpha
+void convertHostFrameAlpha(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStride, FrameAlpha destAlpha);
+
+// as above, to and from 4x4 block-linear layout for block-compressed codecs: each block holds 16 RGBA pixels
+// in row order, and blocks are in row order from the top left. Blocks overhanging the right or bottom edge
+// are padded by repeating the last column / row; dest and source hold blockLinearSizeInBytes(size, bytes per pixel).
+size_t blockLinearSizeInBytes(const FrameSize& size, size_t bytesPerPixel);
+void convertHostFrameTo_RGBA_Top_Left_U8_Blocks(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest);
+void convertRGBA_Top_Left_U8_Blocks_ToHostFrame(const uint8_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef);
+void convertHostFrameTo_RGBA_Top_Left_U16_Blocks(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint16_t* dest);
+void convertRGBA_Top_Left_U16_Blocks_ToHostFrame(const uint16_t* source, uint8_t* data, size_t stride, const FrameDef& frameDef);
+
+// converted frames larger than the threshold, in bytes, are written with non-temporal stores so they don't
+// evict the caller's working set from cache; copyFrameData applies the same rule to plain copies
+size_t streamingStoreThreshold();
+void setStreamingStoreThreshold(size_t bytes);
+void copyFrameData(uint8_t* dest, const uint8_t* source, size_t size);
+
+// 2x2 box filter of a host frame, for proxies: dest is halfFrameSize(frameDef.size), in the host frame's
+// format. A last odd row or column is dropped.
+FrameSize halfFrameSize(const FrameSize& size);
+void downscaleHostFrameByHalf(const uint8_t* data, size_t stride, const FrameDef& frameDef, uint8_t* dest, size_t destStride);
@@ -609,7 +609,9 @@ AEIO_StartAdding(
                 reserveMetadataSpace,
                 movieFile,
                 audio,
-                false // writeMoovTagEarly
+                false, // writeMoovTagEarly
+                createTeeMovieFiles(filePath),
+                createRenditionFiles(filePath)
             );
         }
         catch (...)
@@ -680,6 +682,19 @@ AEIO_AddFrame(
             throw std::runtime_error("unsupported depth");
         }
 
+        // the output spec's alpha label says whether colour in the world is premultiplied; without
+        // one the frame is taken to be straight, rather than failing it
+        FrameAlpha frameAlpha = FrameAlpha_Straight;
+        AEIO_AlphaLabel alpha;
+        AEFX_CLR_STRUCT(alpha);
+        A_Err alphaErr = suites.IOOutSuite4()->AEGP_GetOutSpecAlphaLabel(outH, &alpha);
+        if (alphaErr) {
+            FDN_WARNING("couldn't get the output's alpha label (error ", alphaErr, "); taking alpha as straight");
+        }
+        else if (alpha.alpha == AEIO_Alpha_PREMUL) {
+            frameAlpha = FrameAlpha_Premultiplied;
+        }
+
         char* rgba_buffer_tl = (char *)wP->data; //!!! PF_GET_PIXEL_DATA16(wP, nullptr, PF_Pixel16**(&bgra_buffer));
         if (!rgba_buffer_tl)
             return A_Err_PARAMETER; //  throw std::runtime_error("could not GetPixels on completed frame");
@@ -687,7 +702,7 @@ AEIO_AddFrame(
 
         try {
             for (auto iFrame = frame_index; iFrame < frame_index + frames; ++iFrame)
-                optionsUP->exporter->dispatchVideo(iFrame, (uint8_t*)rgba_buffer_tl, rgba_stride, format);
+                optionsUP->exporter->dispatchVideo(iFrame, (uint8_t*)rgba_buffer_tl, rgba_stride, format, frameAlpha);
         }
         catch (...)
         {
@@ -8,6 +8,9 @@
 #include "configure.hpp"
 #include "string_conversion.hpp"
 #include "presets.hpp"
+#include <atomic>
+#include <exception>
+#include <thread>
 #include <vector>
 #include <locale>
 
@@ -18,7 +21,8 @@
 
 
 csSDK_int32 GetNumberOfAudioChannels(csSDK_int32 audioChannelType);
-static void renderAndWriteAllAudio(exDoExportRec *exportInfoP, prMALError &error, Exporter& exporter);
+static void renderAndWriteAllAudio(exDoExportRec *exportInfoP, prMALError &error, Exporter& exporter,
+                                   const std::atomic<bool>& abandon, bool reportProgress);
 
 // For SEH and stack dump on win32 this is called from an SEH wrapper
 prMALError wrapped_xSDKExport(csSDK_int32 selector, exportStdParms* stdParmsP, void* param1, void* param2)
@@ -664,6 +668,14 @@ static void renderAndWriteAllVideo(exDoExportRec* exportInfoP, prMALError& error
 
     MovieFile movieFile(createMovieFile(settings->exportFileSuite, exportInfoP->fileObject));
 
+    // and copies of it from the same encode, and renditions of it from the same render, if configured
+    csSDK_int32 outPathLength{ 255 };
+    prUTF16Char outputFilePath[256] = { '\0' };
+    settings->exportFileSuite->GetPlatformPath(exportInfoP->fileObject, &outPathLength, outputFilePath);
+    std::string outputPath = SDKStringConvert::to_string(outputFilePath);
+    std::vector<MovieFile> teeFiles = createTeeMovieFiles(outputPath);
+    std::vector<RenditionFile> renditionFiles = createRenditionFiles(outputPath);
+
     std::optional<AudioDef> audio;
     if (exportInfoP->exportAudio) {
         exParamValues sampleRate, channelType;
@@ -678,6 +690,27 @@ static void renderAndWriteAllVideo(exDoExportRec* exportInfoP, prMALError& error
         };
     };
 
+    // audio is rendered ahead of the video, or if configured on a thread of its own while the video
+    // is exported; either way the writer interleaves it with the frames as they're written
+    bool concurrentAudio = audioRenderConfiguration().concurrent;
+    std::thread audioThread;
+    std::atomic<bool> abandonAudio{ false };
+    prMALError audioError = malNoError;
+    std::exception_ptr audioException;
+    auto joinAudio = [&]() {
+        if (audioThread.joinable())
+            audioThread.join();
+    };
+    auto checkAudio = [&]() {
+        if (audioException)
+            std::rethrow_exception(audioException);
+        if (audioError != malNoError)
+        {
+            error = audioError;
+            throw std::runtime_error("rendering audio failed");
+        }
+    };
+
     try {
         settings->exporter = createExporter(
             frameSize, alpha, videoFormat, chunkCounts, quality,
@@ -686,59 +719,42 @@ static void renderAndWriteAllVideo(exDoExportRec* exportInfoP, prMALError& error
             exportInfoP->reserveMetaDataSpace,
             movieFile,
             audio,
-            true  // writeMoovTagEarly
+            true, // writeMoovTagEarly
+            teeFiles,
+            renditionFiles
         );
 
-        if (audio)
-            renderAndWriteAllAudio(exportInfoP, error, *settings->exporter);
-
-        exportLoop(exportInfoP, error);
-
-        // this may throw
-        try
+        if (audio && concurrentAudio)
+            audioThread = std::thread([&]() {
+                try {
+                    renderAndWriteAllAudio(exportInfoP, audioError, *settings->exporter, abandonAudio, false);
+                }
+                catch (...) {
+                    audioException = std::current_exception();
+                }
+            });
+        else if (audio)
         {
-            settings->exporter->close();
+            renderAndWriteAllAudio(exportInfoP, audioError, *settings->exporter, abandonAudio, true);
+            checkAudio();
         }
-        catch (const MovieWriterInvalidData&)
-        {
-            // this will happen if we MovieWriter didn't guess large enough on header size.
-            //  => we have to guess a header size else Adobe will copy the file and rejig it
-            //     with the header at the start. This is unwanted but unavoidable if the header
-            //     isn't placed ahead of mdat
-            // => simplest way out is to redo the export, without the guess, and let adobe do its copy
-
-            FDN_WARNING("incorrect estimate of header size; re-exporting");
-
-            // start with as clean a slate as possible
-            try {
-                settings->exporter.reset(nullptr);
-            }
-            catch (...)
-            {
-            }
 
-            settings->exporter = createExporter(
-                frameSize, alpha, videoFormat, chunkCounts, quality,
-                frameRate,
-                maxFrames,
-                exportInfoP->reserveMetaDataSpace,
-                movieFile,
-                audio,
-                false   // writeMoovTagEarly
-            );
-
-            if (audio)
-                renderAndWriteAllAudio(exportInfoP, error, *settings->exporter);
+        exportLoop(exportInfoP, error);
 
-            exportLoop(exportInfoP, error);
+        // all of the audio has to reach the writer before it can finish the movie
+        joinAudio();
+        checkAudio();
 
-            settings->exporter->close();
-        }
+        // this may throw. The writer puts the moov after the media if the space reserved for it
+        // ahead of the media turns out to be too small, so this never needs a second export.
+        settings->exporter->close();
     }
     catch (...)
     {
         FDN_DEBUG("exception thrown in renderAndWriteAllVideo");
 
+        abandonAudio = true;
+        joinAudio();
         settings->exporter.reset(nullptr);
         throw;
     }
@@ -762,7 +778,10 @@ csSDK_int32 GetNumberOfAudioChannels(csSDK_int32 audioChannelType)
     return numberOfChannels;
 }
 
-static void renderAndWriteAllAudio(exDoExportRec *exportInfoP, prMALError &error, Exporter& exporter)
+// reportProgress drives the progress bar while the audio is rendered ahead of the video; not when
+// the audio runs alongside the video export loop, which drives it then
+static void renderAndWriteAllAudio(exDoExportRec *exportInfoP, prMALError &error, Exporter& exporter,
+                                   const std::atomic<bool>& abandon, bool reportProgress)
 {
     // All audio calls to and from Premiere use arrays of buffers of 32-bit floats to pass audio.
     // Audio is not interleaved, rather separate channels are stored in separate buffers.
@@ -809,14 +828,17 @@ static void renderAndWriteAllAudio(exDoExportRec *exportInfoP, prMALError &error
     float progress = 0.f;
 	// Annoyingly SetProgressString takes a non-const string argument, so use a buffer
     prUTF16Char tempStrProgress[256];
-    SDKStringConvert::to_buffer(L"Preparing Audio...", tempStrProgress);
-    settings->exportProgressSuite->SetProgressString(exID, tempStrProgress);
+    if (reportProgress)
+    {
+        SDKStringConvert::to_buffer(L"Preparing Audio...", tempStrProgress);
+        settings->exportProgressSuite->SetProgressString(exID, tempStrProgress);
+    }
 
     // GetAudio loop
     csSDK_int32 samplesRequested, maxBlipSize;
     csSDK_int64 samplesExported = 0; // pts
     prMALError resultS = malNoError;
-    while (samplesRemaining && (resultS == malNoError))
+    while (samplesRemaining && (resultS == malNoError) && !abandon)
     {
         // Find size of blip to ask for
         settings->sequenceAudioSuite->GetMaxBlip(audioRenderID, ticksPerFrame.value.timeValue, &maxBlipSize);
@@ -852,14 +874,20 @@ static void renderAndWriteAllAudio(exDoExportRec *exportInfoP, prMALError &error
         samplesRemaining -= samplesRequested;
 
         // Update progress bar percent
-        progress = (float) samplesExported / totalAudioSamples * 0.06f;
-        settings->exportProgressSuite->UpdateProgressPercent(exID, progress);
+        if (reportProgress)
+        {
+            progress = (float) samplesExported / totalAudioSamples * 0.06f;
+            settings->exportProgressSuite->UpdateProgressPercent(exID, progress);
+        }
     }
     error = resultS;
 
     // Reset progress bar label
-    SDKStringConvert::to_buffer(L"", tempStrProgress);
-    settings->exportProgressSuite->SetProgressString(exID, tempStrProgress);
+    if (reportProgress)
+    {
+        SDKStringConvert::to_buffer(L"", tempStrProgress);
+        settings->exportProgressSuite->SetProgressString(exID, tempStrProgress);
+    }
 
     // Free up
     settings->memorySuite->PrDisposePtr((PrMemoryPtr)audioBufferOut);
@@ -0,0 +1,161 @@
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/mem.h>
+}
+
+#include "buffer_pool.hpp"
+#include "config.hpp"
+#include "logging.hpp"
+
+using json = nlohmann::json;
+
+void from_json(const json& j, BufferPoolConfiguration& c) {
+    j.at("maxCachedBytes").get_to(c.maxCachedBytes);
+    j.at("maxBytesInUse").get_to(c.maxBytesInUse);
+}
+
+BufferPoolConfiguration bufferPoolConfiguration()
+{
+    BufferPoolConfiguration config;
+    try {
+        fdn::config().at("bufferPool").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+BufferPool::BufferPool(int64_t maxCachedBytes, int64_t maxBytesInUse)
+    : maxCachedBytes_(maxCachedBytes), maxBytesInUse_(maxBytesInUse)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    trim();
+}
+
+size_t BufferPool::sizeClass(size_t size)
+{
+    const size_t minimum = 4096;
+    if (size <= minimum)
+        return minimum;
+
+    // four steps between each power of two
+    size_t power = minimum;
+    while (power * 2 < size)
+        power *= 2;
+    size_t step = power / 4;
+    return (size + step - 1) / step * step;
+}
+
+uint8_t *BufferPool::allocate(size_t size)
+{
+    size_t sizeClass = BufferPool::sizeClass(size);
+    uint8_t *data = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto cached = cached_.find(sizeClass);
+        if (cached != cached_.end() && !cached->second.empty()) {
+            data = cached->second.back();
+            cached->second.pop_back();
+            bytesCached_ -= sizeClass;
+        }
+    }
+
+    if (!data) {
+        data = (uint8_t *)av_malloc(sizeClass);
+        if (!data)
+            return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    inUse_[data] = sizeClass;
+    bytesInUse_ += sizeClass;
+    return data;
+}
+
+void BufferPool::release(uint8_t *data)
+{
+    if (!data)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        auto inUse = inUse_.find(data);
+        if (inUse != inUse_.end()) {
+            size_t sizeClass = inUse->second;
+            inUse_.erase(inUse);
+            bytesInUse_ -= sizeClass;
+            if (bytesCached_ + (int64_t)sizeClass <= maxCachedBytes_) {
+                cached_[sizeClass].push_back(data);
+                bytesCached_ += sizeClass;
+                return;
+            }
+        }
+    }
+
+    av_free(data);
+}
+
+AVBufferRef *BufferPool::allocateRef(size_t size)
+{
+    uint8_t *data = allocate(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!data)
+        return nullptr;
+    std::memset(data + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+
+    AVBufferRef *ref = av_buffer_create(data, (int)size, releaseRef, this, 0);
+    if (!ref)
+        release(data);
+    return ref;
+}
+
+void BufferPool::releaseRef(void *opaque, uint8_t *data)
+{
+    reinterpret_cast<BufferPool *>(opaque)->release(data);
+}
+
+int64_t BufferPool::bytesInUse() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return bytesInUse_;
+}
+
+int64_t BufferPool::bytesCached() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return bytesCached_;
+}
+
+bool BufferPool::isWithinBudget() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return maxBytesInUse_ < 0 || bytesInUse_ < maxBytesInUse_;
+}
+
+void BufferPool::trim()
+{
+    std::map<size_t, std::vector<uint8_t *>> cached;
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        cached.swap(cached_);
+        bytesCached_ = 0;
+    }
+    for (auto& sizeClass : cached)
+        for (auto data : sizeClass.second)
+            av_free(data);
+}
+
+BufferPool& sessionBufferPool()
+{
+    // never destroyed, as packets and io contexts may outlive static destruction
+    static BufferPool *pool = [] {
+        auto config = bufferPoolConfiguration();
+        return new BufferPool(config.maxCachedBytes, config.maxBytesInUse);
+    }();
+    return *pool;
+}
@@ -0,0 +1,63 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+// buffer pool configuration, from the "bufferPool" section of config.json
+struct BufferPoolConfiguration
+{
+    int64_t maxCachedBytes{ 256 << 20 };  // released buffers beyond this are freed
+    int64_t maxBytesInUse{ -1 };          // exporters and importers add no workers beyond this; -1 for no limit
+};
+
+BufferPoolConfiguration bufferPoolConfiguration();
+
+// thread-safe pool of av_malloc'd buffers for libav packet and AVIO buffers
+//   sizes are rounded up to one of four classes per power of two, so a buffer released by one
+//   frame is reused by the next frame of similar size. Buffers not allocated here are av_free'd on
+//   release, so buffers libav has reallocated behind our back can be handed back safely.
+class BufferPool
+{
+public:
+    BufferPool(int64_t maxCachedBytes, int64_t maxBytesInUse = -1);
+    ~BufferPool();
+
+    uint8_t *allocate(size_t size);
+    void release(uint8_t *data);
+
+    // a reference counted buffer with AV_INPUT_BUFFER_PADDING_SIZE zeroed bytes after size, returned
+    // to the pool when the last reference is released
+    AVBufferRef *allocateRef(size_t size);
+
+    int64_t bytesInUse() const;
+    int64_t bytesCached() const;
+    bool isWithinBudget() const;  // bytesInUse below maxBytesInUse, counted towards the memory budget
+    void trim();  // free all cached buffers
+
+    static size_t sizeClass(size_t size);
+
+private:
+    static void releaseRef(void *opaque, uint8_t *data);
+
+    const int64_t maxCachedBytes_;
+    const int64_t maxBytesInUse_;
+
+    mutable std::mutex mutex_;
+    std::map<size_t, std::vector<uint8_t *>> cached_;  // by size class
+    std::unordered_map<uint8_t *, size_t> inUse_;      // size class of each outstanding buffer
+    int64_t bytesInUse_{ 0 };
+    int64_t bytesCached_{ 0 };
+};
+
+// the pool shared by the readers and writers of a session, configured from config.json
+BufferPool& sessionBufferPool();
+
+#endif
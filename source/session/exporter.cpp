@@ -1,10 +1,14 @@
+#include <algorithm>
 #include <chrono>
 #include <optional>
 #include <thread>
 
+#include "buffer_pool.hpp"
 #include "config.hpp"
 #include "exporter.hpp"
 #include "logging.hpp"
+#include "util.hpp"
+#include "write_behind_file.hpp"
 
 #ifdef WIN32
 #define NOMINMAX
@@ -26,6 +30,94 @@ void from_json(const json& j, ExporterConfiguration& c) {
     j.at("maxWorkers").get_to(c.maxWorkers);
 }
 
+void from_json(const json& j, TeeConfiguration& c) {
+    j.at("directories").get_to(c.directories);
+    j.at("queuedFrames").get_to(c.queuedFrames);
+}
+
+TeeConfiguration teeConfiguration()
+{
+    TeeConfiguration config;
+    try {
+        fdn::config().at("tee").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+void from_json(const json& j, AudioRenderConfiguration& c) {
+    j.at("concurrent").get_to(c.concurrent);
+}
+
+AudioRenderConfiguration audioRenderConfiguration()
+{
+    AudioRenderConfiguration config;
+    try {
+        fdn::config().at("audio").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+std::vector<MovieFile> createTeeMovieFiles(const fs::path& outputPath)
+{
+    std::vector<MovieFile> files;
+    for (const auto& directory : teeConfiguration().directories)
+    {
+        fs::path path = fs::path(directory) / outputPath.filename();
+        try {
+            if (fs::equivalent(path.parent_path(), outputPath.parent_path()))
+                continue;   // the host's file
+        }
+        catch (const std::exception& ex) {
+            FDN_ERROR("not writing to ", directory, ": ", ex.what());
+            continue;
+        }
+        files.push_back(createMovieFile(path.string()));
+    }
+    return files;
+}
+
+void from_json(const json& j, RenditionConfiguration& c) {
+    j.at("suffix").get_to(c.suffix);
+    j.at("downscale").get_to(c.downscale);
+    j.at("quality").get_to(c.quality);
+}
+
+std::vector<RenditionConfiguration> renditionConfigurations()
+{
+    std::vector<RenditionConfiguration> configs;
+    try {
+        fdn::config().at("renditions").get_to(configs);
+    }
+    catch (...)
+    {
+    }
+    return configs;
+}
+
+std::vector<RenditionFile> createRenditionFiles(const fs::path& outputPath)
+{
+    std::vector<RenditionFile> files;
+    for (const auto& rendition : renditionConfigurations())
+    {
+        int downscale = rendition.downscale;
+        if (rendition.suffix.empty() || downscale < 1 || (downscale & (downscale - 1)) != 0)
+        {
+            FDN_ERROR("not writing rendition \"", rendition.suffix, "\": it needs a suffix, and a downscale that is a power of 2");
+            continue;
+        }
+        fs::path path = outputPath.parent_path()
+                        / (outputPath.stem().string() + rendition.suffix + outputPath.extension().string());
+        files.push_back(RenditionFile{ downscale, rendition.quality, createMovieFile(path.string()) });
+    }
+    return files;
+}
+
 ExporterJobEncoder::ExporterJobEncoder(std::atomic<bool>& error)
     : nEncodeJobs_(0), error_(error)
 {
@@ -80,15 +172,175 @@ void ExporterJobEncoder::flush()
     }
 }
 
-ExporterJobWriter::ExporterJobWriter(std::unique_ptr<MovieWriter> writer)
+AVBufferRef *EncodeOutputPool::wrap(EncodeOutput& output)
+{
+    auto held = std::make_unique<Held>();
+    held->pool = this;
+    held->buffer.swap(output.buffer);
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (!free_.empty()) {
+            output.buffer.swap(free_.back());
+            free_.pop_back();
+        }
+    }
+
+    AVBufferRef *ref = av_buffer_create(held->buffer.data(), (int)held->buffer.size(), release, held.get(), 0);
+    if (!ref)
+    {
+        output.buffer.swap(held->buffer);
+        throw std::runtime_error("couldn't reference encoded frame");
+    }
+    held.release();  // until release
+    return ref;
+}
+
+void EncodeOutputPool::release(void *opaque, uint8_t *data)
+{
+    std::unique_ptr<Held> held(reinterpret_cast<Held *>(opaque));
+    std::lock_guard<std::mutex> guard(held->pool->mutex_);
+    held->pool->free_.push_back(std::move(held->buffer));
+}
+
+ExporterTeeDestination::ExporterTeeDestination(std::unique_ptr<MovieWriter> writer, const std::string& name, size_t maxQueuedFrames)
+  : writer_(std::move(writer)), name_(name), maxQueuedFrames_(std::max(maxQueuedFrames, size_t{ 1 }))
+{
+    thread_ = std::thread(&ExporterTeeDestination::run, this);
+}
+
+ExporterTeeDestination::~ExporterTeeDestination()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        closing_ = true;
+    }
+    changed_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void ExporterTeeDestination::writeVideoFrame(AVBufferRef *frame)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        changed_.wait(lock, [&]() { return queue_.size() < maxQueuedFrames_ || failed_; });
+        if (!failed_)
+        {
+            queue_.push(frame);
+            frame = nullptr;
+        }
+    }
+    changed_.notify_all();
+    av_buffer_unref(&frame);  // if it wasn't queued
+}
+
+void ExporterTeeDestination::preloadAudio(const uint8_t *data, size_t size, int64_t pts)
+{
+    if (failed_)
+        return;
+    try {
+        writer_->preloadAudio(data, size, pts);
+    }
+    catch (const std::exception& ex) {
+        fail(ex.what());
+    }
+}
+
+void ExporterTeeDestination::appendAudio(const uint8_t *data, size_t size)
+{
+    if (failed_)
+        return;
+    try {
+        writer_->appendAudio(data, size);
+    }
+    catch (const std::exception& ex) {
+        fail(ex.what());
+    }
+}
+
+void ExporterTeeDestination::close()
+{
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        closing_ = true;
+    }
+    changed_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+
+    try {
+        if (!failed_)
+        {
+            writer_->flush();
+            writer_->writeTrailer();
+        }
+        writer_->close();
+        if (!failed_)
+            FDN_INFO("finished writing to ", name_);
+    }
+    catch (const std::exception& ex) {
+        fail(ex.what());
+    }
+}
+
+void ExporterTeeDestination::fail(const std::string& reason)
+{
+    FDN_ERROR("stopped writing to ", name_, ": ", reason);
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        failed_ = true;
+    }
+    changed_.notify_all();  // anyone waiting to queue a frame
+}
+
+void ExporterTeeDestination::run()
+{
+    FDN_NAME_THREAD("tee "s + name_);
+
+    for (;;)
+    {
+        AVBufferRef *frame = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [&]() { return !queue_.empty() || closing_; });
+            if (queue_.empty())
+                return;
+            frame = queue_.front();
+            queue_.pop();
+        }
+        changed_.notify_all();
+
+        if (failed_)
+        {
+            av_buffer_unref(&frame);
+            continue;
+        }
+        try {
+            writer_->writeVideoFrame(frame);  // takes the reference whether or not it throws
+        }
+        catch (const std::exception& ex) {
+            fail(ex.what());
+        }
+    }
+}
+
+ExporterJobWriter::ExporterJobWriter(std::unique_ptr<MovieWriter> writer,
+                                     std::vector<std::unique_ptr<MovieWriter>> teeWriters)
   : writer_(std::move(writer)),
     utilisation_(1.)
 {
+    auto tee = teeConfiguration();
+    for (auto& teeWriter : teeWriters)
+        tee_.push_back(std::make_unique<ExporterTeeDestination>(
+            std::move(teeWriter), "destination "s + std::to_string(tee_.size() + 1), (size_t)tee.queuedFrames));
 }
 
 void ExporterJobWriter::writeAudioFrame(const uint8_t *data, size_t size, int64_t pts)
 {
-    writer_->writeAudioFrame(data, size, pts);
+    // held by the writer until the video frames it goes with are written
+    for (auto& destination : tee_)
+        destination->preloadAudio(data, size, pts);
+    writer_->preloadAudio(data, size, pts);
 }
 
 void ExporterJobWriter::enqueueWrite(std::future<ExportJob> encoded)
@@ -97,7 +349,7 @@ void ExporterJobWriter::enqueueWrite(std::future<ExportJob> encoded)
     writeQueue_.push(std::move(encoded));
 }
 
-ExportJob ExporterJobWriter::write()
+bool ExporterJobWriter::write()
 {
     std::lock_guard<std::mutex> guard(mutex_);
     std::optional<std::future<ExportJob>> earliestFutureWriteJob;
@@ -111,7 +363,7 @@ ExportJob ExporterJobWriter::write()
             earliestFutureWriteJob = std::move(writeQueue_.front());
             writeQueue_.pop();
         } else
-            return nullptr;
+            return false;
     }
 
     try {
@@ -127,10 +379,25 @@ ExportJob ExporterJobWriter::write()
         writeStart_ = std::chrono::high_resolution_clock::now();
 
         if (job->type() == ExportJobType::Video) {
-            writer_->writeVideoFrame(&job->output.buffer[0], job->output.buffer.size());
+            // the muxer holds the encoded frame itself, rather than a copy, while it interleaves,
+            // as does each of the other destinations, with a reference of its own
+            AVBufferRef *encoded = outputPool_.wrap(job->output);
+            for (auto& destination : tee_) {
+                AVBufferRef *shared = av_buffer_ref(encoded);
+                if (!shared) {
+                    av_buffer_unref(&encoded);
+                    throw std::runtime_error("couldn't reference encoded frame");
+                }
+                destination->writeVideoFrame(shared);
+            }
+            writer_->writeVideoFrame(encoded);
         }
         else {
-            writer_->writeAudioFrame(&job->output.buffer[0], job->output.buffer.size(), job->iFrameOrPts);
+            // repacketized into chunks of whole frames; the host's pts is only as exact as its
+            // time scale, and the dispatch order is the order of the audio anyway
+            for (auto& destination : tee_)
+                destination->appendAudio(job->output.buffer.data(), job->output.buffer.size());
+            writer_->appendAudio(job->output.buffer.data(), job->output.buffer.size());
         }
         auto writeEnd = std::chrono::high_resolution_clock::now();
 
@@ -147,7 +414,7 @@ ExportJob ExporterJobWriter::write()
         std::chrono::duration<double, std::milli> durationInMs = writeTime;
         FDN_DEBUG(job->name, " writing took ", durationInMs.count(), "ms  utilisation=", utilisation_);
 
-        return job;
+        return true;
     }
     catch (...) {
         error_ = true;
@@ -157,6 +424,10 @@ ExportJob ExporterJobWriter::write()
 
 void ExporterJobWriter::close()
 {
+    // the other destinations are finished whether or not this one is, and report their own errors
+    for (auto& destination : tee_)
+        destination->close();
+
     if (!error_)
     {
         writer_->flush();
@@ -250,8 +521,7 @@ void ExporterWorker::run()
                 //       each job must do one write
                 do
                 {
-                    ExportJob written = jobWriter_.write();
-                    if (written)
+                    if (jobWriter_.write())
                     {
                         break;
                     }
@@ -279,7 +549,8 @@ void ExporterWorker::run()
 
 Exporter::Exporter(
     UniqueEncoder encoder,
-    std::unique_ptr<MovieWriter> movieWriter)
+    std::unique_ptr<MovieWriter> movieWriter,
+    std::vector<std::unique_ptr<MovieWriter>> teeWriters)
   : encoder_(std::move(encoder)),
     videoJobFreeList_(std::function<std::unique_ptr<VideoExportJob>()>([&]() {
                         return std::make_unique<VideoExportJob>(encoder_->create());
@@ -288,7 +559,7 @@ Exporter::Exporter(
                         return std::make_unique<AudioExportJob>();
                       })),
     jobEncoder_(error_),
-    jobWriter_(std::move(movieWriter))
+    jobWriter_(std::move(movieWriter), std::move(teeWriters))
 {
 
     ExporterConfiguration config;
@@ -348,13 +619,16 @@ void Exporter::close()
         // finalise and close the file.
         jobWriter_.close();
 
+        for (auto& rendition : renditions_)
+            rendition.exporter->close();
+
         if (error_)
             throw std::runtime_error("error writing");
     }
 }
 
 
-void Exporter::dispatchVideo(int64_t iFrame, const uint8_t* data, size_t stride, FrameFormat format) const
+void Exporter::dispatchVideo(int64_t iFrame, const uint8_t* data, size_t stride, FrameFormat format, FrameAlpha alpha) const
 {
     // it is not clear from the docs whether or not frames are completed and passed in strict order
     // nevertheless we must make that assumption because
@@ -410,12 +684,41 @@ void Exporter::dispatchVideo(int64_t iFrame, const uint8_t* data, size_t stride,
     //       performance gain
 
     auto start = std::chrono::high_resolution_clock::now();
-    static_cast<VideoExportJob&>(*job).codecJob->copyExternalToLocal(data, stride, format);
+    static_cast<VideoExportJob&>(*job).codecJob->copyExternalToLocal(data, stride, FrameDef(encoder_->parameters().frameSize, format, alpha));
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double, std::milli> durationInMs = end - start;
     FDN_DEBUG(job->name, " queuing took ", durationInMs.count(), "ms");
 
     jobEncoder_.push(std::move(job));
+
+    if (!renditions_.empty())
+        dispatchRenditions(iFrame, data, stride, format, alpha);
+}
+
+void Exporter::dispatchRenditions(int64_t iFrame, const uint8_t* data, size_t stride, FrameFormat format, FrameAlpha alpha) const
+{
+    // each halving is made from the one before, and shared by the renditions at its size.
+    // Renditions copy the frame before their dispatch returns, so the buffers are free for the next.
+    FrameDef frameDef(encoder_->parameters().frameSize, format, alpha);
+    size_t halvings = 0;
+    for (const auto& rendition : renditions_)
+    {
+        while ((1 << halvings) < rendition.downscale)
+        {
+            if (downscaled_.size() <= halvings)
+                downscaled_.emplace_back();
+            FrameDef halfDef(halfFrameSize(frameDef.size), format, alpha);
+            std::vector<uint8_t>& half = downscaled_[halvings];
+            half.resize(halfDef.stride() * halfDef.size.height);
+            downscaleHostFrameByHalf(data, stride, frameDef, half.data(), halfDef.stride());
+
+            data = half.data();
+            stride = halfDef.stride();
+            frameDef = halfDef;
+            ++halvings;
+        }
+        rendition.exporter->dispatchVideo(iFrame, data, stride, format, alpha);
+    }
 }
 
 void Exporter::dispatchAudio(int64_t pts, const uint8_t* data, size_t size) const
@@ -450,11 +753,29 @@ void Exporter::dispatchAudio(int64_t pts, const uint8_t* data, size_t size) cons
 
     // !!! could go straight to the writer here
     jobEncoder_.push(std::move(job));
+
+    for (const auto& rendition : renditions_)
+        rendition.exporter->dispatchAudio(pts, data, size);
 }
 
 void Exporter::writeAudioFrame(const uint8_t *data, size_t size, int64_t pts)
 {
     jobWriter_.writeAudioFrame(data, size, pts);
+
+    for (auto& rendition : renditions_)
+        rendition.exporter->writeAudioFrame(data, size, pts);
+}
+
+void Exporter::addRendition(int downscale, std::unique_ptr<Exporter> rendition)
+{
+    if (downscale < 1 || (downscale & (downscale - 1)) != 0)
+        throw std::runtime_error("rendition downscale must be a power of 2");
+    if (currentFrame_)
+        throw std::runtime_error("renditions must be added before the first frame is dispatched");
+
+    auto after = std::upper_bound(renditions_.begin(), renditions_.end(), downscale,
+                                  [](int downscale, const Rendition& rendition) { return downscale < rendition.downscale; });
+    renditions_.insert(after, Rendition{ downscale, std::move(rendition) });
 }
 
 // returns true if pool was expanded
@@ -462,7 +783,7 @@ bool Exporter::expandWorkerPoolToCapacity() const
 {
     bool isNotThreadLimited = workers_.size() < concurrentThreadsSupported_;
     bool isNotOutputLimited = jobWriter_.utilisation() < 0.99;
-    bool isNotBufferLimited = true;  // TODO: get memoryUsed < maxMemoryCapacity from Adobe API
+    bool isNotBufferLimited = sessionBufferPool().isWithinBudget();
 
     if (isNotThreadLimited && isNotOutputLimited && isNotBufferLimited) {
         workers_.push_back(std::make_unique<ExporterWorker>(error_, jobEncoder_, jobWriter_,
@@ -479,7 +800,9 @@ std::unique_ptr<Exporter> createExporter(
     int32_t maxFrames, int32_t reserveMetadataSpace,
     const MovieFile& file,
     std::optional<AudioDef> audio,
-    bool writeMoovTagEarly
+    bool writeMoovTagEarly,
+    const std::vector<MovieFile>& teeFiles,
+    const std::vector<RenditionFile>& renditionFiles
 )
 {
     std::unique_ptr<EncoderParametersBase> parameters = std::make_unique<EncoderParametersBase>(
@@ -505,15 +828,82 @@ std::unique_ptr<Exporter> createExporter(
         maxFrames
     };
 
-    std::unique_ptr<MovieWriter> writer = std::make_unique<MovieWriter>(
-        reserveMetadataSpace,
-        file,
-        video,
-        audio,
-        writeMoovTagEarly   // writeMoovTagEarly
-        );
+    auto sidecar = sidecarConfiguration();
+    auto writeBehind = writeBehindConfiguration();
+    auto fragment = fragmentConfiguration();
+    auto muxer = muxerConfiguration();
+    auto createWriter = [&](const MovieFile& file) {
+        MovieFile movieFile(file);
+        if (!sidecar.enabled)
+            movieFile.onWriteSidecar = nullptr;
+        // overlap muxing with disk io
+        if (writeBehind.enabled)
+            movieFile = createWriteBehindMovieFile(movieFile, writeBehind);
+
+        return std::make_unique<MovieWriter>(
+            reserveMetadataSpace,
+            movieFile,
+            video,
+            audio,
+            writeMoovTagEarly,  // writeMoovTagEarly
+            0,                  // avioBufferSize, from the video
+            fragment.enabled ? fragment.interval : 0.0,
+            muxer.native,
+            muxer.frameAlignment,
+            std::max(audioChunkConfiguration().frames, 1)
+            );
+    };
+    std::unique_ptr<MovieWriter> writer = createWriter(file);
+
+    // for preallocation; getPixelFormatSize is the same estimate the hosts use to check free space
+    double seconds = (double)maxFrames * frameRate.denominator / frameRate.numerator;
+    double predictedFileSize = CodecRegistry::getPixelFormatSize(alpha, videoFormat, quality)
+                                   * frameSize.width * frameSize.height * maxFrames;
+    if (audio)
+        predictedFileSize += seconds * audio->sampleRate * audio->numChannels * audio->bytesPerSample;
+    if (muxer.native && muxer.frameAlignment > 1)
+        predictedFileSize += (double)muxer.frameAlignment * maxFrames;  // padding ahead of each frame
+    auto preallocation = preallocationConfiguration();
+    int64_t reserveFileSize = preallocation.enabled
+        ? (int64_t)(predictedFileSize * (1.0 + std::max(preallocation.headroom, 0.0)))
+        : 0;
+
+    writer->writeHeader(reserveFileSize);
+
+    // a destination that can't be started is left out, rather than failing the export
+    std::vector<std::unique_ptr<MovieWriter>> teeWriters;
+    for (const auto& teeFile : teeFiles)
+    {
+        try {
+            auto teeWriter = createWriter(teeFile);
+            teeWriter->writeHeader(reserveFileSize);
+            teeWriters.push_back(std::move(teeWriter));
+        }
+        catch (const std::exception& ex) {
+            FDN_ERROR("not writing to one of the further destinations: ", ex.what());
+        }
+    }
 
-    writer->writeHeader();
+    auto exporter = std::make_unique<Exporter>(std::move(encoder), std::move(writer), std::move(teeWriters));
+
+    // each rendition is an export of its own, fed by this one
+    for (const auto& rendition : renditionFiles)
+    {
+        FrameSize renditionSize{ frameSize.width / rendition.downscale, frameSize.height / rendition.downscale };
+        if (renditionSize.width == 0 || renditionSize.height == 0)
+        {
+            FDN_ERROR("not writing a rendition at 1/", rendition.downscale, " of ", frameSize.width, "x", frameSize.height);
+            continue;
+        }
+        exporter->addRendition(rendition.downscale, createExporter(
+            renditionSize, alpha, videoFormat, chunkCounts,
+            (rendition.quality == -1) ? quality : rendition.quality,
+            frameRate,
+            maxFrames, reserveMetadataSpace,
+            rendition.file,
+            audio,
+            writeMoovTagEarly));
+    }
 
-    return std::make_unique<Exporter>(std::move(encoder), std::move(writer));
+    return exporter;
 }
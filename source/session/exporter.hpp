@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
 #include <future>
 #include <list>
 #include <mutex>
@@ -83,15 +84,128 @@ private:
     std::atomic<bool> &error_;  // watch when flushing queue
 };
 
+// thread-safe recycler of EncodeOutput buffers handed to the muxer by reference
+//   wrap takes the encoded frame out of an EncodeOutput, leaving a recycled buffer in its place, so
+//   the job can go back to its free list while the muxer holds the frame. The frame's buffer comes
+//   back here when the muxer releases it, for the next job that's written.
+class EncodeOutputPool
+{
+public:
+    AVBufferRef *wrap(EncodeOutput& output);
+
+private:
+    struct Held
+    {
+        EncodeOutputPool *pool;
+        std::vector<uint8_t> buffer;
+    };
+    static void release(void *opaque, uint8_t *data);
+
+    std::mutex mutex_;
+    std::vector<std::vector<uint8_t>> free_;
+};
+
+// further destinations for an export, from the "tee" section of config.json
+//   the export is written to a movie of the same name in each of "directories" as well as to the
+//   host's file, from the one encode. Each destination has a writer thread of its own, which may fall
+//   up to "queuedFrames" frames behind the others before it holds them up.
+struct TeeConfiguration
+{
+    std::vector<std::string> directories;
+    int queuedFrames{ 32 };
+};
+
+TeeConfiguration teeConfiguration();
+
+// audio rendering, from the "audio" section of config.json
+//   hosts that render the audio separately from the video (Premiere) render all of it ahead of the
+//   video, reporting its progress. With "concurrent" set they render it on a thread of their own
+//   while the video is exported instead, so that neither waits on the other; see writeAudioFrame
+struct AudioRenderConfiguration
+{
+    bool concurrent{ false };
+};
+
+AudioRenderConfiguration audioRenderConfiguration();
+
+// files for the movie named as outputPath in each of the configured directories
+std::vector<MovieFile> createTeeMovieFiles(const fs::path& outputPath);
+
+// further renditions of an export, from the "renditions" section of config.json
+//   each is an encode of the export at 1/"downscale" of its width and height - 1, 2, 4, 8 and so on -
+//   at "quality", or at the export's own quality where that is -1. It is written to a movie named as
+//   the host's with "suffix" before the extension, alongside it.
+struct RenditionConfiguration
+{
+    std::string suffix;
+    int downscale{ 1 };
+    int quality{ -1 };
+};
+
+std::vector<RenditionConfiguration> renditionConfigurations();
+
+struct RenditionFile
+{
+    int downscale;
+    int quality;      // -1 for the export's own
+    MovieFile file;
+};
+
+// files for each of the configured renditions of the movie at outputPath; renditions that aren't
+// valid are logged and left out
+std::vector<RenditionFile> createRenditionFiles(const fs::path& outputPath);
+
+// a destination for an export besides the host's file, with a thread of its own writing the frames
+// queued for it
+//   frames are shared by reference with the other destinations rather than copied. An error is kept
+//   to the destination it happens in: it is logged, the destination stops taking frames, and the
+//   export carries on without it.
+class ExporterTeeDestination
+{
+public:
+    ExporterTeeDestination(std::unique_ptr<MovieWriter> writer, const std::string& name, size_t maxQueuedFrames);
+    ~ExporterTeeDestination();
+
+    void writeVideoFrame(AVBufferRef *frame);  // takes ownership; waits while maxQueuedFrames are queued
+    void preloadAudio(const uint8_t *data, size_t size, int64_t pts);
+    void appendAudio(const uint8_t *data, size_t size);
+
+    void close();  // writes out the queue and finishes the movie. Doesn't throw; see failed
+
+    bool failed() const { return failed_; }
+
+    // noncopyable
+    ExporterTeeDestination(const ExporterTeeDestination&) = delete;
+    ExporterTeeDestination& operator=(const ExporterTeeDestination&) = delete;
+
+private:
+    void run();
+    void fail(const std::string& reason);
+
+    std::unique_ptr<MovieWriter> writer_;
+    std::string name_;
+    size_t maxQueuedFrames_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::queue<AVBufferRef *> queue_;
+    bool closing_{false};
+    std::atomic<bool> failed_{false};
+
+    std::thread thread_;  // last, so that it starts after everything it uses
+};
+
 // thread-safe writer of ExportJob
 class ExporterJobWriter
 {
 public:
-    ExporterJobWriter(std::unique_ptr<MovieWriter> writer);
+    // every job is written to writer, and to each of teeWriters; see ExporterTeeDestination
+    ExporterJobWriter(std::unique_ptr<MovieWriter> writer,
+                      std::vector<std::unique_ptr<MovieWriter>> teeWriters = {});
 
-    // !!! not thread-safe; must be called before jobs get dispatched
-    // !!! primarily for Premiere to preload audio
-    // !!! should be removed and enqueueWrite used instead
+    // thread-safe, and may be called while jobs are dispatched and written
+    // primarily for Premiere to preload audio, which MovieWriter::preloadAudio interleaves
+    // with the video frames as they are written
     void writeAudioFrame(const uint8_t *data, size_t size, int64_t pts);
 
     // frames may arrive out of order due to encoding taking varied lengths of time
@@ -103,14 +217,16 @@ public:
 
     void close();  // call ahead of destruction in order to recognise errors
 
-    ExportJob write();  // returns the job that was written
+    bool write();  // true if a job was written
 
     double utilisation() { return utilisation_; }
 
 private:
     bool error_{false};
     std::mutex mutex_;
+    EncodeOutputPool outputPool_;  // must outlive writer_ and tee_, which may still hold its buffers
     std::unique_ptr<MovieWriter> writer_;
+    std::vector<std::unique_ptr<ExporterTeeDestination>> tee_;
     std::chrono::high_resolution_clock::time_point idleStart_;
     std::chrono::high_resolution_clock::time_point writeStart_;
 
@@ -149,30 +265,51 @@ class Exporter
 public:
     Exporter(
         UniqueEncoder encoder,
-        std::unique_ptr<MovieWriter> writer);
+        std::unique_ptr<MovieWriter> writer,
+        std::vector<std::unique_ptr<MovieWriter>> teeWriters = {});
     ~Exporter();
 
     // users should call close if they wish to handle errors on shutdown - destructors cannot
     // throw, 'close' can and will
     void close();
     
-    // not thread safe, primarily for Premiere where the audio can be preloaded at beginning
-    // !!! must be called prior to dispatchVideo or dispatchAudio
+    // thread safe, primarily for Premiere where the audio is rendered independently of the video,
+    // perhaps on a thread of its own while video is dispatched. Packets must cover every sample from
+    // pts 0, in any order, and must all have been written before close; see MovieWriter::preloadAudio
+    // !!! not to be mixed with dispatchAudio
     // !!! unify with dispatchAudio
     void writeAudioFrame(const uint8_t *data, size_t size, int64_t pts);
 
     // thread safe to be called 'on frame rendered'
-    void dispatchVideo(int64_t iFrame, const uint8_t* data, size_t stride, FrameFormat format) const;
+    //   alpha is how the frame's colour relates to its alpha; see FrameDef::alpha
+    void dispatchVideo(int64_t iFrame, const uint8_t* data, size_t stride, FrameFormat format,
+                       FrameAlpha alpha = FrameAlpha_Straight) const;
     
     // thread safe, to be called in dispatching thread interleaved with video frames
     // output via MovieWriter will be in same exact sequence
     // this is primarily for AfterEffects where the audio cannot be obtained at beginning
     void dispatchAudio(int64_t pts, const uint8_t* data, size_t size) const;
 
+    // a further encode of the export at 1/downscale of its size, a power of 2, to be added ahead
+    // of the first dispatch
+    //   each frame dispatched is downscaled once for all the renditions at a size, from the frame at
+    //   the size before, and dispatched to them along with the audio. Renditions are closed with the
+    //   export, and an error in one is an error in the export.
+    void addRendition(int downscale, std::unique_ptr<Exporter> rendition);
+
 private:
     bool closed_{false};
     mutable std::unique_ptr<int64_t> currentFrame_;
 
+    struct Rendition
+    {
+        int downscale;
+        std::unique_ptr<Exporter> exporter;
+    };
+    std::vector<Rendition> renditions_;  // in increasing order of downscale
+    mutable std::vector<std::vector<uint8_t>> downscaled_;  // the frame at half size, quarter size...
+    void dispatchRenditions(int64_t iFrame, const uint8_t* data, size_t stride, FrameFormat format, FrameAlpha alpha) const;
+
     bool expandWorkerPoolToCapacity() const;
     int concurrentThreadsSupported_;
 
@@ -194,5 +331,7 @@ std::unique_ptr<Exporter> createExporter(
     int32_t maxFrames, int32_t reserveMetadataSpace,
     const MovieFile& file,
     std::optional<AudioDef> audio,
-    bool writeMoovTagEarly
+    bool writeMoovTagEarly,
+    const std::vector<MovieFile>& teeFiles = {},  // written as well as file; see createTeeMovieFiles
+    const std::vector<RenditionFile>& renditionFiles = {}  // encoded as well; see createRenditionFiles
 );
@@ -1,20 +1,113 @@
 // ffmpeg_helpers.cpp
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#ifdef WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "codec_registration.hpp"
+#include "config.hpp"
 #include "ffmpeg_helpers.hpp"
+#include "io_uring_file.hpp"
 #include "logging.hpp"
+#include "movie_index.hpp"
 #include "movie_reader.hpp"
 
+using json = nlohmann::json;
+
+void from_json(const json& j, AVIOConfiguration& c) {
+    j.at("minBufferSize").get_to(c.minBufferSize);
+    j.at("maxBufferSize").get_to(c.maxBufferSize);
+    c.maxReadBufferSize = j.value("maxReadBufferSize", c.maxReadBufferSize);  // added later, so optional
+}
+
+AVIOConfiguration avioConfiguration()
+{
+    AVIOConfiguration config;
+    try {
+        fdn::config().at("avio").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+// bytes per pixel of an encoded frame at the codec's highest quality, the largest it predicts
+static double encodedBytesPerPixel(const VideoDef& video)
+{
+    // encodedBitDepth is the uncompressed depth, so this bounds codecs that can't predict the format
+    double uncompressed = std::max(video.encodedBitDepth, 8) / 8.0;
+    try {
+        const auto& quality = CodecRegistry::details().quality;
+        int highest = quality.descriptions.empty() ? quality.defaultQuality : quality.descriptions.rbegin()->first;
+        CodecAlpha alpha = (video.encodedBitDepth > 24) ? withAlpha : withoutAlpha;
+        double predicted = CodecRegistry::getPixelFormatSize(alpha, video.format, highest);
+        return (predicted > 0.0) ? predicted : uncompressed;
+    }
+    catch (...)
+    {
+        return uncompressed;
+    }
+}
+
+size_t avioBufferSize(const VideoDef& video, const AVIOConfiguration& configuration, bool forReading)
+{
+    int64_t frameSize = (int64_t)std::ceil(video.width * (double)video.height * encodedBytesPerPixel(video));
+
+    const int64_t granularity = 64 << 10;
+    int64_t size = (frameSize + granularity - 1) / granularity * granularity;
+    size = std::max(size, configuration.minBufferSize);
+    size = std::min(size, forReading ? configuration.maxReadBufferSize : configuration.maxBufferSize);
+    size = std::min(size, (int64_t)(1 << 30)); // AVIO buffer sizes are int
+    return (size_t)std::max(size, (int64_t)4096);
+}
+
+// the sidecar index goes alongside the movie, whichever backend writes or reads the movie
+static MovieFile withSidecar(MovieFile file, const std::string& moviePath)
+{
+    std::string path = sidecarPath(moviePath);
+    file.onWriteSidecar = [=](const uint8_t *data, size_t size) {
+        return writeSidecarFile(path, data, size);
+    };
+    file.onReadSidecar = [=](std::vector<uint8_t>& data) {
+        return readSidecarFile(path, data);
+    };
+    return file;
+}
+
 MovieFile createMovieFile(const std::string &filename)
 {
+#ifdef __linux__
+    auto fileIo = fileIoConfiguration();
+    if (fileIo.backend == "io_uring") {
+        try {
+            return withSidecar(createIoUringMovieFile(filename, fileIo), filename);
+        }
+        catch (const std::exception& ex) {
+            FDN_WARNING("io_uring unavailable (", ex.what(), ") - writing ", filename, " with stdio");
+        }
+    }
+#endif
+
     MovieFile fileWrapper;
     auto file=std::make_shared<FILE *>((FILE *)nullptr);
     fileWrapper.onOpenForWrite = [=]() {
         FDN_INFO("opening ", filename, " for writing");
 
 #ifdef WIN32
-        fopen_s(file.get(), filename.c_str(), "wb");
+        fopen_s(file.get(), filename.c_str(), "w+b");
 #else
-        FILE *ptr = fopen(filename.c_str(), "wb");
+        FILE *ptr = fopen(filename.c_str(), "w+b");  // readable, so that onMove can read back
         *file = ptr;
 #endif
         if (!(*file))
@@ -43,8 +136,156 @@ MovieFile createMovieFile(const std::string &filename)
     fileWrapper.onClose = [=]() {
         return (fclose(*file)==0) ? 0 : -1;
     };
+    fileWrapper.onPreallocate = [=](int64_t size) {
+#if defined(WIN32)
+        FILE_ALLOCATION_INFO allocation;
+        allocation.AllocationSize.QuadPart = size;
+        HANDLE handle = (HANDLE)_get_osfhandle(_fileno(*file));
+        bool ok = SetFileInformationByHandle(handle, FileAllocationInfo, &allocation, sizeof(allocation));
+#elif defined(__linux__)
+        bool ok = (fallocate(fileno(*file), FALLOC_FL_KEEP_SIZE, 0, size) == 0);
+#elif defined(__APPLE__)
+        fstore_t store = { F_ALLOCATECONTIG | F_ALLOCATEALL, F_PEOFPOSMODE, 0, size, 0 };
+        bool ok = (fcntl(fileno(*file), F_PREALLOCATE, &store) != -1);
+        if (!ok) {
+            store.fst_flags = F_ALLOCATEALL;   // settle for fragmented
+            ok = (fcntl(fileno(*file), F_PREALLOCATE, &store) != -1);
+        }
+#else
+        bool ok = true;
+#endif
+        if (!ok) {
+            FDN_ERROR("Could not reserve ", size, " bytes for ", filename);
+            return -1;
+        }
+        return 0;
+    };
+    fileWrapper.onTruncate = [=](int64_t size) {
+        if (fflush(*file) != 0)
+            return -1;
+#ifdef WIN32
+        bool ok = (_chsize_s(_fileno(*file), size) == 0);
+#else
+        bool ok = (ftruncate(fileno(*file), size) == 0);
+#endif
+        if (!ok) {
+            FDN_ERROR("Could not truncate ", filename, " to ", size, " bytes");
+            return -1;
+        }
+        return 0;
+    };
+    fileWrapper.onMove = [=](int64_t source, int64_t destination, int64_t size) {
+        if (fflush(*file) != 0)
+            return -1;
+#ifdef WIN32
+        return moveFileRange(_fileno(*file), source, destination, size);
+#else
+        return moveFileRange(fileno(*file), source, destination, size);
+#endif
+    };
+
+    return withSidecar(fileWrapper, filename);
+}
+
+namespace {
+
+const int64_t MoveBlockSize = 16 << 20;
+
+#ifdef WIN32
+int64_t readAt(int fd, uint8_t *buffer, int64_t size, int64_t offset)
+{
+    if (_lseeki64(fd, offset, SEEK_SET) != offset)
+        return -1;
+    return _read(fd, buffer, (unsigned int)size);
+}
 
-    return fileWrapper;
+int64_t writeAt(int fd, const uint8_t *buffer, int64_t size, int64_t offset)
+{
+    if (_lseeki64(fd, offset, SEEK_SET) != offset)
+        return -1;
+    return _write(fd, buffer, (unsigned int)size);
+}
+#else
+int64_t readAt(int fd, uint8_t *buffer, int64_t size, int64_t offset)
+{
+    return pread(fd, buffer, (size_t)size, (off_t)offset);
+}
+
+int64_t writeAt(int fd, const uint8_t *buffer, int64_t size, int64_t offset)
+{
+    return pwrite(fd, buffer, (size_t)size, (off_t)offset);
+}
+#endif
+
+bool moveBlock(int fd, uint8_t *buffer, int64_t source, int64_t destination, int64_t size)
+{
+#ifdef __linux__
+    // the kernel copies without a trip through user space, but refuses overlapping ranges
+    if (std::abs(destination - source) >= size) {
+        loff_t in = source;
+        loff_t out = destination;
+        while (size > 0) {
+            ssize_t n = copy_file_range(fd, &in, fd, &out, (size_t)size, 0);
+            if (n <= 0)
+                break;  // not supported for this file; finish with reads and writes
+            size -= n;
+        }
+        source = in;
+        destination = out;
+    }
+#endif
+    for (int64_t done = 0; done < size; ) {
+        int64_t n = readAt(fd, buffer + done, size - done, source + done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    for (int64_t done = 0; done < size; ) {
+        int64_t n = writeAt(fd, buffer + done, size - done, destination + done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+}
+
+int moveFileRange(int fd, int64_t source, int64_t destination, int64_t size)
+{
+    if (size <= 0 || source == destination)
+        return 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::unique_ptr<uint8_t, void (*)(void *)> buffer((uint8_t *)av_malloc(MoveBlockSize), av_free);
+    if (!buffer)
+        return -1;
+
+    // blocks are aligned in the source so reads are of whole pages; when moving towards the end of
+    // the file, start from the end so nothing is overwritten before it has been moved
+    const int64_t end = source + size;
+    const bool towardsEnd = destination > source;
+    for (int64_t moved = 0; moved < size; ) {
+        int64_t blockStart, blockEnd;
+        if (towardsEnd) {
+            blockEnd = end - moved;
+            blockStart = std::max(source, (blockEnd - 1) / MoveBlockSize * MoveBlockSize);
+        }
+        else {
+            blockStart = source + moved;
+            blockEnd = std::min(end, (blockStart / MoveBlockSize + 1) * MoveBlockSize);
+        }
+        if (!moveBlock(fd, buffer.get(), blockStart, destination + (blockStart - source), blockEnd - blockStart)) {
+            FDN_ERROR("Could not move ", blockEnd - blockStart, " bytes from ", blockStart, " to ", destination + (blockStart - source));
+            return -1;
+        }
+        moved += blockEnd - blockStart;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    FDN_INFO("moved ", size, " bytes in ", seconds, "s (", (double)size / (1 << 20) / std::max(seconds, 1e-6), " MB/s)");
+    return 0;
 }
 
 
@@ -125,13 +366,28 @@ std::unique_ptr<MovieReader> createMovieReader(VideoFormat videoFormat, const fs
         return 0;
     };
 
-    return std::make_unique<MovieReader>(videoFormat, file);
+    return std::make_unique<MovieReader>(videoFormat, withSidecar(file, filePath.string()));
 }
 
 #else
 
 std::unique_ptr<MovieReader> createMovieReader(VideoFormat videoFormat, const fs::path& filePath)
 {
+#ifdef __linux__
+    auto fileIo = fileIoConfiguration();
+    if (fileIo.backend == "io_uring") {
+        std::unique_ptr<MovieFile> uringFile;
+        try {
+            uringFile = std::make_unique<MovieFile>(openIoUringMovieFileForRead(filePath.string(), fileIo));
+        }
+        catch (const std::exception& ex) {
+            FDN_WARNING("io_uring unavailable (", ex.what(), ") - reading ", filePath, " with stdio");
+        }
+        if (uringFile)
+            return std::make_unique<MovieReader>(videoFormat, withSidecar(*uringFile, filePath.string()));
+    }
+#endif
+
 	MovieFile file;
 
     FDN_INFO("opening ", filePath, " for reading");
@@ -179,7 +435,7 @@ std::unique_ptr<MovieReader> createMovieReader(VideoFormat videoFormat, const fs
         return 0;
     };
 
-    return std::make_unique<MovieReader>(videoFormat, file);
+    return std::make_unique<MovieReader>(videoFormat, withSidecar(file, filePath.string()));
 }
 
 #endif
@@ -7,6 +7,7 @@
 #include <optional>
 #include <ostream>
 #include <string>
+#include <vector>
 
 #ifdef __APPLE__
 #include <boost/filesystem.hpp>
@@ -23,6 +24,8 @@ extern"C"
 #include <libavutil/opt.h>
 }
 
+#include "buffer_pool.hpp"
+
 typedef std::array<char, 4> FileFormat;
 typedef std::array<char, 4> VideoFormat;
 typedef std::function<void ()> MovieOpenCallback;                               // throws error on fail
@@ -32,6 +35,11 @@ typedef std::function<size_t(uint8_t*, int size)> MovieReadCallback;
 typedef std::function<size_t(const uint8_t*, int size)> MovieWriteCallback;     // return 0 on success, -ve on failure
 typedef std::function<int (int64_t offset, int whence)> MovieSeekCallback;      // return 0 on success, -ve on failure
 typedef std::function<int ()> MovieCloseCallback;                               // return 0 on success, -ve on failure
+typedef std::function<int (int64_t size)> MoviePreallocateCallback;             // return 0 on success, -ve on failure
+typedef std::function<int (int64_t size)> MovieTruncateCallback;                // return 0 on success, -ve on failure
+typedef std::function<int (int64_t source, int64_t destination, int64_t size)> MovieMoveCallback;  // return 0 on success, -ve on failure
+typedef std::function<int (const uint8_t *data, size_t size)> MovieSidecarWriteCallback;   // return 0 on success, -ve on failure
+typedef std::function<int (std::vector<uint8_t>& data)> MovieSidecarReadCallback;          // return 0 on success, -ve if there's none
 
 struct MovieFile
 {
@@ -41,11 +49,22 @@ struct MovieFile
     MovieSeekCallback onSeek;
     MovieCloseCallback onClose;
     MovieReadCallback onRead;    // not set for write files
+    MoviePreallocateCallback onPreallocate;  // optional; reserves space without changing the file size
+    MovieTruncateCallback onTruncate;        // optional; sets the final file size, after all writes
+    MovieMoveCallback onMove;                // optional; moves bytes already written, ranges may overlap
+    MovieSidecarWriteCallback onWriteSidecar;  // optional; stores a MovieIndex next to the movie
+    MovieSidecarReadCallback onReadSidecar;    // optional; loads the MovieIndex stored next to the movie
     
     int64_t fileSize{-1};  // !!! needed by MovieReader for ffmpeg seek/size; remove if possible
 };
 
 MovieFile createMovieFile(const std::string &filename);
+
+// moves size bytes from source to destination within the file open as fd, in large sequential blocks
+//   working away from the destination so that the ranges may overlap. Uses copy_file_range where
+//   a block doesn't overlap its destination, and aligned reads and writes otherwise. Never holds
+//   more than one block in memory. Returns 0 on success, -ve on failure.
+int moveFileRange(int fd, int64_t source, int64_t destination, int64_t size);
 class MovieReader;
 std::unique_ptr<MovieReader> createMovieReader(VideoFormat videoFormat, const fs::path& filePath);
 
@@ -63,7 +82,8 @@ struct IOContextDeleter {
     void operator()(AVIOContext *ioContext)
     {
         avio_flush(ioContext);
-        av_freep(&ioContext->buffer);
+        sessionBufferPool().release(ioContext->buffer);
+        ioContext->buffer = nullptr;
         avio_context_free(&ioContext);
     }
 };
@@ -215,4 +235,20 @@ struct VideoDef
     int64_t maxFrames;
 };
 
+// AVIO buffer sizing, from the "avio" section of config.json
+//   the buffer between libavformat and the MovieFile is sized to hold one encoded frame at the codec's
+//   highest quality, as CodecRegistry::getPixelFormatSize predicts it, so that most frames cross in a
+//   single callback. It is clamped to [minBufferSize, maxBufferSize] for writing, and to
+//   [minBufferSize, maxReadBufferSize] for reading, as importers hold a reader open per clip and
+//   seek about, where a writer streams.
+struct AVIOConfiguration
+{
+    int64_t minBufferSize{ 256 << 10 };
+    int64_t maxBufferSize{ 64 << 20 };
+    int64_t maxReadBufferSize{ 16 << 20 };
+};
+
+AVIOConfiguration avioConfiguration();
+size_t avioBufferSize(const VideoDef& video, const AVIOConfiguration& configuration, bool forReading);
+
 #endif
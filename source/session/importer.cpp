@@ -1,6 +1,7 @@
 #include <codecvt>
 #include <new>
 
+#include "buffer_pool.hpp"
 #include "codec_registration.hpp"
 #include "importer.hpp"
 
@@ -285,7 +286,7 @@ bool Importer::expandWorkerPoolToCapacity() const
 {
     bool isNotThreadLimited = workers_.size() < concurrentThreadsSupported_;
     bool isNotInputLimited = jobReader_.utilisation() < 0.99;
-    bool isNotBufferLimited = true;  // TODO: get memoryUsed < maxMemoryCapacity from Adobe API
+    bool isNotBufferLimited = sessionBufferPool().isWithinBudget();
 
     if (isNotThreadLimited && isNotInputLimited && isNotBufferLimited) {
         workers_.push_back(std::make_unique<ImporterWorker>(error_, jobReader_, jobDecoder_));
@@ -0,0 +1,663 @@
+#include "config.hpp"
+#include "io_uring_file.hpp"
+#include "logging.hpp"
+
+using json = nlohmann::json;
+
+void from_json(const json& j, FileIoConfiguration& c) {
+    j.at("backend").get_to(c.backend);
+    j.at("directIo").get_to(c.directIo);
+    j.at("bufferSize").get_to(c.bufferSize);
+    j.at("queueDepth").get_to(c.queueDepth);
+}
+
+FileIoConfiguration fileIoConfiguration()
+{
+    FileIoConfiguration config;
+    try {
+        fdn::config().at("fileIo").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t Alignment = 4096;
+
+size_t alignUp(size_t value) { return (value + Alignment - 1) & ~(Alignment - 1); }
+int64_t alignDown(int64_t value) { return value & ~(int64_t)(Alignment - 1); }
+bool isAligned(int64_t value) { return (value & (Alignment - 1)) == 0; }
+
+std::system_error systemError(int error, const std::string& what)
+{
+    return std::system_error(error, std::generic_category(), what);
+}
+
+// minimal io_uring over the raw syscalls; one submitting thread
+class IoUring
+{
+public:
+    IoUring(unsigned entries)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (fd_ < 0)
+            throw systemError(errno, "io_uring_setup");
+
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+
+        sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sqRing_ == MAP_FAILED) {
+            int error = errno;
+            ::close(fd_);
+            throw systemError(error, "io_uring sq ring mmap");
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            cqRing_ = sqRing_;
+        else {
+            cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+            if (cqRing_ == MAP_FAILED) {
+                int error = errno;
+                munmap(sqRing_, sqRingSize_);
+                ::close(fd_);
+                throw systemError(error, "io_uring cq ring mmap");
+            }
+        }
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = (io_uring_sqe *)mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sqes_ == MAP_FAILED) {
+            int error = errno;
+            unmapRings();
+            ::close(fd_);
+            throw systemError(error, "io_uring sqe mmap");
+        }
+
+        uint8_t *sq = (uint8_t *)sqRing_;
+        sqHead_ = (unsigned *)(sq + params.sq_off.head);
+        sqTail_ = (unsigned *)(sq + params.sq_off.tail);
+        sqMask_ = *(unsigned *)(sq + params.sq_off.ring_mask);
+        sqArray_ = (unsigned *)(sq + params.sq_off.array);
+        sqEntries_ = params.sq_entries;
+
+        uint8_t *cq = (uint8_t *)cqRing_;
+        cqHead_ = (unsigned *)(cq + params.cq_off.head);
+        cqTail_ = (unsigned *)(cq + params.cq_off.tail);
+        cqMask_ = *(unsigned *)(cq + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    }
+
+    ~IoUring()
+    {
+        munmap(sqes_, sqesSize_);
+        unmapRings();
+        ::close(fd_);
+    }
+
+    void registerBuffers(const std::vector<iovec>& buffers)
+    {
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, buffers.data(), (unsigned)buffers.size()) < 0)
+            throw systemError(errno, "io_uring_register buffers");
+    }
+
+    // queues a fixed-buffer read or write, and submits it
+    void submit(uint8_t opcode, int fd, uint8_t *data, uint32_t size, int64_t offset, uint16_t bufferIndex, uint64_t userData)
+    {
+        unsigned tail = *sqTail_;
+        if (tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+            throw std::runtime_error("io_uring submission queue full");
+
+        unsigned index = tail & sqMask_;
+        io_uring_sqe& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)(uintptr_t)data;
+        sqe.len = size;
+        sqe.off = (uint64_t)offset;
+        sqe.buf_index = bufferIndex;
+        sqe.user_data = userData;
+        sqArray_[index] = index;
+        __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+
+        while (syscall(__NR_io_uring_enter, fd_, 1, 0, 0, nullptr, 0) < 0) {
+            if (errno != EINTR)
+                throw systemError(errno, "io_uring_enter submit");
+        }
+    }
+
+    // waits for the next completion
+    io_uring_cqe wait()
+    {
+        for (;;) {
+            unsigned head = *cqHead_;
+            if (head != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+                io_uring_cqe cqe = cqes_[head & cqMask_];
+                __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+                return cqe;
+            }
+            if (syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+                throw systemError(errno, "io_uring_enter wait");
+        }
+    }
+
+private:
+    void unmapRings()
+    {
+        munmap(sqRing_, sqRingSize_);
+        if (cqRing_ != sqRing_)
+            munmap(cqRing_, cqRingSize_);
+    }
+
+    int fd_;
+    void *sqRing_{ nullptr };
+    void *cqRing_{ nullptr };
+    size_t sqRingSize_;
+    size_t cqRingSize_;
+    io_uring_sqe *sqes_;
+    size_t sqesSize_;
+
+    unsigned *sqHead_;
+    unsigned *sqTail_;
+    unsigned sqMask_;
+    unsigned *sqArray_;
+    unsigned sqEntries_;
+
+    unsigned *cqHead_;
+    unsigned *cqTail_;
+    unsigned cqMask_;
+    io_uring_cqe *cqes_;
+};
+
+// page aligned buffers, registered with the ring
+class RegisteredBuffers
+{
+public:
+    RegisteredBuffers(IoUring& ring, int count, size_t size)
+        : size_(alignUp(size))
+    {
+        std::vector<iovec> iovecs;
+        for (int i = 0; i < count; ++i) {
+            void *buffer = nullptr;
+            if (posix_memalign(&buffer, Alignment, size_) != 0)
+                throw std::bad_alloc();
+            buffers_.push_back((uint8_t *)buffer);
+            iovecs.push_back(iovec{ buffer, size_ });
+        }
+        ring.registerBuffers(iovecs);
+    }
+
+    ~RegisteredBuffers()
+    {
+        for (auto buffer : buffers_)
+            free(buffer);
+    }
+
+    uint8_t *operator[](size_t i) { return buffers_[i]; }
+    size_t count() const { return buffers_.size(); }
+    size_t size() const { return size_; }
+
+private:
+    std::vector<uint8_t *> buffers_;
+    size_t size_;
+};
+
+class IoUringWriter
+{
+public:
+    IoUringWriter(const std::string& filename, const FileIoConfiguration& configuration)
+        : filename_(filename), configuration_(configuration),
+          ring_(std::max(2, configuration.queueDepth)),
+          buffers_(ring_, std::max(2, configuration.queueDepth), (size_t)configuration.bufferSize)
+    {
+        for (size_t i = 0; i < buffers_.count(); ++i)
+            free_.push_back((uint16_t)i);
+    }
+
+    ~IoUringWriter()
+    {
+        if (fd_ >= 0)
+            close();
+    }
+
+    void open()
+    {
+        fd_ = ::open(filename_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);  // readable for move
+        if (fd_ < 0)
+            throw systemError(errno, "couldn't open output file");
+        if (configuration_.directIo) {
+            directFd_ = ::open(filename_.c_str(), O_WRONLY | O_DIRECT);
+            if (directFd_ < 0)
+                FDN_WARNING("O_DIRECT unavailable for ", filename_, " - writing through the page cache");
+        }
+    }
+
+    int write(const uint8_t *data, size_t size)
+    {
+        try {
+            while (size) {
+                if (filling_ < 0)
+                    startBuffer();
+                size_t n = std::min(size, fillingCapacity_ - filled_);
+                std::memcpy(buffers_[filling_] + filled_, data, n);
+                filled_ += n;
+                position_ += n;
+                data += n;
+                size -= n;
+                if (filled_ == fillingCapacity_)
+                    submitFilling();
+            }
+            end_ = std::max(end_, position_);
+            return 0;
+        }
+        catch (const std::exception& ex) {
+            FDN_ERROR(ex.what());
+            return -1;
+        }
+    }
+
+    int seek(int64_t offset, int whence)
+    {
+        try {
+            // later writes may overlap earlier ones, so let everything land first
+            submitFilling();
+            waitAll();
+
+            if (whence == SEEK_SET)
+                position_ = offset;
+            else if (whence == SEEK_CUR)
+                position_ += offset;
+            else if (whence == SEEK_END)
+                position_ = end_ + offset;
+            else
+                throw std::runtime_error("unhandled file seek mode");
+            return 0;
+        }
+        catch (const std::exception& ex) {
+            FDN_ERROR(ex.what());
+            return -1;
+        }
+    }
+
+    int preallocate(int64_t size)
+    {
+        if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+            FDN_ERROR("Could not reserve ", size, " bytes for ", filename_);
+            return -1;
+        }
+        return 0;
+    }
+
+    int truncate(int64_t size)
+    {
+        try {
+            submitFilling();
+            waitAll();
+        }
+        catch (const std::exception& ex) {
+            FDN_ERROR(ex.what());
+            return -1;
+        }
+        if (ftruncate(fd_, size) != 0) {
+            FDN_ERROR("Could not truncate ", filename_, " to ", size, " bytes");
+            return -1;
+        }
+        end_ = size;
+        return 0;
+    }
+
+    // through the page cache fd, once the direct writes it reads back have landed
+    int move(int64_t source, int64_t destination, int64_t size)
+    {
+        try {
+            submitFilling();
+            waitAll();
+        }
+        catch (const std::exception& ex) {
+            FDN_ERROR(ex.what());
+            return -1;
+        }
+        if (moveFileRange(fd_, source, destination, size) < 0)
+            return -1;
+        end_ = std::max(end_, destination + size);
+        return 0;
+    }
+
+    int close()
+    {
+        int result = 0;
+        try {
+            submitFilling();
+            waitAll();
+        }
+        catch (const std::exception& ex) {
+            FDN_ERROR(ex.what());
+            result = -1;
+        }
+        if (directFd_ >= 0)
+            ::close(directFd_);
+        if (fd_ >= 0 && ::close(fd_) != 0)
+            result = -1;
+        fd_ = directFd_ = -1;
+        return result;
+    }
+
+private:
+    void startBuffer()
+    {
+        filling_ = acquire();
+        filled_ = 0;
+        fillingStart_ = position_;
+        // an unaligned start only fills up to the next boundary, so the buffers after it can go direct
+        fillingCapacity_ = isAligned(position_) ? buffers_.size() : (size_t)(alignDown(position_) + Alignment - position_);
+    }
+
+    void submitFilling()
+    {
+        if (filling_ < 0)
+            return;
+
+        if (filled_ == 0) {
+            free_.push_back((uint16_t)filling_);
+        }
+        else if (directFd_ >= 0 && isAligned(fillingStart_) && isAligned(filled_)) {
+            ring_.submit(IORING_OP_WRITE_FIXED, directFd_, buffers_[filling_], (uint32_t)filled_, fillingStart_, (uint16_t)filling_,
+                         userData(filling_, filled_));
+            ++inFlight_;
+        }
+        else if (directFd_ >= 0) {
+            // unaligned pieces go through the page cache, after any direct writes they might share a block with
+            waitAll();
+            if (pwrite(fd_, buffers_[filling_], filled_, fillingStart_) != (ssize_t)filled_)
+                throw systemError(errno, "could not write to file");
+            free_.push_back((uint16_t)filling_);
+        }
+        else {
+            ring_.submit(IORING_OP_WRITE_FIXED, fd_, buffers_[filling_], (uint32_t)filled_, fillingStart_, (uint16_t)filling_,
+                         userData(filling_, filled_));
+            ++inFlight_;
+        }
+        filling_ = -1;
+        filled_ = 0;
+    }
+
+    static uint64_t userData(int buffer, size_t size) { return ((uint64_t)size << 16) | (uint64_t)buffer; }
+
+    int acquire()
+    {
+        while (free_.empty())
+            complete();
+        int buffer = free_.front();
+        free_.pop_front();
+        return buffer;
+    }
+
+    void complete()
+    {
+        io_uring_cqe cqe = ring_.wait();
+        --inFlight_;
+        uint16_t buffer = (uint16_t)(cqe.user_data & 0xffff);
+        size_t size = (size_t)(cqe.user_data >> 16);
+        free_.push_back(buffer);
+        if (cqe.res < 0)
+            throw systemError(-cqe.res, "could not write to file");
+        if ((size_t)cqe.res != size)
+            throw std::runtime_error("short write to file");
+    }
+
+    void waitAll()
+    {
+        while (inFlight_)
+            complete();
+    }
+
+    std::string filename_;
+    FileIoConfiguration configuration_;
+    IoUring ring_;
+    RegisteredBuffers buffers_;
+
+    int fd_{ -1 };
+    int directFd_{ -1 };
+
+    std::deque<uint16_t> free_;
+    int inFlight_{ 0 };
+
+    int filling_{ -1 };
+    size_t filled_{ 0 };
+    size_t fillingCapacity_{ 0 };
+    int64_t fillingStart_{ 0 };
+
+    int64_t position_{ 0 };
+    int64_t end_{ 0 };
+};
+
+// sequential reads are served from buffers read ahead of the reader; a seek elsewhere discards them
+class IoUringReader
+{
+public:
+    IoUringReader(const std::string& filename, const FileIoConfiguration& configuration)
+        : ring_(std::max(2, configuration.queueDepth)),
+          buffers_(ring_, std::max(2, configuration.queueDepth), (size_t)configuration.bufferSize)
+    {
+        if (configuration.directIo)
+            fd_ = ::open(filename.c_str(), O_RDONLY | O_DIRECT);
+        if (fd_ < 0)
+            fd_ = ::open(filename.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            throw systemError(errno, "could not open " + filename);
+
+        struct stat status;
+        if (fstat(fd_, &status) != 0) {
+            int error = errno;
+            ::close(fd_);
+            throw systemError(error, "could not stat " + filename);
+        }
+        size_ = status.st_size;
+
+        for (size_t i = 0; i < buffers_.count(); ++i)
+            free_.push_back((uint16_t)i);
+    }
+
+    ~IoUringReader()
+    {
+        close();
+    }
+
+    int64_t size() const { return size_; }
+
+    size_t read(uint8_t *data, size_t size)
+    {
+        size_t read = 0;
+        while (read < size && position_ < size_) {
+            ReadAhead& ahead = bufferHolding(position_);
+            size_t offsetInBuffer = (size_t)(position_ - ahead.offset);
+            size_t n = std::min(size - read, ahead.size - offsetInBuffer);
+            std::memcpy(data + read, buffers_[ahead.buffer] + offsetInBuffer, n);
+            read += n;
+            position_ += n;
+        }
+        return read;
+    }
+
+    int seek(int64_t offset, int whence)
+    {
+        if (whence == SEEK_SET)
+            position_ = offset;
+        else if (whence == SEEK_CUR)
+            position_ += offset;
+        else if (whence == SEEK_END)
+            position_ = size_ + offset;
+        else
+            throw std::runtime_error("unhandled file seek mode");
+        return 0;
+    }
+
+    int close()
+    {
+        if (fd_ < 0)
+            return 0;
+        discard();
+        int result = ::close(fd_);
+        fd_ = -1;
+        return result == 0 ? 0 : -1;
+    }
+
+private:
+    struct ReadAhead
+    {
+        uint16_t buffer;
+        int64_t offset;
+        size_t size;      // valid bytes, once complete
+        bool complete;
+    };
+
+    ReadAhead& bufferHolding(int64_t position)
+    {
+        // drop buffers behind the reader, or everything if it jumped
+        while (!ahead_.empty() && (position < ahead_.front().offset || position >= ahead_.front().offset + (int64_t)buffers_.size())) {
+            if (position < ahead_.front().offset || position >= ahead_.back().offset + (int64_t)buffers_.size()) {
+                discard();
+                break;
+            }
+            retire();
+        }
+
+        if (ahead_.empty())
+            nextOffset_ = alignDown(position);
+        while (!free_.empty() && nextOffset_ < size_)
+            submitRead();
+
+        ReadAhead& front = ahead_.front();
+        while (!front.complete)
+            complete();
+        if (position >= front.offset + (int64_t)front.size)
+            throw std::runtime_error("could not read");
+        return front;
+    }
+
+    void submitRead()
+    {
+        uint16_t buffer = free_.front();
+        free_.pop_front();
+        ring_.submit(IORING_OP_READ_FIXED, fd_, buffers_[buffer], (uint32_t)buffers_.size(), nextOffset_, buffer, buffer);
+        ahead_.push_back(ReadAhead{ buffer, nextOffset_, 0, false });
+        nextOffset_ += buffers_.size();
+    }
+
+    void complete()
+    {
+        io_uring_cqe cqe = ring_.wait();
+        for (auto& ahead : ahead_) {
+            if (ahead.buffer == cqe.user_data && !ahead.complete) {
+                if (cqe.res < 0)
+                    throw systemError(-cqe.res, "could not read");
+                ahead.size = (size_t)cqe.res;
+                ahead.complete = true;
+                return;
+            }
+        }
+    }
+
+    void retire()
+    {
+        while (!ahead_.front().complete)
+            complete();
+        free_.push_back(ahead_.front().buffer);
+        ahead_.pop_front();
+    }
+
+    void discard()
+    {
+        while (!ahead_.empty())
+            retire();
+    }
+
+    IoUring ring_;
+    RegisteredBuffers buffers_;
+    int fd_{ -1 };
+    int64_t size_{ 0 };
+
+    std::deque<uint16_t> free_;
+    std::deque<ReadAhead> ahead_;
+    int64_t nextOffset_{ 0 };
+    int64_t position_{ 0 };
+};
+
+}
+
+MovieFile createIoUringMovieFile(const std::string& filename, const FileIoConfiguration& configuration)
+{
+    auto writer = std::make_shared<IoUringWriter>(filename, configuration);
+
+    MovieFile fileWrapper;
+    fileWrapper.onOpenForWrite = [=]() {
+        FDN_INFO("opening ", filename, " for writing with io_uring", configuration.directIo ? " and O_DIRECT" : "");
+        writer->open();
+    };
+    fileWrapper.onWrite = [=](const uint8_t* buffer, size_t size) {
+        return writer->write(buffer, size);
+    };
+    fileWrapper.onSeek = [=](int64_t offset, int whence) {
+        return writer->seek(offset, whence);
+    };
+    fileWrapper.onClose = [=]() {
+        return writer->close();
+    };
+    fileWrapper.onPreallocate = [=](int64_t size) {
+        return writer->preallocate(size);
+    };
+    fileWrapper.onTruncate = [=](int64_t size) {
+        return writer->truncate(size);
+    };
+    fileWrapper.onMove = [=](int64_t source, int64_t destination, int64_t size) {
+        return writer->move(source, destination, size);
+    };
+
+    return fileWrapper;
+}
+
+MovieFile openIoUringMovieFileForRead(const std::string& filename, const FileIoConfiguration& configuration)
+{
+    FDN_INFO("opening ", filename, " for reading with io_uring", configuration.directIo ? " and O_DIRECT" : "");
+
+    auto reader = std::make_shared<IoUringReader>(filename, configuration);
+
+    MovieFile file;
+    file.fileSize = reader->size();
+    file.onRead = [=](uint8_t* buffer, size_t size) {
+        return reader->read(buffer, size);
+    };
+    file.onSeek = [=](int64_t offset, int whence) {
+        return reader->seek(offset, whence);
+    };
+    file.onClose = [=]() {
+        return reader->close();
+    };
+
+    return file;
+}
+
+#endif
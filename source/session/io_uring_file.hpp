@@ -0,0 +1,34 @@
+#ifndef IO_URING_FILE_HPP
+#define IO_URING_FILE_HPP
+
+#include <string>
+
+#include "ffmpeg_helpers.hpp"
+
+// file io configuration, from the "fileIo" section of config.json
+//   "backend" is "stdio" (the default) or "io_uring", which is only available on linux and falls
+//   back to stdio if the kernel refuses it
+struct FileIoConfiguration
+{
+    std::string backend{ "stdio" };
+    bool directIo{ false };          // bypass the page cache with O_DIRECT
+    int64_t bufferSize{ 4 << 20 };   // bytes per registered buffer
+    int queueDepth{ 8 };             // buffers, and so reads or writes, in flight at once
+};
+
+FileIoConfiguration fileIoConfiguration();
+
+#ifdef __linux__
+
+// io_uring MovieFiles
+//   reads and writes go through registered, page aligned buffers with up to queueDepth of them in
+//   flight. Writes are sequenced so that a seek waits for earlier writes to complete; with directIo,
+//   whole aligned buffers are written with O_DIRECT and the unaligned pieces either side of a seek
+//   through the page cache. Reads run ahead of the reader by up to queueDepth buffers.
+//   Both throw on failure to set up io_uring, so callers can fall back.
+MovieFile createIoUringMovieFile(const std::string& filename, const FileIoConfiguration& configuration);
+MovieFile openIoUringMovieFileForRead(const std::string& filename, const FileIoConfiguration& configuration);
+
+#endif
+
+#endif
@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/adler32.h>
+}
+
+#include "config.hpp"
+#include "logging.hpp"
+#include "movie_index.hpp"
+
+using json = nlohmann::json;
+
+void from_json(const json& j, SidecarConfiguration& c) {
+    j.at("enabled").get_to(c.enabled);
+}
+
+SidecarConfiguration sidecarConfiguration()
+{
+    SidecarConfiguration config;
+    try {
+        fdn::config().at("sidecar").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+namespace {
+
+const char Magic[4] = { 'F', 'D', 'N', 'I' };
+const uint32_t Version = 1;
+
+// little endian fields
+class IndexWriter
+{
+public:
+    void u8(uint8_t value) { data_.push_back(value); }
+    void u32(uint32_t value) { for (int i = 0; i < 4; ++i) u8((uint8_t)(value >> (8 * i))); }
+    void u64(uint64_t value) { for (int i = 0; i < 8; ++i) u8((uint8_t)(value >> (8 * i))); }
+    void bytes(const void *data, size_t size) { data_.insert(data_.end(), (const uint8_t *)data, (const uint8_t *)data + size); }
+
+    std::vector<uint8_t>& data() { return data_; }
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+// throws on reading past the end
+class IndexReader
+{
+public:
+    IndexReader(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+    uint8_t u8() { need(1); return data_[position_++]; }
+    uint32_t u32() { uint32_t value = 0; for (int i = 0; i < 4; ++i) value |= (uint32_t)u8() << (8 * i); return value; }
+    uint64_t u64() { uint64_t value = 0; for (int i = 0; i < 8; ++i) value |= (uint64_t)u8() << (8 * i); return value; }
+    void bytes(void *into, size_t size) { need(size); std::memcpy(into, data_ + position_, size); position_ += size; }
+
+    size_t remaining() const { return size_ - position_; }
+
+private:
+    void need(size_t size) const
+    {
+        if (size > remaining())
+            throw std::runtime_error("index truncated");
+    }
+
+    const uint8_t *data_;
+    size_t size_;
+    size_t position_{ 0 };
+};
+
+}
+
+uint32_t frameChecksum(const uint8_t *data, size_t size)
+{
+    unsigned long checksum = 1;
+    const size_t block = 1 << 30;
+    for (size_t offset = 0; offset < size; offset += block)
+        checksum = av_adler32_update(checksum, data + offset, (unsigned int)std::min(block, size - offset));
+    return (uint32_t)checksum;
+}
+
+std::vector<uint8_t> serializeMovieIndex(const MovieIndex& index)
+{
+    IndexWriter writer;
+    writer.bytes(Magic, sizeof(Magic));
+    writer.u32(Version);
+    writer.u64((uint64_t)index.movieSize);
+
+    writer.u32((uint32_t)index.video.width);
+    writer.u32((uint32_t)index.video.height);
+    writer.bytes(index.video.format.data(), index.video.format.size());
+    writer.u32((uint32_t)index.video.encodedBitDepth);
+    writer.u64((uint64_t)index.video.frameRate.numerator);
+    writer.u64((uint64_t)index.video.frameRate.denominator);
+    writer.u32((uint32_t)index.video.encoderName.size());
+    writer.bytes(index.video.encoderName.data(), index.video.encoderName.size());
+
+    writer.u8(index.audio ? 1 : 0);
+    if (index.audio) {
+        writer.u32((uint32_t)index.audio->numChannels);
+        writer.u32((uint32_t)index.audio->sampleRate);
+        writer.u32((uint32_t)index.audio->bytesPerSample);
+        writer.u32((uint32_t)index.audio->encoding);
+    }
+
+    writer.u64(index.frames.size());
+    for (const auto& frame : index.frames) {
+        writer.u64((uint64_t)frame.position);
+        writer.u32(frame.size);
+        writer.u32(frame.checksum);
+    }
+
+    writer.u64(index.audioChunks.size());
+    for (const auto& chunk : index.audioChunks) {
+        writer.u64((uint64_t)chunk.position);
+        writer.u64((uint64_t)chunk.samples);
+    }
+
+    // of everything above, so a torn write isn't mistaken for an index
+    writer.u32(frameChecksum(writer.data().data(), writer.data().size()));
+    return std::move(writer.data());
+}
+
+std::optional<MovieIndex> parseMovieIndex(const std::vector<uint8_t>& data)
+{
+    if (data.size() < sizeof(Magic) + 8
+        || std::memcmp(data.data(), Magic, sizeof(Magic)) != 0)
+        return std::nullopt;
+
+    size_t contentSize = data.size() - 4;
+    IndexReader trailer(data.data() + contentSize, 4);
+    if (trailer.u32() != frameChecksum(data.data(), contentSize))
+        return std::nullopt;
+
+    try {
+        IndexReader reader(data.data() + sizeof(Magic), contentSize - sizeof(Magic));
+        if (reader.u32() != Version)
+            return std::nullopt;
+
+        MovieIndex index;
+        index.movieSize = (int64_t)reader.u64();
+
+        index.video.width = (int)reader.u32();
+        index.video.height = (int)reader.u32();
+        reader.bytes(index.video.format.data(), index.video.format.size());
+        index.video.encodedBitDepth = (int)reader.u32();
+        index.video.frameRate.numerator = (int64_t)reader.u64();
+        index.video.frameRate.denominator = (int64_t)reader.u64();
+        uint32_t encoderNameSize = reader.u32();
+        if (encoderNameSize > reader.remaining())
+            return std::nullopt;
+        index.video.encoderName.resize(encoderNameSize);
+        reader.bytes(&index.video.encoderName[0], encoderNameSize);
+
+        if (reader.u8()) {
+            AudioDef audio;
+            audio.numChannels = (int)reader.u32();
+            audio.sampleRate = (int)reader.u32();
+            audio.bytesPerSample = (int)reader.u32();
+            audio.encoding = (AudioEncoding)reader.u32();
+            index.audio = audio;
+        }
+
+        uint64_t frames = reader.u64();
+        if (frames > reader.remaining() / 16)
+            return std::nullopt;
+        index.frames.resize((size_t)frames);
+        for (auto& frame : index.frames) {
+            frame.position = (int64_t)reader.u64();
+            frame.size = reader.u32();
+            frame.checksum = reader.u32();
+        }
+        index.video.maxFrames = (int64_t)frames;
+
+        uint64_t chunks = reader.u64();
+        if (chunks > reader.remaining() / 16)
+            return std::nullopt;
+        index.audioChunks.resize((size_t)chunks);
+        for (auto& chunk : index.audioChunks) {
+            chunk.position = (int64_t)reader.u64();
+            chunk.samples = (int64_t)reader.u64();
+        }
+
+        return index;
+    }
+    catch (const std::exception& ex) {
+        FDN_WARNING("ignoring sidecar index - ", ex.what());
+        return std::nullopt;
+    }
+}
+
+std::string sidecarPath(const std::string& moviePath)
+{
+    return moviePath + ".fdnidx";
+}
+
+int writeSidecarFile(const std::string& path, const uint8_t *data, size_t size)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file) {
+        FDN_ERROR("Could not open ", path, " for writing");
+        return -1;
+    }
+    bool ok = (fwrite(data, 1, size, file) == size);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        FDN_ERROR("Could not write ", path);
+        std::remove(path.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int readSidecarFile(const std::string& path, std::vector<uint8_t>& data)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return -1;   // no sidecar, which is usual
+
+    bool ok = (fseek(file, 0, SEEK_END) == 0);
+    long size = ok ? ftell(file) : -1;
+    ok = ok && size >= 0 && fseek(file, 0, SEEK_SET) == 0;
+    if (ok) {
+        data.resize((size_t)size);
+        ok = (fread(data.data(), 1, data.size(), file) == data.size());
+    }
+    fclose(file);
+    return ok ? 0 : -1;
+}
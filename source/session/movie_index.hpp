@@ -0,0 +1,56 @@
+#ifndef MOVIE_INDEX_HPP
+#define MOVIE_INDEX_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ffmpeg_helpers.hpp"
+
+// sidecar index configuration, from the "sidecar" section of config.json
+//   when enabled, exports write a MovieIndex next to the movie, which MovieReader opens in place of
+//   parsing the movie itself
+struct SidecarConfiguration
+{
+    bool enabled{ false };
+};
+
+SidecarConfiguration sidecarConfiguration();
+
+// where every sample of an unfragmented movie is, so that it can be opened with one small read
+//   movieSize and the checksum of the last frame tie the index to the movie it was written with; an
+//   index that doesn't match is ignored, and the movie is parsed as usual
+struct MovieIndex
+{
+    struct Frame
+    {
+        int64_t position;
+        uint32_t size;
+        uint32_t checksum;   // frameChecksum of the frame
+    };
+
+    struct AudioChunk
+    {
+        int64_t position;
+        int64_t samples;     // multichannel samples, contiguous from position
+    };
+
+    int64_t movieSize{ 0 };
+    VideoDef video;          // maxFrames is the number of frames
+    std::optional<AudioDef> audio;
+    std::vector<Frame> frames;
+    std::vector<AudioChunk> audioChunks;
+};
+
+uint32_t frameChecksum(const uint8_t *data, size_t size);
+
+std::vector<uint8_t> serializeMovieIndex(const MovieIndex& index);
+std::optional<MovieIndex> parseMovieIndex(const std::vector<uint8_t>& data);  // nullopt if not a valid index
+
+// the sidecar for the movie at moviePath, and stdio access to it. Both return 0 on success, -ve on failure.
+std::string sidecarPath(const std::string& moviePath);
+int writeSidecarFile(const std::string& path, const uint8_t *data, size_t size);
+int readSidecarFile(const std::string& path, std::vector<uint8_t>& data);
+
+#endif
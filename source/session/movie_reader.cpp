@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
+#include <map>
 #include <string>
 #include <numeric>
 
@@ -13,7 +15,15 @@ extern "C" {
 }
 
 #include "logging.hpp"
+#include "movie_index.hpp"
 #include "movie_reader.hpp"
+#include "util.hpp"
+
+// MovieReader::resizeAVIOBuffer sets AVIOContext fields directly; they are laid out as here only for
+//   libavformat 58, as built from the external/ffmpeg submodule (FFmpeg release/4.0)
+#if LIBAVFORMAT_VERSION_MAJOR != 58
+#error "MovieReader::resizeAVIOBuffer needs checking against this libavformat; see movie_reader.cpp"
+#endif
 
 
 #undef av_err2str
@@ -30,111 +40,59 @@ extern "C" {
 // =======================================================
 MovieReader::MovieReader(
     VideoFormat videoFormat,
-    MovieFile file)
+    MovieFile file,
+    size_t avioBufferSize)
     : fileSize_(file.fileSize),
       onRead_(file.onRead), onSeek_(file.onSeek), onClose_(file.onClose)
 {
-    int ret;
-
     try {
-        uint8_t* buffer = (uint8_t*)av_malloc(cAVIOBufferSize);
+        // the frame size isn't known until the header has been read, so that's done with the minimum
+        auto avio = avioConfiguration();
+        size_t initialBufferSize = avioBufferSize ? avioBufferSize : (size_t)avio.minBufferSize;
+
+        uint8_t* buffer = sessionBufferPool().allocate(initialBufferSize);
         if (!buffer)
             throw std::runtime_error("couldn't allocate write buffer");
         AVIOContext *ioContext = avio_alloc_context(
-            buffer,               // unsigned char *buffer,
-            (int)cAVIOBufferSize, // int buffer_size,
+            buffer,                 // unsigned char *buffer,
+            (int)initialBufferSize, // int buffer_size,
             0,                    // int write_flag,
             this,                 // void *opaque,
-            c_onRead,             // int(*read_packet)(void *opaque, uint8_t *buf, int buf_size),
-            nullptr,              // int(*write_packet)(void *opaque, uint8_t *buf, int buf_size),
-            c_onSeek);            // int64_t(*seek)(void *opaque, int64_t offset, int whence));
+            c_onRead,               // int(*read_packet)(void *opaque, uint8_t *buf, int buf_size),
+            nullptr,                // int(*write_packet)(void *opaque, uint8_t *buf, int buf_size),
+            c_onSeek);              // int64_t(*seek)(void *opaque, int64_t offset, int whence));
         if (!ioContext)
         {
-            av_free(buffer);  // not owned by anyone yet :(
+            sessionBufferPool().release(buffer);  // not owned by anyone yet :(
             throw std::runtime_error("couldn't allocate io context");
         }
         ioContext_.reset(ioContext);
 
-        /* allocate the io media context */
-        AVFormatContext *formatContext = avformat_alloc_context();
-        formatContext->iformat = &ff_mov_demuxer;
-        formatContext->pb = ioContext_.get();
-
-        // !!! bugfix - editlist processing on read discards last frame entry
-        // !!! TODO: find out why ffmpeg mov.c mov_fix_index is doing this
-        AVDictionary* movOptionsDictptr(nullptr);
-        av_dict_set(&movOptionsDictptr, "ignore_editlist", "1", 0);
-        // !!!
-
-        ret = avformat_open_input(&formatContext, NULL, NULL, &movOptionsDictptr);
-
-        // !!!
-        av_dict_free(&movOptionsDictptr);
-        // !!!
-
-        if (ret < 0) {
-            throw std::runtime_error("format could not open input");
-        }
-
-        formatContext_.reset(formatContext); // and own it
-
-        if ((ret = avformat_find_stream_info(formatContext_.get(), 0)) < 0) {
-            throw std::runtime_error("Failed to retrieve input stream information");
-        }
-
-
-        //!!!
-        //!!!av_dump_format(formatContext_.get(), 0, "input file", 0);
+        fromSidecar_ = openFromSidecar(videoFormat, file.onReadSidecar);
+        if (!fromSidecar_)
+            openWithLibav(videoFormat);
 
-        //frameRateNumerator_ = formatContext_->
-        //frameRateDenominator_ = formatContext_->iformat->
+        if (!avioBufferSize)
+            resizeAVIOBuffer(::avioBufferSize(video_, avio, true));
 
-        auto desiredVideoTag = MKTAG(videoFormat[0], videoFormat[1], videoFormat[2], videoFormat[3]);
-
-        for (size_t i = 0; i < formatContext_->nb_streams; i++) {
-            AVStream *stream = formatContext_->streams[i];
-            AVCodecParameters *codecpar = stream->codecpar;
+        if (!fromSidecar_)
+        {
+            if (audioStreamIdx_ != -1)
+                audioDef_ = std::make_unique<AudioDef>(getAVCodecParams(*formatContext_->streams[audioStreamIdx_]->codecpar));
 
-            switch (codecpar->codec_type) {
-            case AVMEDIA_TYPE_AUDIO:
-                audioStreamIdx_ = (int)i;
-                break;
-            case AVMEDIA_TYPE_VIDEO:
-                if (codecpar->codec_tag == desiredVideoTag) {
-                    videoStreamIdx_ = (int)i;
-
-                    int64_t frameRateGCD = std::gcd(stream->r_frame_rate.num, stream->r_frame_rate.den);
-                    auto encoderName = av_dict_get(stream->metadata, "encoder", nullptr, 0);
-
-                    video_ = VideoDef{
-                        codecpar->width,
-                        codecpar->height,
-                        videoFormat,
-                        encoderName ? encoderName->value : "<unknown>",
-                        codecpar->bits_per_coded_sample,
-                        Rational{
-                            (int)(stream->r_frame_rate.num / frameRateGCD),
-                            (int)(stream->r_frame_rate.den / frameRateGCD)
-                        },
-                        stream->nb_frames
-                    };
-                }
-                break;
-            default:
-                break;
-            }
+            indexFragments();
         }
 
-        if (videoStreamIdx_ == -1)
-            throw std::runtime_error("could not find video stream");
-
         if (audioStreamIdx_ != -1)
         {
-            AVStream *stream = formatContext_->streams[audioStreamIdx_];
-            audioDef_ = std::make_unique<AudioDef>(getAVCodecParams(*stream->codecpar));
             int bytesPerFrame = audioDef_->bytesPerSample * audioDef_->numChannels;
+            int64_t duration;
+            if (indexed_)
+                duration = audioSamples_.empty() ? 0 : audioSamples_.back().dts + audioSamples_.back().duration;
+            else
+                duration = formatContext_->streams[audioStreamIdx_]->duration;
             audioCache_ = std::make_unique<SampleCache>(
-                stream->duration, bytesPerFrame,
+                duration, bytesPerFrame,
                 [this](size_t frame, uint8_t *into_begin, size_t into_size)->SampleCache::Range {
                     return loadAudio(frame, into_begin, into_size);
                 }
@@ -153,11 +111,166 @@ MovieReader::MovieReader(
     }
 }
 
+// has libav read the header and probe the streams, and finds the video stream
+void MovieReader::openWithLibav(VideoFormat videoFormat)
+{
+    int ret;
+
+    /* allocate the io media context */
+    AVFormatContext *formatContext = avformat_alloc_context();
+    formatContext->iformat = &ff_mov_demuxer;
+    formatContext->pb = ioContext_.get();
+
+    // !!! bugfix - editlist processing on read discards last frame entry
+    // !!! TODO: find out why ffmpeg mov.c mov_fix_index is doing this
+    AVDictionary* movOptionsDictptr(nullptr);
+    av_dict_set(&movOptionsDictptr, "ignore_editlist", "1", 0);
+    // !!!
+
+    ret = avformat_open_input(&formatContext, NULL, NULL, &movOptionsDictptr);
+
+    // !!!
+    av_dict_free(&movOptionsDictptr);
+    // !!!
+
+    if (ret < 0) {
+        throw std::runtime_error("format could not open input");
+    }
+
+    formatContext_.reset(formatContext); // and own it
+
+    if ((ret = avformat_find_stream_info(formatContext_.get(), 0)) < 0) {
+        throw std::runtime_error("Failed to retrieve input stream information");
+    }
+
+
+    //!!!
+    //!!!av_dump_format(formatContext_.get(), 0, "input file", 0);
+
+    //frameRateNumerator_ = formatContext_->
+    //frameRateDenominator_ = formatContext_->iformat->
+
+    auto desiredVideoTag = MKTAG(videoFormat[0], videoFormat[1], videoFormat[2], videoFormat[3]);
+
+    for (size_t i = 0; i < formatContext_->nb_streams; i++) {
+        AVStream *stream = formatContext_->streams[i];
+        AVCodecParameters *codecpar = stream->codecpar;
+
+        switch (codecpar->codec_type) {
+        case AVMEDIA_TYPE_AUDIO:
+            audioStreamIdx_ = (int)i;
+            break;
+        case AVMEDIA_TYPE_VIDEO:
+            if (codecpar->codec_tag == desiredVideoTag) {
+                videoStreamIdx_ = (int)i;
+
+                int64_t frameRateGCD = std::gcd(stream->r_frame_rate.num, stream->r_frame_rate.den);
+                auto encoderName = av_dict_get(stream->metadata, "encoder", nullptr, 0);
+
+                video_ = VideoDef{
+                    codecpar->width,
+                    codecpar->height,
+                    videoFormat,
+                    encoderName ? encoderName->value : "<unknown>",
+                    codecpar->bits_per_coded_sample,
+                    Rational{
+                        (int)(stream->r_frame_rate.num / frameRateGCD),
+                        (int)(stream->r_frame_rate.den / frameRateGCD)
+                    },
+                    stream->nb_frames
+                };
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (videoStreamIdx_ == -1)
+        throw std::runtime_error("could not find video stream");
+}
+
+// from the sidecar index written with the movie, in place of libav reading the header and probing the
+// streams - a single small read. false if there's no index, or it isn't the index of this movie.
+bool MovieReader::openFromSidecar(VideoFormat videoFormat, const MovieSidecarReadCallback& onReadSidecar)
+{
+    std::vector<uint8_t> data;
+    if (!onReadSidecar || onReadSidecar(data) < 0)
+        return false;
+
+    auto index = parseMovieIndex(data);
+    if (!index || index->video.format != videoFormat || index->movieSize != fileSize_ || index->frames.empty())
+    {
+        FDN_WARNING("ignoring sidecar index that doesn't match the movie");
+        return false;
+    }
+
+    // a re-export to the same size is most likely to differ in its last frame
+    const MovieIndex::Frame& last = index->frames.back();
+    std::vector<uint8_t> frame(last.size);
+    try {
+        readSample(IndexedSample{ last.position, last.size, 0, 1 }, frame.data());
+    }
+    catch (const std::exception& ex) {
+        FDN_WARNING("ignoring sidecar index - ", ex.what());
+        return false;
+    }
+    if (frameChecksum(frame.data(), frame.size()) != last.checksum)
+    {
+        FDN_WARNING("ignoring sidecar index that doesn't match the movie");
+        return false;
+    }
+
+    video_ = index->video;
+    videoSamples_.reserve(index->frames.size());
+    for (const auto& indexed : index->frames)
+        videoSamples_.push_back(IndexedSample{ indexed.position, indexed.size, (int64_t)videoSamples_.size(), 1 });
+
+    if (index->audio)
+    {
+        audioDef_ = std::make_unique<AudioDef>(*index->audio);
+        audioStreamIdx_ = 1;  // there's no stream, but this marks the audio as present
+        int bytesPerFrame = audioDef_->bytesPerSample * audioDef_->numChannels;
+        int64_t dts = 0;
+        for (const auto& chunk : index->audioChunks) {
+            audioSamples_.push_back(IndexedSample{ chunk.position, chunk.samples * bytesPerFrame, dts, chunk.samples });
+            dts += chunk.samples;
+        }
+    }
+
+    indexed_ = true;
+    FDN_DEBUG("opened from sidecar index with ", videoSamples_.size(), " frames");
+    return true;
+}
+
 void MovieReader::readVideoFrame(int iFrame, std::vector<uint8_t>& frame)
 {
+    if (indexed_)
+    {
+        if (iFrame < 0 || iFrame >= (int64_t)videoSamples_.size())
+            throw std::runtime_error(std::string("could not read frame " + std::to_string(iFrame) + " - not in movie"));
+        const IndexedSample& sample = videoSamples_[iFrame];
+        frame.resize((size_t)sample.size);
+        readSample(sample, frame.data());
+        return;
+    }
+
     AVStream *stream = formatContext_->streams[videoStreamIdx_];
     int64_t timestamp = (int64_t)iFrame * stream->r_frame_rate.den * stream->time_base.den / (int64_t(stream->r_frame_rate.num) * stream->time_base.num);
 
+    // read the sample straight into the frame when the index says where it is, so libav
+    // doesn't allocate a packet for it
+    int entry = av_index_search_timestamp(stream, timestamp, AVSEEK_FLAG_ANY);
+    if (entry >= 0 && stream->index_entries[entry].timestamp == timestamp) {
+        const AVIndexEntry& sample = stream->index_entries[entry];
+        if (avio_seek(ioContext_.get(), sample.pos, SEEK_SET) < 0)
+            throw std::runtime_error(std::string("could not seek to read frame " + std::to_string(iFrame)));
+        frame.resize(sample.size);
+        if (avio_read(ioContext_.get(), frame.data(), sample.size) != sample.size)
+            throw std::runtime_error(std::string("could not read frame " + std::to_string(iFrame)));
+        return;
+    }
+
     int ret = av_seek_frame(formatContext_.get(), videoStreamIdx_, timestamp, AVSEEK_FLAG_ANY);
     if (ret < 0)
         throw std::runtime_error(std::string("could not seek to read frame " + std::to_string(iFrame) + " - " + av_err2str(ret)));
@@ -169,7 +282,7 @@ void MovieReader::readVideoFrame(int iFrame, std::vector<uint8_t>& frame)
             throw std::runtime_error(std::string("could not read frame " + std::to_string(iFrame) + " - " + av_err2str(ret)));
         else if (pkt.stream_index == videoStreamIdx_) {
             frame.resize(pkt.size);
-            std::copy(pkt.data, pkt.data + pkt.size, &frame[0]);
+            copyFrameData(&frame[0], pkt.data, pkt.size);
             av_packet_unref(&pkt);
             return;
         }
@@ -196,9 +309,22 @@ void MovieReader::readAudio(size_t pos, size_t size, std::vector<uint8_t>& buffe
 
 SampleCache::Range MovieReader::loadAudio(size_t frame, uint8_t *into_begin, size_t into_size)
 {
-    AVStream *stream = formatContext_->streams[audioStreamIdx_];
     int bytesPerFrame = audioDef_->bytesPerSample * audioDef_->numChannels;
 
+    if (indexed_)
+    {
+        auto after = std::upper_bound(audioSamples_.begin(), audioSamples_.end(), (int64_t)frame,
+            [](int64_t frame, const IndexedSample& sample) { return frame < sample.dts; });
+        if (after == audioSamples_.begin() || (size_t)(after - 1)->dts + (size_t)(after - 1)->duration <= frame)
+            throw std::runtime_error("attempt to load audio outside of stream duration");
+        const IndexedSample& sample = *(after - 1);
+        if (into_size < (size_t)(sample.dts * bytesPerFrame + sample.size))
+            throw std::runtime_error("audio cache not large enough for loadAudio");
+        readSample(sample, into_begin + sample.dts * bytesPerFrame);
+        return SampleCache::Range(sample.dts, sample.dts + sample.duration);
+    }
+
+    AVStream *stream = formatContext_->streams[audioStreamIdx_];
     AVPacket pkt;
     while (frame < (size_t)stream->duration) {
         int ret = av_seek_frame(formatContext_.get(), audioStreamIdx_, frame, AVSEEK_FLAG_ANY);
@@ -229,12 +355,246 @@ SampleCache::Range MovieReader::loadAudio(size_t frame, uint8_t *into_begin, siz
     throw std::runtime_error("attempt to load audio outside of stream duration");
 }
 
+namespace {
+
+uint64_t readBigEndian(const uint8_t *data, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value = (value << 8) | data[i];
+    return value;
+}
+
+// calls visit(type, body, bodySize) for each of the atoms in size bytes, stopping at a malformed one
+template <typename Visit>
+void forEachAtom(const uint8_t *atoms, int64_t size, Visit visit)
+{
+    int64_t offset = 0;
+    while (offset + 8 <= size) {
+        const uint8_t *atom = atoms + offset;
+        int64_t atomSize = (int64_t)readBigEndian(atom, 4);
+        int64_t headerSize = 8;
+        if (atomSize == 1 && offset + 16 <= size) {
+            atomSize = (int64_t)readBigEndian(atom + 8, 8);
+            headerSize = 16;
+        }
+        else if (atomSize == 0) {
+            atomSize = size - offset;
+        }
+        if (atomSize < headerSize || atomSize > size - offset)
+            return;
+        visit(std::string((const char *)atom + 4, 4), atom + headerSize, atomSize - headerSize);
+        offset += atomSize;
+    }
+}
+
+bool readAt(AVIOContext *pb, int64_t pos, int64_t size, std::vector<uint8_t>& into)
+{
+    into.resize((size_t)size);
+    return avio_seek(pb, pos, SEEK_SET) >= 0 && avio_read(pb, into.data(), (int)size) == (int)size;
+}
+
+struct TrackDefaults
+{
+    int64_t duration{ 0 };
+    int64_t size{ 0 };
+};
+
+}
+
+// walks the top level atoms and the moofs among them, recording the position, size and decode time of
+// every sample of the video and audio tracks. Samples in the moov's own mdat come from libav's index.
+// A fragment cut short by a crash or by the file still being written is left out.
+void MovieReader::indexFragments()
+{
+    AVIOContext *pb = ioContext_.get();
+    int64_t fileSize = (fileSize_ > 0) ? fileSize_ : avio_size(pb);
+
+    int64_t moovPos = -1, moovSize = 0;
+    std::vector<std::pair<int64_t, int64_t>> moofs;
+    for (int64_t pos = 0; pos + 8 <= fileSize; ) {
+        std::vector<uint8_t> header;
+        if (!readAt(pb, pos, 8, header))
+            break;
+        int64_t size = (int64_t)readBigEndian(header.data(), 4);
+        int64_t headerSize = 8;
+        if (size == 1) {
+            std::vector<uint8_t> largeSize;
+            if (!readAt(pb, pos + 8, 8, largeSize))
+                break;
+            size = (int64_t)readBigEndian(largeSize.data(), 8);
+            headerSize = 16;
+        }
+        else if (size == 0) {
+            size = fileSize - pos;
+        }
+        if (size < headerSize || size > fileSize - pos)
+            break;
+
+        std::string type((const char *)header.data() + 4, 4);
+        if (type == "moov")
+            moovPos = pos + headerSize, moovSize = size - headerSize;
+        else if (type == "moof")
+            moofs.emplace_back(pos, size);
+        pos += size;
+    }
+    if (moofs.empty() || moovPos < 0)
+        return;
+
+    AVStream *videoStream = formatContext_->streams[videoStreamIdx_];
+    AVStream *audioStream = (audioStreamIdx_ != -1) ? formatContext_->streams[audioStreamIdx_] : nullptr;
+    int bytesPerFrame = audioDef_ ? audioDef_->bytesPerSample * audioDef_->numChannels : 1;
+
+    // samples ahead of the first fragment
+    for (int i = 0; i < videoStream->nb_index_entries; ++i) {
+        const AVIndexEntry& entry = videoStream->index_entries[i];
+        if (entry.pos < moofs.front().first)
+            videoSamples_.push_back(IndexedSample{ entry.pos, entry.size, entry.timestamp, 1 });
+    }
+    for (int i = 0; audioStream && i < audioStream->nb_index_entries; ++i) {
+        const AVIndexEntry& entry = audioStream->index_entries[i];
+        if (entry.pos < moofs.front().first)
+            audioSamples_.push_back(IndexedSample{ entry.pos, entry.size, entry.timestamp, entry.size / bytesPerFrame });
+    }
+
+    // per track defaults, from moov/mvex/trex
+    std::map<uint32_t, TrackDefaults> defaults;
+    std::vector<uint8_t> moov;
+    if (!readAt(pb, moovPos, moovSize, moov))
+        throw std::runtime_error("could not read moov");
+    forEachAtom(moov.data(), moovSize, [&](const std::string& type, const uint8_t *body, int64_t size) {
+        if (type != "mvex")
+            return;
+        forEachAtom(body, size, [&](const std::string& type, const uint8_t *body, int64_t size) {
+            if (type == "trex" && size >= 24)
+                defaults[(uint32_t)readBigEndian(body + 4, 4)] = TrackDefaults{ (int64_t)readBigEndian(body + 12, 4), (int64_t)readBigEndian(body + 16, 4) };
+        });
+    });
+
+    std::map<uint32_t, int64_t> nextDts;
+    for (const auto& moof : moofs) {
+        std::vector<uint8_t> atoms;
+        if (!readAt(pb, moof.first + 8, moof.second - 8, atoms))
+            break;
+
+        // the default base for a traf is the end of the previous traf's data, or the moof for the first
+        int64_t dataEnd = moof.first;
+        forEachAtom(atoms.data(), (int64_t)atoms.size(), [&](const std::string& type, const uint8_t *body, int64_t size) {
+            if (type != "traf")
+                return;
+
+            uint32_t trackId = 0;
+            TrackDefaults track;
+            int64_t base = dataEnd;
+            std::vector<IndexedSample> *samples = nullptr;
+            forEachAtom(body, size, [&](const std::string& type, const uint8_t *body, int64_t size) {
+                if (type == "tfhd" && size >= 8) {
+                    uint32_t flags = (uint32_t)readBigEndian(body, 4) & 0xffffff;
+                    trackId = (uint32_t)readBigEndian(body + 4, 4);
+                    track = defaults[trackId];
+                    const uint8_t *field = body + 8;
+                    const uint8_t *end = body + size;
+                    if ((flags & 0x01) && field + 8 <= end)
+                        base = (int64_t)readBigEndian(field, 8), field += 8;
+                    else if (flags & 0x020000)
+                        base = moof.first;
+                    if (flags & 0x02)
+                        field += 4;
+                    if ((flags & 0x08) && field + 4 <= end)
+                        track.duration = (int64_t)readBigEndian(field, 4), field += 4;
+                    if ((flags & 0x10) && field + 4 <= end)
+                        track.size = (int64_t)readBigEndian(field, 4);
+                    if (trackId == (uint32_t)videoStream->id)
+                        samples = &videoSamples_;
+                    else if (audioStream && trackId == (uint32_t)audioStream->id)
+                        samples = &audioSamples_;
+                    dataEnd = base;
+                }
+                else if (type == "tfdt" && size >= 8) {
+                    bool version1 = body[0] == 1;
+                    if (!version1 || size >= 12)
+                        nextDts[trackId] = (int64_t)readBigEndian(body + 4, version1 ? 8 : 4);
+                }
+                else if (type == "trun" && size >= 8) {
+                    uint32_t flags = (uint32_t)readBigEndian(body, 4) & 0xffffff;
+                    int64_t count = (int64_t)readBigEndian(body + 4, 4);
+                    const uint8_t *field = body + 8;
+                    const uint8_t *end = body + size;
+                    int64_t pos = dataEnd;
+                    if ((flags & 0x01) && field + 4 <= end)
+                        pos = base + (int32_t)readBigEndian(field, 4), field += 4;
+                    if (flags & 0x04)
+                        field += 4;
+                    int fieldsPerSample = !!(flags & 0x100) + !!(flags & 0x200) + !!(flags & 0x400) + !!(flags & 0x800);
+                    if (field + count * fieldsPerSample * 4 > end)
+                        return;
+                    int64_t& dts = nextDts[trackId];
+                    for (int64_t i = 0; i < count; ++i) {
+                        IndexedSample sample{ pos, track.size, dts, track.duration };
+                        if (flags & 0x100)
+                            sample.duration = (int64_t)readBigEndian(field, 4), field += 4;
+                        if (flags & 0x200)
+                            sample.size = (int64_t)readBigEndian(field, 4), field += 4;
+                        if (flags & 0x400)
+                            field += 4;
+                        if (flags & 0x800)
+                            field += 4;
+                        if (samples && sample.pos + sample.size <= fileSize)
+                            samples->push_back(sample);
+                        pos += sample.size;
+                        dts += sample.duration;
+                    }
+                    dataEnd = pos;
+                }
+            });
+        });
+    }
+
+    indexed_ = true;
+    fragmented_ = true;
+    video_.maxFrames = (int64_t)videoSamples_.size();
+    FDN_DEBUG("indexed ", video_.maxFrames, " frames from ", moofs.size(), " fragments");
+}
+
+void MovieReader::readSample(const IndexedSample& sample, uint8_t *into)
+{
+    if (avio_seek(ioContext_.get(), sample.pos, SEEK_SET) < 0
+        || avio_read(ioContext_.get(), into, (int)sample.size) != (int)sample.size)
+        throw std::runtime_error("could not read sample at " + std::to_string(sample.pos));
+}
+
 
 MovieReader::~MovieReader()
 {
     onClose_();
 }
 
+void MovieReader::resizeAVIOBuffer(size_t size)
+{
+    AVIOContext *ioContext = ioContext_.get();
+    if ((int)size == ioContext->buffer_size)
+        return;
+
+    uint8_t *buffer = sessionBufferPool().allocate(size);
+    if (!buffer)
+        throw std::runtime_error("couldn't allocate read buffer");
+
+    // as ffio_set_buf_size, but from the pool; this discards anything buffered, so reposition afterwards.
+    //   The context can't be swapped for a new one from avio_alloc_context instead, because the mov
+    //   demuxer keeps its own pointer to it for each track (MOVStreamContext::pb) once the header is read.
+    //   So this relies on what ffio_set_buf_size relies on: that buffer, buf_ptr and buf_end describe
+    //   what is buffered, buffer_size and orig_buffer_size its capacity, and that an empty buffer
+    //   followed by avio_seek leaves the context as it would be just after opening
+    int64_t position = avio_tell(ioContext);
+    sessionBufferPool().release(ioContext->buffer);
+    ioContext->buffer = ioContext->buf_ptr = ioContext->buf_end = buffer;
+    ioContext->buffer_size = ioContext->orig_buffer_size = (int)size;
+    if (avio_seek(ioContext, position, SEEK_SET) < 0)
+        throw std::runtime_error("couldn't seek after resizing read buffer");
+
+    FDN_DEBUG("AVIO read buffer is ", size, " bytes");
+}
+
 
 int MovieReader::c_onRead(void *context, uint8_t *data, int size)
 {
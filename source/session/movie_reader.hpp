@@ -16,7 +16,8 @@ class MovieReader
 public:
     MovieReader(
         VideoFormat videoFormat,
-        MovieFile file
+        MovieFile file,
+        size_t avioBufferSize = 0   // 0 sizes from the video and the "avio" configuration
     );
     ~MovieReader();
 
@@ -32,6 +33,8 @@ public:
     int frameRateDenominator() const { return video_.frameRate.denominator; }
     int64_t numFrames() const { return video_.maxFrames; }
     VideoDef video() const { return video_; }
+    bool fragmented() const { return fragmented_; }
+    bool fromSidecar() const { return fromSidecar_; }  // opened from a MovieIndex rather than by libav
 
 private:
     std::string filespec_; // path + filename
@@ -48,6 +51,26 @@ private:
     int64_t numFrames_{0};
 
     VideoDef video_;
+
+    // where the samples are, when they're read directly rather than through libav: for a fragmented
+    // movie, as libav only learns of its samples as it reads through the file, so they're found up
+    // front from the moof atoms; and for a movie opened from its sidecar index
+    struct IndexedSample
+    {
+        int64_t pos;
+        int64_t size;
+        int64_t dts;
+        int64_t duration;
+    };
+    bool indexed_{false};
+    bool fragmented_{false};
+    bool fromSidecar_{false};
+    std::vector<IndexedSample> videoSamples_;
+    std::vector<IndexedSample> audioSamples_;
+    void openWithLibav(VideoFormat videoFormat);
+    bool openFromSidecar(VideoFormat videoFormat, const MovieSidecarReadCallback& onReadSidecar);
+    void indexFragments();
+    void readSample(const IndexedSample& sample, uint8_t *into);
     
     // audio, valid if audioStreamIdx_>=0
     std::unique_ptr<AudioDef> audioDef_;
@@ -57,10 +80,9 @@ private:
     // adapt writers that throw exceptions
     static int c_onRead(void *context, uint8_t *data, int size);
     static int64_t c_onSeek(void *context, int64_t offset, int whence);
-    // we're forced to allocate a buffer for AVIO.
-    // TODO: get an no idea what an appropriate size is
-    // TODO: hook libav allocation system so it can use externally cached memory management
-    const size_t cAVIOBufferSize = 2 << 20;
+    // we're forced to allocate a buffer for AVIO; see avioBufferSize
+    // it is drawn from sessionBufferPool() and goes back to it when the io context is freed
+    void resizeAVIOBuffer(size_t size);
 
     MovieReadCallback onRead_;
     MovieSeekCallback onSeek_;
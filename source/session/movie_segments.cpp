@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "logging.hpp"
+#include "movie_reader.hpp"
+#include "movie_segments.hpp"
+#include "movie_writer.hpp"
+#include "write_behind_file.hpp"
+
+static int64_t audioSamplesBefore(int64_t frame, Rational frameRate, int sampleRate)
+{
+    return frame * sampleRate * frameRate.denominator / frameRate.numerator;
+}
+
+std::vector<MovieSegment> splitIntoSegments(int64_t frames, int segments, Rational frameRate, int sampleRate)
+{
+    if (frames < 1 || segments < 1)
+        throw std::runtime_error("nothing to split into segments");
+    segments = (int)std::min(frames, (int64_t)segments);
+
+    std::vector<MovieSegment> split;
+    int64_t firstFrame = 0;
+    for (int i = 0; i < segments; ++i)
+    {
+        int64_t segmentFrames = frames / segments + ((i < frames % segments) ? 1 : 0);
+        int64_t firstAudioSample = audioSamplesBefore(firstFrame, frameRate, sampleRate);
+        int64_t endAudioSample = audioSamplesBefore(firstFrame + segmentFrames, frameRate, sampleRate);
+        split.push_back(MovieSegment{ firstFrame, segmentFrames, firstAudioSample, endAudioSample - firstAudioSample });
+        firstFrame += segmentFrames;
+    }
+    return split;
+}
+
+std::string segmentMoviePath(const std::string& moviePath, int iSegment)
+{
+    fs::path path(moviePath);
+    std::string number = std::to_string(iSegment);
+    number.insert(0, (number.size() < 3) ? 3 - number.size() : 0, '0');
+    return (path.parent_path() / (path.stem().string() + ".segment" + number + path.extension().string())).string();
+}
+
+static bool sameAudio(const AudioDef& lhs, const AudioDef& rhs)
+{
+    return lhs.numChannels == rhs.numChannels && lhs.sampleRate == rhs.sampleRate
+        && lhs.bytesPerSample == rhs.bytesPerSample && lhs.encoding == rhs.encoding;
+}
+
+void stitchMovies(VideoFormat videoFormat, const std::vector<MovieFile>& segments, MovieFile output)
+{
+    if (segments.empty())
+        throw std::runtime_error("no segments to stitch");
+
+    // all are opened up front, to check they go together before anything is written
+    std::vector<MovieRange> ranges;
+    for (const auto& segment : segments)
+        ranges.push_back(MovieRange{ std::make_unique<MovieReader>(videoFormat, segment) });
+    FDN_INFO("stitching ", ranges.size(), " segments");
+
+    joinMovies(ranges, output);
+}
+
+void stitchMovieSegments(VideoFormat videoFormat, const std::string& moviePath, int segments)
+{
+    if (segments < 1)
+        throw std::runtime_error("no segments to stitch");
+
+    std::vector<MovieRange> ranges;
+    for (int i = 0; i < segments; ++i)
+        ranges.push_back(MovieRange{ createMovieReader(videoFormat, fs::path(segmentMoviePath(moviePath, i))) });
+    FDN_INFO("stitching ", segments, " segments into ", moviePath);
+
+    joinMovies(ranges, createMovieFile(moviePath));
+}
+
+void joinMovies(std::vector<MovieRange>& ranges, MovieFile output)
+{
+    if (ranges.empty())
+        throw std::runtime_error("no movies to join");
+
+    VideoDef video = ranges.front().reader->video();
+    std::optional<AudioDef> audio;
+    if (ranges.front().reader->hasAudio())
+        audio = ranges.front().reader->audioDef();
+
+    // the frames and samples of each range, from first to end
+    struct Extent
+    {
+        int64_t firstFrame;
+        int64_t endFrame;
+        int64_t firstSample;
+        int64_t endSample;
+    };
+    std::vector<Extent> extents;
+    int64_t frames = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        const MovieRange& range = ranges[i];
+        const MovieReader& reader = *range.reader;
+        if (reader.video().format != video.format || reader.video().encodedBitDepth != video.encodedBitDepth
+            || reader.width() != video.width || reader.height() != video.height
+            || reader.video().frameRate.numerator != video.frameRate.numerator
+            || reader.video().frameRate.denominator != video.frameRate.denominator)
+            throw std::runtime_error("movie " + std::to_string(i) + " has different video to the first");
+        if (reader.hasAudio() != (bool)audio || (audio && !sameAudio(reader.audioDef(), *audio)))
+            throw std::runtime_error("movie " + std::to_string(i) + " has different audio to the first");
+
+        int64_t endFrame = (range.frames < 0) ? reader.numFrames() : range.firstFrame + range.frames;
+        if (range.firstFrame < 0 || range.firstFrame >= endFrame || endFrame > reader.numFrames())
+            throw std::runtime_error("frames " + std::to_string(range.firstFrame) + " to " + std::to_string(endFrame)
+                                     + " are outside movie " + std::to_string(i) + " of " + std::to_string(reader.numFrames()) + " frames");
+
+        Extent extent{ range.firstFrame, endFrame, 0, 0 };
+        if (audio)
+        {
+            int64_t audioSamples = reader.numAudioFrames();
+            extent.firstSample = std::min(audioSamplesBefore(extent.firstFrame, video.frameRate, audio->sampleRate), audioSamples);
+            extent.endSample = (endFrame == reader.numFrames())
+                                   ? audioSamples
+                                   : std::min(audioSamplesBefore(endFrame, video.frameRate, audio->sampleRate), audioSamples);
+        }
+        extents.push_back(extent);
+        frames += endFrame - range.firstFrame;
+    }
+    video.maxFrames = frames;
+    FDN_INFO("joining ", ranges.size(), " movies of ", frames, " frames in all");
+
+    // frames and audio go to the file straight from the buffers they're read into
+    auto muxer = muxerConfiguration();
+    auto writeBehind = writeBehindConfiguration();
+    if (!sidecarConfiguration().enabled)
+        output.onWriteSidecar = nullptr;
+    if (writeBehind.enabled)
+        output = createWriteBehindMovieFile(output, writeBehind);
+    MovieWriter writer(
+        0,                  // reserveMetadataSpace
+        output,
+        video,
+        audio,
+        false,              // writeMoovTagEarly; the trailer moves it ahead of the media if it can
+        0,                  // avioBufferSize, from the video
+        0.0,                // fragmentInterval
+        true,               // nativeMuxer
+        muxer.frameAlignment,
+        std::max(audioChunkConfiguration().frames, 1)
+    );
+    writer.writeHeader();
+
+    // the audio of the ranges as one stream, which needn't break where the video does
+    size_t audioRange = 0;
+    int64_t audioRead = extents.front().firstSample;   // of audioRange
+    int64_t audioAppended = 0;
+    std::vector<uint8_t> samples;
+    auto appendAudioThrough = [&](int64_t end) {
+        while (audioAppended < end && audioRange < ranges.size())
+        {
+            int64_t available = extents[audioRange].endSample - audioRead;
+            if (available == 0)
+            {
+                if (++audioRange < ranges.size())
+                    audioRead = extents[audioRange].firstSample;
+                continue;
+            }
+            int64_t size = std::min(available, end - audioAppended);
+            ranges[audioRange].reader->readAudio((size_t)audioRead, (size_t)size, samples);
+            writer.appendAudio(samples.data(), samples.size());
+            audioRead += size;
+            audioAppended += size;
+        }
+    };
+
+    std::vector<uint8_t> frame;
+    int64_t iFrame = 0;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        for (int64_t source = extents[i].firstFrame; source < extents[i].endFrame; ++source)
+        {
+            // each frame's audio ahead of it, so that the writer can follow the frame with it
+            if (audio)
+            {
+                int64_t needed = audioSamplesBefore(iFrame + 1, video.frameRate, audio->sampleRate);
+                if (audioAppended < needed)
+                    appendAudioThrough(needed + audio->sampleRate);
+            }
+            ranges[i].reader->readVideoFrame((int)source, frame);
+            writer.writeVideoFrame(frame.data(), frame.size());
+            ++iFrame;
+        }
+    }
+    if (audio)
+        appendAudioThrough(std::numeric_limits<int64_t>::max());
+
+    writer.writeTrailer();
+    writer.close();
+}
@@ -0,0 +1,59 @@
+#ifndef MOVIE_SEGMENTS_HPP
+#define MOVIE_SEGMENTS_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ffmpeg_helpers.hpp"
+#include "movie_reader.hpp"
+
+// segmented export
+//   a long export is split into segments of consecutive frames, each exported through createExporter
+//   by a process - or a render node - of its own, to a movie of its own. As every frame of our codecs
+//   is a keyframe, the segments are independent of each other, and stitchMovies joins them into the
+//   one movie by copying their frames and audio as they are, without decoding.
+
+struct MovieSegment
+{
+    int64_t firstFrame;
+    int64_t frames;
+    int64_t firstAudioSample;  // 0 without audio
+    int64_t audioSamples;
+};
+
+// frames split as evenly as they go into segments, each at least a frame long. The audio is split at
+// the same points, frame n starting at sample n * sampleRate / frameRate, so the stitched audio is
+// exactly the audio of the whole; sampleRate is 0 without audio.
+std::vector<MovieSegment> splitIntoSegments(int64_t frames, int segments, Rational frameRate, int sampleRate = 0);
+
+// the movie for segment iSegment of the movie at moviePath, alongside it
+std::string segmentMoviePath(const std::string& moviePath, int iSegment);
+
+// writes the frames and audio of each of segments in turn to output; see joinMovies
+void stitchMovies(VideoFormat videoFormat, const std::vector<MovieFile>& segments, MovieFile output);
+
+// stitches the segment movies 0 to segments - 1 of moviePath, as named by segmentMoviePath, into the
+// movie at moviePath
+void stitchMovieSegments(VideoFormat videoFormat, const std::string& moviePath, int segments);
+
+// frames firstFrame to firstFrame + frames of a movie, with the audio that goes with them
+//   the audio runs from the first sample of firstFrame to the last of the last frame, counting
+//   sampleRate / frameRate samples to a frame. A range that reaches the end of the movie takes all of
+//   the audio from its start, so whole movies are joined with all of their audio.
+struct MovieRange
+{
+    std::unique_ptr<MovieReader> reader;
+    int64_t firstFrame{ 0 };
+    int64_t frames{ -1 };   // -1 for the rest of the movie
+};
+
+// writes each of ranges in turn to output, a movie with a sample table for the whole, copying the
+// compressed frames and PCM without decoding them. The movies must have the same 4CC, bit depth, frame
+// size and frame rate, and the same audio, if any; throws if they don't, if a range is outside its
+// movie, or on failing to read or write.
+//   output is written as createExporter writes, with the native muxer; frames and audio are read in
+//   the order they're written, the audio a second at a time ahead of the frames it goes with.
+void joinMovies(std::vector<MovieRange>& ranges, MovieFile output);
+
+#endif
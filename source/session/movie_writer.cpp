@@ -18,10 +18,107 @@ extern "C" {
 #endif
 // !!! needed to fool 4CC validation
 #include <libavformat/internal.h>
+// !!! needed to measure the sample tables the muxer will write
+#include <libavformat/movenc.h>
 }
 
+// internal.h and movenc.h are private to libavformat, and MOVMuxContext / MOVTrack change between
+//   releases, so these must be the headers of the library linked: FFmpeg 4.0 (libavformat 58.12), as
+//   pinned by the external/ffmpeg submodule. Check the sample table sizes below against movenc.c
+//   before moving to another version
+#if LIBAVFORMAT_VERSION_MAJOR != 58 || LIBAVFORMAT_VERSION_MINOR != 12
+#error "movie_writer.cpp uses libavformat internals and is only known to work with libavformat 58.12 (FFmpeg 4.0)"
+#endif
+
+#include "config.hpp"
 #include "logging.hpp"
 #include "movie_writer.hpp"
+#include "util.hpp"
+
+using json = nlohmann::json;
+
+void from_json(const json& j, PreallocationConfiguration& c) {
+    j.at("enabled").get_to(c.enabled);
+    j.at("headroom").get_to(c.headroom);
+}
+
+PreallocationConfiguration preallocationConfiguration()
+{
+    PreallocationConfiguration config;
+    try {
+        fdn::config().at("preallocate").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+void from_json(const json& j, FaststartConfiguration& c) {
+    j.at("enabled").get_to(c.enabled);
+}
+
+FaststartConfiguration faststartConfiguration()
+{
+    FaststartConfiguration config;
+    try {
+        fdn::config().at("faststart").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+void from_json(const json& j, FragmentConfiguration& c) {
+    j.at("enabled").get_to(c.enabled);
+    j.at("interval").get_to(c.interval);
+}
+
+FragmentConfiguration fragmentConfiguration()
+{
+    FragmentConfiguration config;
+    try {
+        fdn::config().at("fragment").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+void from_json(const json& j, MuxerConfiguration& c) {
+    j.at("native").get_to(c.native);
+    j.at("frameAlignment").get_to(c.frameAlignment);
+}
+
+MuxerConfiguration muxerConfiguration()
+{
+    MuxerConfiguration config;
+    try {
+        fdn::config().at("muxer").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+void from_json(const json& j, AudioChunkConfiguration& c) {
+    j.at("frames").get_to(c.frames);
+}
+
+AudioChunkConfiguration audioChunkConfiguration()
+{
+    AudioChunkConfiguration config;
+    try {
+        fdn::config().at("audioChunk").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
 
 #undef av_err2str
 std::string av_err2str(int errnum)
@@ -80,13 +177,47 @@ MovieWriter::MovieWriter(
     MovieFile file,
     const VideoDef& video,
     std::optional<AudioDef> audio,
-    bool writeMoovTagEarly)
-    : video_(video), reserveMetadataSpace_(reserveMetadataSpace),
-      onWrite_(file.onWrite), onSeek_(file.onSeek), onClose_(file.onClose),      
-      writeMoovTagEarly_(writeMoovTagEarly)
+    bool writeMoovTagEarly,
+    size_t avioBufferSize,
+    double fragmentInterval,
+    bool nativeMuxer,
+    int64_t frameAlignment,
+    int framesPerAudioChunk)
+    : video_(video), reserveMetadataSpace_(reserveMetadataSpace), audio_(audio),
+      onWrite_(file.onWrite), onSeek_(file.onSeek), onClose_(file.onClose),
+      onPreallocate_(file.onPreallocate), onTruncate_(file.onTruncate), onMove_(file.onMove),
+      onWriteSidecar_(file.onWriteSidecar),
+      writeMoovTagEarly_(writeMoovTagEarly), fragmentInterval_(fragmentInterval),
+      avioBufferSize_(avioBufferSize ? avioBufferSize : ::avioBufferSize(video, avioConfiguration(), false)),
+      framesPerAudioChunk_(framesPerAudioChunk)
 {
     file.onOpenForWrite();
 
+    // a fragmented movie is indexed from its fragments when it's read
+    if (fragmentInterval_ > 0)
+        onWriteSidecar_ = nullptr;
+
+    if (nativeMuxer && fragmentInterval_ <= 0)
+    {
+        // no streams, codecs or 4CC validation; frames go straight to the file
+        native_ = std::make_unique<QuickTimeMuxer>(video, audio,
+            [this](const uint8_t *data, size_t size) {
+                if (onWrite_(data, (int)size) != 0)
+                    throw std::runtime_error("Error writing to output file");
+                position_ += size;
+                end_ = std::max(end_, position_);
+            },
+            [this](int64_t position) {
+                if (onSeek_(position, SEEK_SET) < 0)
+                    throw std::runtime_error("Error seeking in output file");
+                position_ = position;
+            },
+            frameAlignment);
+        return;
+    }
+    if (frameAlignment > 1)
+        FDN_WARNING("frame alignment needs the native muxer and an unfragmented movie; frames will not be aligned");
+
     /* allocate the output media context */
     AVFormatContext *formatContext = avformat_alloc_context();
     formatContext->oformat = &ff_mov_muxer;
@@ -142,13 +273,14 @@ MovieWriter::MovieWriter(
     videoStream_->time_base.num = 1;
     //videoStream_->codec->time_base = streamTimebase_; // deprecation warning, but it work...
 
-    uint8_t* buffer = (uint8_t*)av_malloc(cAVIOBufferSize);
+    FDN_DEBUG("AVIO write buffer is ", avioBufferSize_, " bytes");
+    uint8_t* buffer = sessionBufferPool().allocate(avioBufferSize_);
     if (!buffer)
         throw std::runtime_error("couldn't allocate write buffer");
 
     AVIOContext *ioContext = avio_alloc_context(
         buffer,               // unsigned char *buffer,
-        (int)cAVIOBufferSize, // int buffer_size,
+        (int)avioBufferSize_, // int buffer_size,
         1,                    // int write_flag,
         this,                 // void *opaque,
         nullptr,              // int(*read_packet)(void *opaque, uint8_t *buf, int buf_size),
@@ -156,7 +288,7 @@ MovieWriter::MovieWriter(
         c_onSeek);            // int64_t(*seek)(void *opaque, int64_t offset, int whence));
     if (!ioContext)
     {
-        av_free(buffer);  // not owned by anyone yet :(
+        sessionBufferPool().release(buffer);  // not owned by anyone yet :(
         throw std::runtime_error("couldn't allocate io context");
     }
     ioContext_.reset(ioContext);
@@ -171,8 +303,24 @@ MovieWriter::MovieWriter(
     //writeHeader();
 }
 
-void MovieWriter::writeHeader()
+void MovieWriter::writeHeader(int64_t reserveFileSize)
 {
+    if (reserveFileSize > 0 && onPreallocate_ && onTruncate_)
+    {
+        FDN_INFO("reserving ", reserveFileSize, " bytes for output");
+        if (onPreallocate_(reserveFileSize) < 0)
+            throw std::runtime_error("not enough space for output file (" + std::to_string(reserveFileSize) + " bytes)");
+        preallocated_ = true;
+    }
+
+    if (native_)
+    {
+        if (writeMoovTagEarly_)
+            reservedMoovSize_ = guessMoovSize() * 2;
+        native_->writeHeader(reservedMoovSize_, writeMoovTagEarly_ ? reserveMetadataSpace_ : 0);
+        return;
+    }
+
     Dictionary movOptions;
     AVDictionary* movOptionsDictptr(nullptr);
     movOptions.reset(&movOptionsDictptr);
@@ -182,20 +330,45 @@ void MovieWriter::writeHeader()
     av_dict_set(&movOptionsDictptr, "use_editlist", "0", 0);
     // !!!
 
-    if (writeMoovTagEarly_)
+    if (fragmentInterval_ > 0)
+    {
+        // the moov goes first with no samples in it and each fragment carries its own sample tables,
+        // so there's nothing to reserve; still leave Adobe CC its metadata space
+        av_dict_set(&movOptionsDictptr, "movflags", "empty_moov+default_base_moof", 0);
+        av_dict_set(&movOptionsDictptr, "frag_duration", std::to_string((int64_t)(fragmentInterval_ * 1000000)).c_str(), 0);
+        if (writeMoovTagEarly_)
+            av_dict_set(&formatContext_->metadata, "xmp", std::string(reserveMetadataSpace_, ' ').c_str(), 0);
+    }
+    else if (writeMoovTagEarly_)
     {
         // avoid Adobe CC's post export copy step by giving ffmpeg enough info to put the moov header at
         // the start, including metadata
         auto predictedMoovSize = guessMoovSize();
+        reservedMoovSize_ = predictedMoovSize * 2;
 
         av_dict_set(&formatContext_->metadata, "xmp", std::string(reserveMetadataSpace_, ' ').c_str(), 0);
-        av_dict_set(&movOptionsDictptr, "moov_size", std::to_string((int)(predictedMoovSize * 2)).c_str(), 0);
+        av_dict_set(&movOptionsDictptr, "moov_size", std::to_string((int)reservedMoovSize_).c_str(), 0);
     }
 
     int ret = avformat_write_header(formatContext_.get(), movOptions.get()); // this is where the mov file format trashes the videoStream_ timebase
     if (ret < 0) {
         throw std::runtime_error(std::string("Error occurred when writing header: ") + av_err2str(ret).c_str());
     }
+
+    if (reservedMoovSize_)
+    {
+        // the muxer leaves a hole for the moov; make it a 'free' atom so that the file is still valid
+        // if the moov ends up after mdat instead. The moov overwrites it when it fits.
+        const MOVMuxContext *mov = reinterpret_cast<const MOVMuxContext *>(formatContext_->priv_data);
+        AVIOContext *pb = ioContext_.get();
+        int64_t position = avio_tell(pb);
+        avio_seek(pb, mov->reserved_header_pos, SEEK_SET);
+        avio_wb32(pb, (unsigned int)reservedMoovSize_);
+        avio_write(pb, (const unsigned char *)"free", 4);
+        avio_seek(pb, position, SEEK_SET);
+        if (pb->error < 0)
+            throw std::runtime_error(std::string("Error reserving header space: ") + av_err2str(pb->error).c_str());
+    }
 }
 
 MovieWriter::~MovieWriter()
@@ -224,6 +397,8 @@ void MovieWriter::close()
         {
             throw std::runtime_error("error while closing");
         }
+
+        FDN_DEBUG("buffer pool holds ", sessionBufferPool().bytesInUse(), " bytes in use and ", sessionBufferPool().bytesCached(), " cached");
     }
 }
 
@@ -232,7 +407,17 @@ int MovieWriter::c_onWrite(void *context, uint8_t *data, int size)
     MovieWriter *writer = reinterpret_cast<MovieWriter*>(context);
     try
     {
-        return (int)writer->onWrite_(data, size);
+        int result = (int)writer->onWrite_(data, size);
+        if (result >= 0) {
+            if (writer->captureFrom_ >= 0 && writer->position_ >= writer->captureFrom_) {
+                size_t offset = (size_t)(writer->position_ - writer->captureFrom_);
+                writer->captured_.resize(std::max(writer->captured_.size(), offset + size));
+                std::memcpy(writer->captured_.data() + offset, data, size);
+            }
+            writer->position_ += size;
+            writer->end_ = std::max(writer->end_, writer->position_);
+        }
+        return result;
     }
     catch (const std::exception &ex)
     {
@@ -258,7 +443,16 @@ int64_t MovieWriter::c_onSeek(void *context, int64_t seekPos, int whence)
         else {
             whence &= (~AVSEEK_FORCE);  // we don't want this potential option to interfere
 
-            return writer->onSeek_(seekPos, whence);
+            int result = writer->onSeek_(seekPos, whence);
+            if (result >= 0) {
+                if (whence == SEEK_SET)
+                    writer->position_ = seekPos;
+                else if (whence == SEEK_CUR)
+                    writer->position_ += seekPos;
+                else if (whence == SEEK_END)
+                    writer->position_ = writer->end_ + seekPos;
+            }
+            return result;
         }
     }
     catch (const std::exception &ex)
@@ -284,13 +478,75 @@ void MovieWriter::addAudioStream(const AudioDef& audio)
     setAVCodecParams(audio.numChannels, audio.sampleRate, audio.bytesPerSample, audio.encoding, *audioStream_->codecpar);
 }
 
+// the interleaver holds on to packets, so they're copied once into pooled buffers rather than
+// into ones it would malloc itself
+static void setPooledPacketData(AVPacket& pkt, const uint8_t *data, size_t size)
+{
+    pkt.buf = sessionBufferPool().allocateRef(size);
+    if (!pkt.buf)
+        throw std::runtime_error("couldn't allocate packet buffer");
+    copyFrameData(pkt.buf->data, data, size);
+    pkt.data = pkt.buf->data;
+    pkt.size = (int)size;
+}
+
+void MovieWriter::indexFrame(const uint8_t *data, size_t size)
+{
+    if (onWriteSidecar_)
+        index_.frames.push_back(MovieIndex::Frame{ -1, (uint32_t)size, frameChecksum(data, size) });
+}
+
 void MovieWriter::writeVideoFrame(const uint8_t *data, size_t size)
 {
-    AVPacket pkt = { 0 };
+    indexFrame(data, size);
+    if (native_)
+    {
+        native_->writeVideoFrame(data, size);
+        ++iFrame_;
+    }
+    else
+    {
+        AVPacket pkt = { 0 };
 
-    av_init_packet(&pkt);
-    pkt.data = const_cast<uint8_t *>(data);
-    pkt.size = (int)size;
+        av_init_packet(&pkt);
+        setPooledPacketData(pkt, data, size);
+        writeVideoPacket(pkt);
+    }
+    writePreloadedAudioThroughFrame();
+}
+
+void MovieWriter::writeVideoFrame(AVBufferRef *buffer)
+{
+    indexFrame(buffer->data, buffer->size);
+    if (native_)
+    {
+        // written before returning, so there's nothing to hold on to
+        try {
+            native_->writeVideoFrame(buffer->data, buffer->size);
+        }
+        catch (...) {
+            av_buffer_unref(&buffer);
+            throw;
+        }
+        av_buffer_unref(&buffer);
+        ++iFrame_;
+    }
+    else
+    {
+        AVPacket pkt = { 0 };
+
+        av_init_packet(&pkt);
+        pkt.buf = buffer;
+        pkt.data = buffer->data;
+        pkt.size = buffer->size;
+        writeVideoPacket(pkt);
+    }
+    writePreloadedAudioThroughFrame();
+}
+
+// takes ownership of pkt's buffer, which the interleaver keeps rather than copies
+void MovieWriter::writeVideoPacket(AVPacket& pkt)
+{
     pkt.stream_index = videoStream_->index;
     pkt.pts = iFrame_++;
     pkt.dts = pkt.pts;
@@ -304,15 +560,51 @@ void MovieWriter::writeVideoFrame(const uint8_t *data, size_t size)
     {
         throw std::runtime_error(std::string("Error while writing video frame: ") + av_err2str(ret).c_str());
     }
+    flushCompletedFragments();
 }
 
 void MovieWriter::writeAudioFrame(const uint8_t *data, size_t size, int64_t pts)
 {
+    if (native_)
+    {
+        // audio is written contiguously, so pts only matters to the interleaver
+        native_->writeAudioFrame(data, size);
+        return;
+    }
+
     AVPacket pkt = { 0 };
 
     av_init_packet(&pkt);
-    pkt.data = const_cast<uint8_t *>(data);
-    pkt.size = (int)size;
+    setPooledPacketData(pkt, data, size);
+    writeAudioPacket(pkt, pts);
+}
+
+void MovieWriter::writeAudioFrame(AVBufferRef *buffer, int64_t pts)
+{
+    if (native_)
+    {
+        try {
+            native_->writeAudioFrame(buffer->data, buffer->size);
+        }
+        catch (...) {
+            av_buffer_unref(&buffer);
+            throw;
+        }
+        av_buffer_unref(&buffer);
+        return;
+    }
+
+    AVPacket pkt = { 0 };
+
+    av_init_packet(&pkt);
+    pkt.buf = buffer;
+    pkt.data = buffer->data;
+    pkt.size = buffer->size;
+    writeAudioPacket(pkt, pts);
+}
+
+void MovieWriter::writeAudioPacket(AVPacket& pkt, int64_t pts)
+{
     pkt.stream_index = audioStream_->index;
     pkt.pts = pts;
     pkt.dts = pkt.pts;
@@ -326,10 +618,140 @@ void MovieWriter::writeAudioFrame(const uint8_t *data, size_t size, int64_t pts)
     {
         throw std::runtime_error(std::string("Error while writing audio frame: ") + av_err2str(ret).c_str());
     }
+    flushCompletedFragments();
+}
+
+void MovieWriter::preloadAudio(const uint8_t *data, size_t size, int64_t pts)
+{
+    std::lock_guard<std::mutex> guard(preloadedMutex_);
+    storeAudio(data, size, pts);
+}
+
+void MovieWriter::appendAudio(const uint8_t *data, size_t size)
+{
+    std::lock_guard<std::mutex> guard(preloadedMutex_);
+    storeAudio(data, size, preloadedEnd_);
+}
+
+void MovieWriter::storeAudio(const uint8_t *data, size_t size, int64_t pts)
+{
+    if (!audio_)
+        throw std::runtime_error("no audio stream to preload audio for");
+    size_t bytesPerSample = (size_t)audio_->numChannels * audio_->bytesPerSample;
+    if (size % bytesPerSample)
+        throw std::runtime_error("preloaded audio must be whole samples");
+    if (pts < preloadedEnd_)
+        throw std::runtime_error("preloaded audio overlaps audio already preloaded");
+    if (!preloaded_)
+        preloaded_ = std::make_unique<PcmStore>((size_t)preloadedAudioConfiguration().memoryLimit);
+
+    if (pts > preloadedEnd_)
+    {
+        if (!preloadedAhead_.emplace(pts, std::vector<uint8_t>(data, data + size)).second)
+            throw std::runtime_error("preloaded audio overlaps audio already preloaded");
+        return;
+    }
+
+    preloaded_->append(data, size);
+    preloadedEnd_ += (int64_t)(size / bytesPerSample);
+
+    // and whatever was waiting for it
+    for (auto ahead = preloadedAhead_.find(preloadedEnd_); ahead != preloadedAhead_.end(); ahead = preloadedAhead_.find(preloadedEnd_))
+    {
+        preloaded_->append(ahead->second.data(), ahead->second.size());
+        preloadedEnd_ += (int64_t)(ahead->second.size() / bytesPerSample);
+        preloadedAhead_.erase(ahead);
+    }
+}
+
+// where audio sample boundaries fall on frame boundaries, rounding down
+int64_t MovieWriter::audioSamplesBefore(int64_t frame) const
+{
+    return frame * audio_->sampleRate * video_.frameRate.denominator / video_.frameRate.numerator;
+}
+
+// each chunk of preloaded audio that ends with the frames written so far, so it follows its last frame
+void MovieWriter::writePreloadedAudioThroughFrame()
+{
+    if (!audio_)
+        return;
+    int64_t framesPerChunk = std::max(framesPerAudioChunk_, 1);
+    while ((preloadedChunks_ + 1) * framesPerChunk <= iFrame_
+           && writePreloadedAudio(audioSamplesBefore((preloadedChunks_ + 1) * framesPerChunk)))
+        ++preloadedChunks_;
+}
+
+bool MovieWriter::writePreloadedAudio(int64_t through)
+{
+    int64_t samples = 0;
+    AVBufferRef *buffer = nullptr;
+    size_t size = 0;
+    {
+        // only the copy out of the store holds up preloadAudio, not the muxing
+        std::lock_guard<std::mutex> guard(preloadedMutex_);
+        if (!preloaded_ || preloadedEnd_ < through)
+            return false;
+        samples = through - preloadedWritten_;
+        if (samples <= 0)
+            return true;
+        size = (size_t)samples * audio_->numChannels * audio_->bytesPerSample;
+
+        if (native_)
+        {
+            preloadedChunk_.resize(size);
+            preloaded_->read(preloadedChunk_.data(), size);
+        }
+        else
+        {
+            buffer = sessionBufferPool().allocateRef(size);
+            if (!buffer)
+                throw std::runtime_error("couldn't allocate packet buffer");
+            try {
+                preloaded_->read(buffer->data, size);
+            }
+            catch (...) {
+                av_buffer_unref(&buffer);
+                throw;
+            }
+        }
+    }
+
+    if (native_)
+    {
+        native_->writeAudioFrame(preloadedChunk_.data(), size);
+    }
+    else
+    {
+        AVPacket pkt = { 0 };
+
+        av_init_packet(&pkt);
+        pkt.buf = buffer;
+        pkt.data = buffer->data;
+        pkt.size = (int)size;
+        writeAudioPacket(pkt, preloadedWritten_);
+    }
+    preloadedWritten_ += samples;
+    return true;
+}
+
+// push each fragment through to the file as the muxer completes it, so that readers and crashes see it
+void MovieWriter::flushCompletedFragments()
+{
+    if (fragmentInterval_ <= 0)
+        return;
+    const MOVMuxContext *mov = reinterpret_cast<const MOVMuxContext *>(formatContext_->priv_data);
+    if (mov->fragments != fragmentsFlushed_)
+    {
+        avio_flush(ioContext_.get());
+        fragmentsFlushed_ = mov->fragments;
+    }
 }
 
 void MovieWriter::flush()
 {
+    if (native_)
+        return;   // nothing is queued
+
     int ret = av_interleaved_write_frame(formatContext_.get(), nullptr);
     if (ret < 0)
     {
@@ -339,6 +761,134 @@ void MovieWriter::flush()
 
 void MovieWriter::writeTrailer()
 {
+    // audio that hadn't arrived by its last frame, and audio beyond the last frame, in the same chunks
+    int64_t preloadedEnd = 0;
+    {
+        std::lock_guard<std::mutex> guard(preloadedMutex_);
+        if (!preloadedAhead_.empty())
+            throw std::runtime_error("preloaded audio is missing samples from " + std::to_string(preloadedEnd_));
+        preloadedEnd = preloadedEnd_;
+    }
+    for (int64_t framesPerChunk = std::max(framesPerAudioChunk_, 1); preloadedWritten_ < preloadedEnd; ++preloadedChunks_)
+        writePreloadedAudio(std::min(audioSamplesBefore((preloadedChunks_ + 1) * framesPerChunk), preloadedEnd));
+
+    if (native_)
+    {
+        // the native muxer knows the exact moov size, and moves the media itself if it has to
+        QuickTimeMuxer::Move move;
+        if (onMove_ && faststartConfiguration().enabled)
+            move = [this](int64_t source, int64_t destination, int64_t size) {
+                if (onMove_(source, destination, size) < 0)
+                    throw std::runtime_error("Error moving media to make room for the moov");
+                end_ = std::max(end_, destination + size);
+            };
+        native_->writeTrailer(move);
+    }
+    else
+        writeLibavTrailer();
+
+    // release whatever was reserved beyond the end of the file
+    if (preallocated_)
+    {
+        if (onTruncate_(end_) < 0)
+            throw std::runtime_error("Error truncating output file");
+    }
+
+    writeSidecar();
+}
+
+// where the muxer put each sample, before av_write_trailer frees its tables
+void MovieWriter::indexLibavSamples()
+{
+    flush();
+    const MOVMuxContext *mov = reinterpret_cast<const MOVMuxContext *>(formatContext_->priv_data);
+
+    const MOVTrack& video = mov->tracks[videoStream_->index];
+    for (int i = 0; i < video.entry && i < (int)index_.frames.size(); ++i)
+        index_.frames[i].position = (int64_t)video.cluster[i].pos;
+
+    if (audioStream_)
+    {
+        const MOVTrack& audio = mov->tracks[audioStream_->index];
+        for (int i = 0; i < audio.entry; ++i)
+            index_.audioChunks.push_back(MovieIndex::AudioChunk{ (int64_t)audio.cluster[i].pos, audio.cluster[i].entries });
+    }
+}
+
+// a failure here leaves a movie that is opened the slow way, so is only a warning
+void MovieWriter::writeSidecar()
+{
+    if (!onWriteSidecar_)
+        return;
+
+    if (native_)
+    {
+        auto positions = native_->videoFramePositions();
+        for (size_t i = 0; i < positions.size() && i < index_.frames.size(); ++i)
+            index_.frames[i].position = positions[i];
+        for (const auto& chunk : native_->audioChunks())
+            index_.audioChunks.push_back(MovieIndex::AudioChunk{ chunk.first, chunk.second });
+    }
+    else
+    {
+        for (auto& frame : index_.frames)
+            frame.position += mediaShift_;
+        for (auto& chunk : index_.audioChunks)
+            chunk.position += mediaShift_;
+    }
+
+    if (index_.frames.empty()
+        || std::any_of(index_.frames.begin(), index_.frames.end(), [](const MovieIndex::Frame& frame) { return frame.position < 0; }))
+    {
+        FDN_WARNING("not writing a sidecar index, as not every frame's position is known");
+        return;
+    }
+
+    index_.movieSize = end_;
+    index_.video = video_;
+    index_.video.maxFrames = (int64_t)index_.frames.size();
+    index_.audio = audio_;
+
+    auto data = serializeMovieIndex(index_);
+    if (onWriteSidecar_(data.data(), data.size()) < 0)
+        FDN_WARNING("couldn't write the sidecar index; the movie will be parsed when it's opened");
+    else
+        FDN_DEBUG("wrote sidecar index of ", data.size(), " bytes");
+}
+
+void MovieWriter::writeLibavTrailer()
+{
+    bool moovAfterMedia = !writeMoovTagEarly_ && fragmentInterval_ <= 0;
+    if (reservedMoovSize_)
+    {
+        // the reserved space was a guess made before any samples were written. movenc writes the moov
+        // into it before checking it fits, so decide here from the tables it is about to write, and
+        // if it won't fit have it put the moov after mdat, behind the 'free' atom writeHeader left.
+        flush();
+        int64_t moovSize = measureMoovSize();
+        // room for the free atom after it, and for the atoms sized by inspection in moovSize
+        const int64_t slack = 4096;
+        if (moovSize + slack > reservedMoovSize_)
+        {
+            FDN_WARNING("moov needs ", moovSize, " bytes but ", reservedMoovSize_, " were reserved; writing it after the media");
+            av_opt_set_int(formatContext_->priv_data, "moov_size", 0, 0);
+            moovAfterMedia = true;
+        }
+    }
+
+    if (onWriteSidecar_)
+        indexLibavSamples();
+
+    // keep a copy of the moov as it is written after the media, to move it ahead of the media after
+    int64_t moovPosition = -1;
+    if (moovAfterMedia && onMove_ && faststartConfiguration().enabled)
+    {
+        flush();
+        avio_flush(ioContext_.get());
+        moovPosition = position_;
+        captureFrom_ = moovPosition;
+    }
+
     /* Write the trailer, if any. The trailer must be written before you
     * close the CodecContexts open when you wrote the header; otherwise
     * av_write_trailer() may try to use memory that was freed on
@@ -350,6 +900,15 @@ void MovieWriter::writeTrailer()
     } 
     else if (ret < 0)
         throw std::runtime_error(std::string("Error writing trailer: ") + av_err2str(ret).c_str());
+
+    if (moovPosition >= 0)
+    {
+        avio_flush(ioContext_.get());
+        captureFrom_ = -1;
+        moveMoovAheadOfMedia(moovPosition);
+    }
+
+    avio_flush(ioContext_.get());
 }
 
 int64_t MovieWriter::guessMoovSize()
@@ -424,17 +983,34 @@ int64_t MovieWriter::guessMoovSize()
     auto n_video_chunks_guess = offsettedMaxFrames_;
     auto n_audio_chunks_guess = offsettedMaxFrames_;
 
-    // stsd
-    //   sample description
-    auto video_stsd = 8 + (8 + 4 + 2 + 2 + 2 + 2 + 4 + 4 + 4 + 2 + 2 + 4 + 4 + 4 + 2 + 1 + 31 + 2 + 2 + 8);
-    auto audio_stsd = 8 + 68;  // !!! from inspection above, needs verification, on cursory inspection is not varying size
+    // unless the audio is packetized here, when the chunks are known: framesPerAudioChunk_ frames'
+    // duration each, with a sample-to-chunk entry wherever the number of samples in a chunk changes
+    int64_t audio_entries_known = -1;
+    if (framesPerAudioChunk_ > 0 && audio_)
+    {
+        int64_t chunks = (video_.maxFrames + framesPerAudioChunk_ - 1) / framesPerAudioChunk_;
+        int64_t previousSamples = -1;
+        audio_entries_known = 0;
+        for (int64_t chunk = 0; chunk < chunks; ++chunk)
+        {
+            int64_t samples = audioSamplesBefore(std::min((chunk + 1) * framesPerAudioChunk_, video_.maxFrames))
+                              - audioSamplesBefore(chunk * framesPerAudioChunk_);
+            if (samples != previousSamples)
+                ++audio_entries_known;
+            previousSamples = samples;
+        }
+        // and a chunk for any audio beyond the last frame
+        n_audio_chunks_guess = chunks + 1;
+        audio_entries_known += 1;
+    }
 
     // stts
     //   time-to-sample, for looking up sample indices from time (on a timeline say).
     //   for the files we're writing this is completely uniform, although samples may be missing
     //   checked this for a file with frames missing from the middle - stts was still 24/32
-    auto video_stts = 24;
-    auto audio_stts = 32;
+    SampleTableSizes video, audio;
+    video.stts = 24;
+    audio.stts = 32;
 
     // stss
     //   we're not writing this
@@ -446,26 +1022,117 @@ int64_t MovieWriter::guessMoovSize()
     //   based on a test encoding the number of entries was approx
     //     maxFrames / 250 for video,
     //     maxFrames / 180 for audio   <-- this seems determined by the granularity of the data pushed from the client
+    //   but an entry is written whenever the samples per chunk changes, which for audio can be every chunk;
+    //   writeTrailer measures the real tables and copes with this guess being short
     auto video_entries_guess = n_video_chunks_guess / 60;
-    auto audio_entries_guess = n_audio_chunks_guess / 60;
-    auto video_stsc = 8 + 4 + 4 + 12 * video_entries_guess;
-    auto audio_stsc = 8 + 4 + 4 + 12 * audio_entries_guess;
+    auto audio_entries_guess = (audio_entries_known >= 0) ? audio_entries_known : n_audio_chunks_guess / 60;
+    video.stsc = 8 + 4 + 4 + 12 * video_entries_guess;
+    audio.stsc = 8 + 4 + 4 + 12 * audio_entries_guess;
 
     // stsz
     //   sample sizes. Frame sizes for video. Uniform for audio.
-    auto video_stsz = 8 + 4 + 4 + offsettedMaxFrames_ * 4;
-    auto audio_stsz = 8 + 4 + 4 + 4;
+    video.stsz = 8 + 4 + 4 + offsettedMaxFrames_ * 4;
+    audio.stsz = 8 + 4 + 4 + 4;
 
     // co64, stco
     //   chunk offset tables
     //   co64 uses 64-bit offsets; assume file might get big enough that this will be used
-    auto video_co64_or_stco = 8 + 4 + 4 + n_video_chunks_guess * 8;
-    auto audio_co64_or_stco = 8 + 4 + 4 + n_audio_chunks_guess * 8;
+    video.co64_or_stco = 8 + 4 + 4 + n_video_chunks_guess * 8;
+    audio.co64_or_stco = 8 + 4 + 4 + n_audio_chunks_guess * 8;
+
+    return moovSize(video, audio);
+}
+
+// exact sizes of the tables movenc will write for a track, by following the same steps as its
+// build_chunks and mov_write_stts/stsc/stsz/stco_tag over the samples it holds
+static MovieWriter::SampleTableSizes measureSampleTables(const MOVTrack& track, bool isPcmAudio)
+{
+    MovieWriter::SampleTableSizes sizes;
+
+    int64_t chunks = 0;
+    int64_t stscEntries = 0;
+    uint64_t chunkPos = 0;
+    uint64_t chunkSize = 0;
+    unsigned int chunkSamples = 0;
+    unsigned int previousChunkSamples = 0;
+    auto endChunk = [&]() {
+        if (chunks && chunkSamples != previousChunkSamples) {
+            ++stscEntries;
+            previousChunkSamples = chunkSamples;
+        }
+    };
+    for (int i = 0; i < track.entry; i++) {
+        const MOVIentry& sample = track.cluster[i];
+        if (i && chunkPos + chunkSize == sample.pos && chunkSize + sample.size < (1 << 20)) {
+            chunkSize += sample.size;
+            chunkSamples += sample.entries;
+        }
+        else {
+            endChunk();
+            ++chunks;
+            chunkPos = sample.pos;
+            chunkSize = sample.size;
+            chunkSamples = sample.entries;
+        }
+    }
+    endChunk();
+
+    int64_t sttsEntries = 1;
+    if (!isPcmAudio && track.entry) {
+        sttsEntries = 0;
+        int64_t previousDuration = -1;
+        for (int i = 0; i < track.entry; i++) {
+            int64_t nextDts = (i + 1 == track.entry) ? track.track_duration + track.start_dts : track.cluster[i + 1].dts;
+            int64_t duration = nextDts - track.cluster[i].dts;
+            if (!i || duration != previousDuration)
+                ++sttsEntries;
+            previousDuration = duration;
+        }
+    }
+
+    bool equalSampleSizes = true;
+    int64_t samples = 0;
+    int64_t previousSampleSize = -1;
+    for (int i = 0; i < track.entry; i++) {
+        int64_t sampleSize = track.cluster[i].size / track.cluster[i].entries;
+        if (previousSampleSize != -1 && sampleSize != previousSampleSize)
+            equalSampleSizes = false;
+        previousSampleSize = sampleSize;
+        samples += track.cluster[i].entries;
+    }
+
+    bool co64 = track.entry > 0 && track.cluster[track.entry - 1].pos + track.data_offset > UINT32_MAX;
+
+    sizes.stts = 8 + 4 + 4 + 8 * sttsEntries;
+    sizes.stsc = 8 + 4 + 4 + 12 * stscEntries;
+    sizes.stsz = 8 + 4 + 4 + 4 + (equalSampleSizes ? 0 : 4 * samples);
+    sizes.co64_or_stco = 8 + 4 + 4 + (co64 ? 8 : 4) * chunks;
+    return sizes;
+}
+
+int64_t MovieWriter::measureMoovSize()
+{
+    const MOVMuxContext *mov = reinterpret_cast<const MOVMuxContext *>(formatContext_->priv_data);
+
+    SampleTableSizes video = measureSampleTables(mov->tracks[videoStream_->index], false);
+    SampleTableSizes audio;
+    if (audioStream_)
+        audio = measureSampleTables(mov->tracks[audioStream_->index], true);
+
+    return moovSize(video, audio);
+}
+
+int64_t MovieWriter::moovSize(const SampleTableSizes& video, const SampleTableSizes& audio)
+{
+    // stsd
+    //   sample description
+    auto video_stsd = 8 + (8 + 4 + 2 + 2 + 2 + 2 + 4 + 4 + 4 + 2 + 2 + 4 + 4 + 4 + 2 + 1 + 31 + 2 + 2 + 8);
+    auto audio_stsd = 8 + 68;  // !!! from inspection above, needs verification, on cursory inspection is not varying size
 
     // stbl
     //   sample table. for looking up samples
-    auto video_stbl = 8 + video_stsd + video_stts + video_stsc + video_stsz + video_co64_or_stco; 
-    auto audio_stbl = 8 + audio_stsd + audio_stts + audio_stsc + audio_stsz + audio_co64_or_stco;
+    auto video_stbl = 8 + video_stsd + video.stts + video.stsc + video.stsz + video.co64_or_stco; 
+    auto audio_stbl = 8 + audio_stsd + audio.stts + audio.stsc + audio.stsz + audio.co64_or_stco;
 
     // minf
     auto vmhd = 20;
@@ -501,7 +1168,100 @@ int64_t MovieWriter::guessMoovSize()
 
     // moov
     auto mvhd = 120;
-    auto moov = 8 + mvhd + video_trak + ((audioStream_) ? audio_trak : 0) + udta;
+    auto moov = 8 + mvhd + video_trak + ((audio_) ? audio_trak : 0) + udta;
     
     return moov;
 }
+
+static uint64_t readBigEndian(const uint8_t *data, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value = (value << 8) | data[i];
+    return value;
+}
+
+static void writeBigEndian(uint8_t *data, int bytes, uint64_t value)
+{
+    for (int i = bytes - 1; i >= 0; --i, value >>= 8)
+        data[i] = (uint8_t)value;
+}
+
+// adds shift to the chunk offsets in the stco and co64 atoms found among size bytes of atoms, or with
+// apply false only checks it can. false if an atom is malformed or a 32 bit offset would overflow.
+static bool shiftChunkOffsets(uint8_t *atoms, int64_t size, int64_t shift, bool apply)
+{
+    int64_t offset = 0;
+    while (offset + 8 <= size) {
+        uint8_t *atom = atoms + offset;
+        int64_t atomSize = (int64_t)readBigEndian(atom, 4);
+        int64_t headerSize = 8;
+        if (atomSize == 1 && offset + 16 <= size) {
+            atomSize = (int64_t)readBigEndian(atom + 8, 8);
+            headerSize = 16;
+        }
+        else if (atomSize == 0) {
+            atomSize = size - offset;
+        }
+        if (atomSize < headerSize || atomSize > size - offset)
+            return false;
+
+        std::string type((const char *)atom + 4, 4);
+        uint8_t *body = atom + headerSize;
+        int64_t bodySize = atomSize - headerSize;
+        if (type == "moov" || type == "trak" || type == "mdia" || type == "minf" || type == "stbl") {
+            if (!shiftChunkOffsets(body, bodySize, shift, apply))
+                return false;
+        }
+        else if (type == "stco" || type == "co64") {
+            int entryBytes = (type == "co64") ? 8 : 4;
+            if (bodySize < 8)
+                return false;
+            int64_t entries = (int64_t)readBigEndian(body + 4, 4);
+            if (8 + entries * entryBytes > bodySize)
+                return false;
+            for (int64_t i = 0; i < entries; ++i) {
+                uint8_t *entry = body + 8 + i * entryBytes;
+                uint64_t chunkOffset = readBigEndian(entry, entryBytes) + (uint64_t)shift;
+                if (entryBytes == 4 && chunkOffset > UINT32_MAX)
+                    return false;
+                if (apply)
+                    writeBigEndian(entry, entryBytes, chunkOffset);
+            }
+        }
+        offset += atomSize;
+    }
+    return offset == size;
+}
+
+// the trailer has written the moov after the media, and captured_ holds it. Moves everything after
+// ftyp along by the size of the moov - with large sequential block moves, never the whole file in
+// memory - and writes the moov in the gap with its chunk offsets shifted to match. The file stays
+// the same size.
+void MovieWriter::moveMoovAheadOfMedia(int64_t moovPosition)
+{
+    const MOVMuxContext *mov = reinterpret_cast<const MOVMuxContext *>(formatContext_->priv_data);
+    std::vector<uint8_t> moov;
+    moov.swap(captured_);
+    int64_t moovSize = (int64_t)moov.size();
+
+    // ftyp is followed by the 'free' atom writeHeader left, if any, then the 'wide' atom ahead of mdat
+    int64_t mediaPosition = reservedMoovSize_ ? mov->reserved_header_pos : mov->mdat_pos - 8;
+
+    if (moovSize < 8 || moovPosition + moovSize != end_
+        || !shiftChunkOffsets(moov.data(), moovSize, moovSize, false))
+    {
+        FDN_WARNING("couldn't relocate the moov; leaving it after the media");
+        return;
+    }
+    shiftChunkOffsets(moov.data(), moovSize, moovSize, true);
+
+    FDN_INFO("moving ", moovPosition - mediaPosition, " bytes of media to put the moov ahead of it");
+    if (onMove_(mediaPosition, mediaPosition + moovSize, moovPosition - mediaPosition) < 0)
+        throw std::runtime_error("Error moving media to put the moov ahead of it");
+    mediaShift_ = moovSize;
+
+    if (onSeek_(mediaPosition, SEEK_SET) < 0 || onWrite_(moov.data(), (int)moovSize) != 0)
+        throw std::runtime_error("Error writing moov ahead of the media");
+    position_ = mediaPosition + moovSize;
+}
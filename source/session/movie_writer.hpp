@@ -3,7 +3,10 @@
 
 #include <array>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 extern"C"
 {
@@ -14,6 +17,9 @@ extern"C"
 
 // wrappers for libav-* objects
 #include "ffmpeg_helpers.hpp"
+#include "movie_index.hpp"
+#include "pcm_store.hpp"
+#include "quicktime_muxer.hpp"
 
 class MovieWriterInvalidData : public std::runtime_error
 {
@@ -25,7 +31,64 @@ public:
 
 Rational SimplifyAndSnapToMpegFrameRate(Rational rational);
 
-// ffmpeg libavformat-based file writing
+// output preallocation, from the "preallocate" section of config.json
+//   when enabled, createExporter has writeHeader reserve the predicted file size plus headroom so that
+//   the file is laid out contiguously and running out of space fails the export before the first frame
+struct PreallocationConfiguration
+{
+    bool enabled{ false };
+    double headroom{ 0.1 };   // fraction of the predicted size
+};
+
+PreallocationConfiguration preallocationConfiguration();
+
+// in-place faststart, from the "faststart" section of config.json
+//   when the moov ends up after the media, writeTrailer moves the media along and writes the moov in
+//   front of it, rather than leaving the host to copy the whole file. Needs a MovieFile with onMove.
+struct FaststartConfiguration
+{
+    bool enabled{ true };
+};
+
+FaststartConfiguration faststartConfiguration();
+
+// fragmented output, from the "fragment" section of config.json
+//   when enabled, the moov is written up front with no samples in it, followed by moof / mdat
+//   fragments of about "interval" seconds that each carry their own sample tables. There's no moov to
+//   size or move, the movie can be read while it is being written, and a crash leaves a movie that
+//   plays up to the last complete fragment.
+struct FragmentConfiguration
+{
+    bool enabled{ false };
+    double interval{ 1.0 };   // seconds
+};
+
+FragmentConfiguration fragmentConfiguration();
+
+// choice of muxer, from the "muxer" section of config.json
+//   "native" writes movies with QuickTimeMuxer instead of libavformat: frames go to the file as they
+//   are written, without the interleaver's copy and queue. Fragmented output always uses libavformat.
+//   "frameAlignment" pads the native muxer's video frames to start on multiples of that many bytes;
+//   see QuickTimeMuxer.
+struct MuxerConfiguration
+{
+    bool native{ false };
+    int64_t frameAlignment{ 0 };
+};
+
+MuxerConfiguration muxerConfiguration();
+
+// audio packetization, from the "audioChunk" section of config.json
+//   the exporter has MovieWriter write audio in chunks of exactly "frames" video frames' duration,
+//   whatever size of packet the host renders it in; see MovieWriter::preloadAudio
+struct AudioChunkConfiguration
+{
+    int frames{ 1 };
+};
+
+AudioChunkConfiguration audioChunkConfiguration();
+
+// QuickTime file writing, with ffmpeg libavformat or QuickTimeMuxer
 class MovieWriter
 {
 public:
@@ -33,52 +96,130 @@ public:
                 MovieFile file,
                 const VideoDef& video,
                 std::optional<AudioDef> audio,
-                bool writeMoovTagEarly
+                bool writeMoovTagEarly,
+                size_t avioBufferSize = 0,  // 0 sizes from the video and the "avio" configuration
+                double fragmentInterval = 0,// seconds per fragment; 0 writes a single moov
+                bool nativeMuxer = false,   // see MuxerConfiguration
+                int64_t frameAlignment = 0, // bytes; native muxer only
+                int framesPerAudioChunk = 0 // see preloadAudio; 0 if audio may be written with writeAudioFrame
     );
     ~MovieWriter();
 
     void writeVideoFrame(const uint8_t* data, size_t size);
     void writeAudioFrame(const uint8_t *data, size_t size, int64_t pts);
 
+    // as above, taking ownership of a reference to the data. The muxer queues the reference for
+    // interleaving instead of copying the frame, and releases it once the frame is written.
+    void writeVideoFrame(AVBufferRef *buffer);
+    void writeAudioFrame(AVBufferRef *buffer, int64_t pts);
+
+    // audio rendered ahead of the video, in packets covering every sample from pts 0. It's held in a
+    // PcmStore and written as chunks of exactly framesPerAudioChunk frames' duration, each following
+    // the last frame it covers, so the muxer neither queues it nor ends up with a chunk per packet.
+    // writeTrailer writes what's left, and throws if any of it never arrived.
+    //   thread-safe, so audio may be rendered on a thread of its own while the video is written.
+    //   Packets may arrive out of order; each is held until those before it arrive. A chunk whose
+    //   audio hasn't all arrived by its last frame follows a later frame.
+    void preloadAudio(const uint8_t *data, size_t size, int64_t pts);
+    void appendAudio(const uint8_t *data, size_t size);  // as above, following the audio preloaded so far
+
     void flush();        // internally frames are not written immediately but are queued
-    void writeHeader();
-    void writeTrailer();
+    void writeHeader(int64_t reserveFileSize = 0);    // bytes to preallocate, 0 for none; see PreallocationConfiguration
+    void writeTrailer();                              // truncates to the final size if space was reserved,
+                                                      // and moves the moov ahead of the media if it can.
+                                                      // Then writes the sidecar index, if the file has onWriteSidecar
 
     void close(); // can throw. Call ahead of destruction if onClose errors must be caught externally.
 
+    // sizes in bytes of the sample table atoms that grow with the samples written
+    struct SampleTableSizes
+    {
+        int64_t stts{ 0 };
+        int64_t stsc{ 0 };
+        int64_t stsz{ 0 };
+        int64_t co64_or_stco{ 0 };
+    };
+
 private:
     //void addVideoStream(VideoFormat videoFormat, int width, int height, int64_t frameRateNumerator, int64_t frameRateDenominator);
     void addAudioStream(const AudioDef& audio);
+    void writeVideoPacket(AVPacket& pkt);
+    void writeAudioPacket(AVPacket& pkt, int64_t pts);
+    void storeAudio(const uint8_t *data, size_t size, int64_t pts);  // with preloadedMutex_ held
+    int64_t audioSamplesBefore(int64_t frame) const;
+    void writePreloadedAudioThroughFrame();
+    bool writePreloadedAudio(int64_t through);   // preloaded samples before through, as one packet;
+                                                 // false if they haven't all arrived
     int64_t guessMoovSize();
+    int64_t measureMoovSize();  // exact, once every packet has reached the muxer
+    int64_t moovSize(const SampleTableSizes& video, const SampleTableSizes& audio);
+    void moveMoovAheadOfMedia(int64_t moovPosition);
+    void flushCompletedFragments();
+    void writeLibavTrailer();
+    void indexFrame(const uint8_t *data, size_t size);
+    void indexLibavSamples();
+    void writeSidecar();
 
     // need enough information to calculate space to reserve for moov atom
     VideoDef video_;
     int32_t reserveMetadataSpace_;    // space to reserve for XMP_ atom
+    std::optional<AudioDef> audio_;
 
     MovieWriteCallback onWrite_;
     MovieSeekCallback onSeek_;
     MovieCloseCallback onClose_;
+    MoviePreallocateCallback onPreallocate_;
+    MovieTruncateCallback onTruncate_;
+    MovieMoveCallback onMove_;
+    MovieSidecarWriteCallback onWriteSidecar_;
 
     bool writeMoovTagEarly_;
+    int64_t reservedMoovSize_{0};   // space left ahead of mdat for the moov, when written early
+    double fragmentInterval_;
+    int fragmentsFlushed_{0};
 
     // adapt writers that throw exceptions
     static int c_onWrite(void *context, uint8_t *data, int size);
     static int64_t c_onSeek(void *context, int64_t offset, int whence);
 
-    // we're forced to allocate a buffer for AVIO.
-    // TODO: get an no idea what an appropriate size is
-    // TODO: hook libav allocation system so it can use externally cached memory management
-    const size_t cAVIOBufferSize = 2 << 20;
+    // we're forced to allocate a buffer for AVIO; see avioBufferSize
+    // it is drawn from sessionBufferPool() and goes back to it when the io context is freed
+    size_t avioBufferSize_;
 
     //CodecContext videoCodecContext_;
     FormatContext formatContext_;
     IOContext ioContext_;
-    AVStream *videoStream_;
+    AVStream *videoStream_{nullptr};
     AVRational streamTimebase_;
     AVStream *audioStream_{nullptr};     // nullptr on audio not present
 
+    std::unique_ptr<QuickTimeMuxer> native_;  // in place of all of the above when set
+
     int64_t iFrame_{0};
 
+    // audio from preloadAudio, in samples from the start
+    std::mutex preloadedMutex_;     // for all but preloadedWritten_ and preloadedChunk_, which only writes touch
+    std::unique_ptr<PcmStore> preloaded_;
+    std::map<int64_t, std::vector<uint8_t>> preloadedAhead_;  // by pts, waiting for the audio before it
+    int64_t preloadedEnd_{0};
+    int64_t preloadedWritten_{0};
+    int64_t preloadedChunks_{0};    // chunks written
+    int framesPerAudioChunk_;
+    std::vector<uint8_t> preloadedChunk_;   // for the native muxer, which doesn't take references
+
+    // the extent of the file written, for truncating after preallocation
+    int64_t position_{0};
+    int64_t end_{0};
+    bool preallocated_{false};
+
+    // the moov as the trailer writes it after the media, so it can be moved ahead of the media
+    int64_t captureFrom_{-1};
+    std::vector<uint8_t> captured_;
+    int64_t mediaShift_{0};         // how far moveMoovAheadOfMedia moved the media
+
+    // the frames and audio as written, for the sidecar index; positions are filled in by the trailer
+    MovieIndex index_;
+
     bool closed_{false};
 };
 
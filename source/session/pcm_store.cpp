@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "config.hpp"
+#include "logging.hpp"
+#include "pcm_store.hpp"
+
+#ifdef WIN32
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+using json = nlohmann::json;
+
+void from_json(const json& j, PreloadedAudioConfiguration& c) {
+    j.at("memoryLimit").get_to(c.memoryLimit);
+}
+
+PreloadedAudioConfiguration preloadedAudioConfiguration()
+{
+    PreloadedAudioConfiguration config;
+    try {
+        fdn::config().at("preloadedAudio").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+// removed when closed
+static FILE *openTemporaryFile()
+{
+#ifdef WIN32
+    // tmpfile wants to create its file in the root of the drive, which needs elevation
+    wchar_t directory[MAX_PATH + 1];
+    wchar_t path[MAX_PATH + 1];
+    if (!GetTempPathW(MAX_PATH + 1, directory) || !GetTempFileNameW(directory, L"fdn", 0, path))
+        return nullptr;
+    return _wfopen(path, L"w+bTD");
+#else
+    return std::tmpfile();
+#endif
+}
+
+PcmStore::PcmStore(size_t memoryLimit)
+    : memoryLimit_(memoryLimit)
+{
+}
+
+PcmStore::~PcmStore()
+{
+    if (spill_)
+        fclose(spill_);
+}
+
+void PcmStore::append(const uint8_t *data, size_t size)
+{
+    // once anything has gone to the file, later data follows it there to keep the order
+    size_t held = memory_.size() - memoryRead_;
+    if (!spilled() && held + size <= memoryLimit_)
+    {
+        if (memoryRead_ > memory_.size() / 2)
+        {
+            memory_.erase(memory_.begin(), memory_.begin() + memoryRead_);
+            memoryRead_ = 0;
+        }
+        memory_.insert(memory_.end(), data, data + size);
+        return;
+    }
+
+    if (!spill_)
+    {
+        spill_ = openTemporaryFile();
+        if (!spill_)
+            throw std::runtime_error("couldn't create a temporary file for audio");
+        FDN_DEBUG("holding audio beyond ", memoryLimit_, " bytes in a temporary file");
+    }
+    if (!spilled())
+        spillWritten_ = spillRead_ = 0;
+
+    seekSpill(spillWritten_);
+    if (fwrite(data, 1, size, spill_) != size)
+        throw std::runtime_error("couldn't write audio to temporary file");
+    spillWritten_ += (int64_t)size;
+}
+
+void PcmStore::read(uint8_t *into, size_t size)
+{
+    if ((int64_t)size > this->size())
+        throw std::runtime_error("reading more audio than is held");
+
+    size_t fromMemory = std::min(size, memory_.size() - memoryRead_);
+    std::memcpy(into, memory_.data() + memoryRead_, fromMemory);
+    memoryRead_ += fromMemory;
+    if (memoryRead_ == memory_.size())
+    {
+        memory_.clear();
+        memoryRead_ = 0;
+    }
+
+    size_t fromSpill = size - fromMemory;
+    if (fromSpill)
+    {
+        seekSpill(spillRead_);
+        if (fread(into + fromMemory, 1, fromSpill, spill_) != fromSpill)
+            throw std::runtime_error("couldn't read audio from temporary file");
+        spillRead_ += (int64_t)fromSpill;
+    }
+}
+
+int64_t PcmStore::size() const
+{
+    return (int64_t)(memory_.size() - memoryRead_) + (spillWritten_ - spillRead_);
+}
+
+// reads and writes alternate, and stdio needs a seek between them
+void PcmStore::seekSpill(int64_t position)
+{
+#ifdef WIN32
+    auto result = _fseeki64(spill_, position, SEEK_SET);
+#else
+    auto result = fseek(spill_, position, SEEK_SET);
+#endif
+    if (result != 0)
+        throw std::runtime_error("couldn't seek in audio temporary file");
+}
@@ -0,0 +1,50 @@
+#ifndef PCM_STORE_HPP
+#define PCM_STORE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// audio rendered ahead of the video, from the "preloadedAudio" section of config.json
+//   MovieWriter holds it in a PcmStore until the video frames it belongs with are written. Up to
+//   "memoryLimit" bytes are kept in memory; the rest waits in a temporary file.
+struct PreloadedAudioConfiguration
+{
+    int64_t memoryLimit{ 64 << 20 };  // bytes
+};
+
+PreloadedAudioConfiguration preloadedAudioConfiguration();
+
+// first in, first out store of raw PCM
+//   appends go to memory until memoryLimit bytes are held there, then to a temporary file, so that
+//   an hour of audio doesn't cost an hour of audio in memory. Reads take the oldest data first,
+//   wherever it is.
+class PcmStore
+{
+public:
+    explicit PcmStore(size_t memoryLimit);
+    ~PcmStore();
+
+    void append(const uint8_t *data, size_t size);
+    void read(uint8_t *into, size_t size);  // throws if fewer than size bytes are held
+
+    int64_t size() const;  // bytes held
+    bool spilled() const { return spillWritten_ > spillRead_; }
+
+    // noncopyable
+    PcmStore(const PcmStore&) = delete;
+    PcmStore& operator=(const PcmStore&) = delete;
+
+private:
+    void seekSpill(int64_t position);
+
+    size_t memoryLimit_;
+    std::vector<uint8_t> memory_;
+    size_t memoryRead_{ 0 };
+
+    FILE *spill_{ nullptr };   // created on first use
+    int64_t spillWritten_{ 0 };
+    int64_t spillRead_{ 0 };
+};
+
+#endif
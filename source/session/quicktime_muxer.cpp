@@ -0,0 +1,516 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+#include "quicktime_muxer.hpp"
+
+namespace {
+
+const int64_t MovieTimescale = 1000;
+
+// big endian atoms, sized when they're ended
+class AtomBuffer
+{
+public:
+    void u8(uint8_t value) { data_.push_back(value); }
+    void u16(uint16_t value) { u8((uint8_t)(value >> 8)); u8((uint8_t)value); }
+    void u32(uint32_t value) { u16((uint16_t)(value >> 16)); u16((uint16_t)value); }
+    void u64(uint64_t value) { u32((uint32_t)(value >> 32)); u32((uint32_t)value); }
+    void fourcc(const char *type) { data_.insert(data_.end(), type, type + 4); }
+    void zeros(size_t count) { data_.insert(data_.end(), count, 0); }
+
+    // a length-prefixed string, padded to fieldSize if set
+    void pascal(const std::string& text, size_t fieldSize = 0)
+    {
+        size_t length = std::min(text.size(), fieldSize ? fieldSize - 1 : (size_t)255);
+        u8((uint8_t)length);
+        data_.insert(data_.end(), text.begin(), text.begin() + length);
+        if (fieldSize)
+            zeros(fieldSize - 1 - length);
+    }
+
+    size_t begin(const char *type)
+    {
+        size_t start = data_.size();
+        u32(0);
+        fourcc(type);
+        return start;
+    }
+
+    size_t beginFull(const char *type, uint8_t version, uint32_t flags)
+    {
+        size_t start = begin(type);
+        u32(((uint32_t)version << 24) | flags);
+        return start;
+    }
+
+    void end(size_t start)
+    {
+        uint32_t size = (uint32_t)(data_.size() - start);
+        for (int i = 0; i < 4; ++i)
+            data_[start + i] = (uint8_t)(size >> (24 - 8 * i));
+    }
+
+    void matrix()
+    {
+        const uint32_t unity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+        for (uint32_t value : unity)
+            u32(value);
+    }
+
+    std::vector<uint8_t>& data() { return data_; }
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+int64_t rescale(int64_t value, int64_t to, int64_t from)
+{
+    return (value / from) * to + ((value % from) * to + from / 2) / from;
+}
+
+}
+
+QuickTimeMuxer::QuickTimeMuxer(const VideoDef& video, std::optional<AudioDef> audio, Write write, Seek seek,
+                               int64_t frameAlignment)
+    : video_(video), audio_(audio), write_(write), seek_(seek), frameAlignment_(frameAlignment)
+{
+    if (frameAlignment_ < 0 || frameAlignment_ > UINT32_MAX)
+        throw std::runtime_error("invalid frame alignment");
+
+    int64_t gcd = std::gcd(video.frameRate.numerator, video.frameRate.denominator);
+    videoTimescale_ = video.frameRate.numerator / gcd;
+    frameDuration_ = video.frameRate.denominator / gcd;
+    // as movenc, so that hosts can place edits at finer than frame resolution
+    while (videoTimescale_ < 10000) {
+        videoTimescale_ *= 2;
+        frameDuration_ *= 2;
+    }
+}
+
+void QuickTimeMuxer::writeHeader(int64_t reserveMoovSize, int32_t metadataSpace)
+{
+    metadataSpace_ = metadataSpace;
+
+    AtomBuffer header;
+    size_t ftyp = header.begin("ftyp");
+    header.fourcc("qt  ");
+    header.u32(0x20050300);
+    header.fourcc("qt  ");
+    header.end(ftyp);
+
+    reservedPosition_ = (int64_t)header.data().size();
+    if (reserveMoovSize > 0) {
+        reservedSize_ = std::max(reserveMoovSize, (int64_t)8);
+        header.u32((uint32_t)reservedSize_);
+        header.fourcc("free");
+        write_(header.data().data(), header.data().size());
+        header.data().clear();
+        seek_(reservedPosition_ + reservedSize_);
+    }
+
+    // the 'wide' atom makes room for a 64 bit mdat size; a zero mdat size runs to the end of the file
+    // until writeTrailer sets it
+    mediaPosition_ = reservedPosition_ + reservedSize_;
+    header.u32(8);
+    header.fourcc("wide");
+    header.u32(0);
+    header.fourcc("mdat");
+    write_(header.data().data(), header.data().size());
+    position_ = mediaPosition_ + 16;
+}
+
+void QuickTimeMuxer::writeVideoFrame(const uint8_t *data, size_t size)
+{
+    if (frameAlignment_ > 1 && position_ % frameAlignment_)
+        pad(frameAlignment_ - position_ % frameAlignment_);
+    writeChunk(videoTrack_, data, size, 1);
+    frameSizes_.push_back((uint32_t)size);
+}
+
+void QuickTimeMuxer::writeAudioFrame(const uint8_t *data, size_t size)
+{
+    if (!audio_)
+        throw std::runtime_error("movie has no audio track");
+    size_t bytesPerFrame = (size_t)audio_->bytesPerSample * audio_->numChannels;
+    if (size % bytesPerFrame)
+        throw std::runtime_error("audio is not a whole number of samples");
+    writeChunk(audioTrack_, data, size, (uint32_t)(size / bytesPerFrame));
+}
+
+void QuickTimeMuxer::writeChunk(Track& track, const uint8_t *data, size_t size, uint32_t samples)
+{
+    write_(data, size);
+
+    if (lastTrack_ == &track && !track.chunks.empty())
+        track.chunks.back().samples += samples;
+    else
+        track.chunks.push_back(Chunk{ position_, samples });
+    track.samples += samples;
+    position_ += size;
+    lastTrack_ = &track;
+}
+
+// zeros in the mdat that no chunk refers to; what follows starts a new chunk
+void QuickTimeMuxer::pad(int64_t size)
+{
+    static const std::vector<uint8_t> zeros(64 << 10, 0);
+    for (int64_t remaining = size; remaining > 0; remaining -= (int64_t)zeros.size())
+        write_(zeros.data(), (size_t)std::min(remaining, (int64_t)zeros.size()));
+    position_ += size;
+    lastTrack_ = nullptr;
+}
+
+void QuickTimeMuxer::writeTrailer(Move move)
+{
+    int64_t end = position_;
+
+    AtomBuffer mdat;
+    int64_t mdatSize = end - (mediaPosition_ + 8);
+    if (mdatSize <= UINT32_MAX) {
+        seek_(mediaPosition_ + 8);
+        mdat.u32((uint32_t)mdatSize);
+        mdat.fourcc("mdat");
+    }
+    else {
+        // over the 'wide' atom
+        seek_(mediaPosition_);
+        mdat.u32(1);
+        mdat.fourcc("mdat");
+        mdat.u64((uint64_t)(end - mediaPosition_));
+    }
+    write_(mdat.data().data(), mdat.data().size());
+
+    // the space between ftyp and the media must be exactly filled by the moov, or leave room for a
+    // 'free' atom after it. Aligned frames must stay aligned, so then the media moves by whole alignments.
+    auto shiftFor = [&](int64_t moovSize) -> int64_t {
+        if (reservedSize_ == moovSize || reservedSize_ >= moovSize + 8)
+            return 0;
+        if (frameAlignment_ > 1) {
+            int64_t shift = (moovSize - reservedSize_ + frameAlignment_ - 1) / frameAlignment_ * frameAlignment_;
+            if (reservedSize_ + shift != moovSize && reservedSize_ + shift < moovSize + 8)
+                shift += frameAlignment_;
+            return shift;
+        }
+        if (reservedSize_ < moovSize)
+            return moovSize - reservedSize_;
+        return moovSize + 8 - reservedSize_;
+    };
+
+    std::vector<uint8_t> moov = buildMoov(0);
+    int64_t shift = shiftFor((int64_t)moov.size());
+    if (shift && !move) {
+        // after the media, leaving any reserved space as a 'free' atom
+        seek_(end);
+        write_(moov.data(), moov.size());
+        return;
+    }
+
+    if (shift) {
+        // moving the media changes the chunk offsets, which may change the size of the moov
+        for (int64_t needed = shift; ; shift = needed) {
+            moov = buildMoov(shift);
+            needed = shiftFor((int64_t)moov.size());
+            if (needed <= shift)
+                break;
+        }
+        move(mediaPosition_, mediaPosition_ + shift, end - mediaPosition_);
+        mediaShift_ = shift;
+    }
+
+    seek_(reservedPosition_);
+    write_(moov.data(), moov.size());
+    int64_t gap = reservedSize_ + shift - (int64_t)moov.size();
+    if (gap) {
+        AtomBuffer free;
+        free.u32((uint32_t)gap);
+        free.fourcc("free");
+        write_(free.data().data(), free.data().size());
+    }
+}
+
+int64_t QuickTimeMuxer::moovSize(int64_t mediaShift) const
+{
+    return (int64_t)buildMoov(mediaShift).size();
+}
+
+std::vector<int64_t> QuickTimeMuxer::videoFramePositions() const
+{
+    std::vector<int64_t> positions;
+    positions.reserve(frameSizes_.size());
+    size_t frame = 0;
+    for (const Chunk& chunk : videoTrack_.chunks) {
+        int64_t position = chunk.position + mediaShift_;
+        for (uint32_t i = 0; i < chunk.samples; ++i) {
+            positions.push_back(position);
+            position += frameSizes_[frame++];
+        }
+    }
+    return positions;
+}
+
+std::vector<std::pair<int64_t, int64_t>> QuickTimeMuxer::audioChunks() const
+{
+    std::vector<std::pair<int64_t, int64_t>> chunks;
+    chunks.reserve(audioTrack_.chunks.size());
+    for (const Chunk& chunk : audioTrack_.chunks)
+        chunks.emplace_back(chunk.position + mediaShift_, chunk.samples);
+    return chunks;
+}
+
+std::vector<uint8_t> QuickTimeMuxer::buildMoov(int64_t mediaShift) const
+{
+    AtomBuffer moov;
+
+    int64_t videoDuration = (int64_t)frameSizes_.size() * frameDuration_;
+    int64_t audioDuration = audioTrack_.samples;
+    int64_t movieDuration = rescale(videoDuration, MovieTimescale, videoTimescale_);
+    if (audio_)
+        movieDuration = std::max(movieDuration, rescale(audioDuration, MovieTimescale, audio_->sampleRate));
+    bool longMovie = movieDuration > UINT32_MAX;
+
+    size_t moovStart = moov.begin("moov");
+
+    size_t mvhd = moov.beginFull("mvhd", longMovie ? 1 : 0, 0);
+    if (longMovie) {
+        moov.u64(0);  // creation time
+        moov.u64(0);  // modification time
+        moov.u32((uint32_t)MovieTimescale);
+        moov.u64((uint64_t)movieDuration);
+    }
+    else {
+        moov.u32(0);
+        moov.u32(0);
+        moov.u32((uint32_t)MovieTimescale);
+        moov.u32((uint32_t)movieDuration);
+    }
+    moov.u32(0x00010000);   // rate
+    moov.u16(0x0100);       // volume
+    moov.zeros(10);
+    moov.matrix();
+    moov.zeros(24);         // preview, poster, selection and current times
+    moov.u32(audio_ ? 3 : 2);  // next track id
+    moov.end(mvhd);
+
+    auto writeTrack = [&](uint32_t trackId, const Track& track, int64_t mediaDuration, int64_t timescale, bool isVideo) {
+        int64_t trackDuration = rescale(mediaDuration, MovieTimescale, timescale);
+        size_t trak = moov.begin("trak");
+
+        bool longTrack = trackDuration > UINT32_MAX;
+        size_t tkhd = moov.beginFull("tkhd", longTrack ? 1 : 0, 0x0f);  // enabled, in movie, preview and poster
+        if (longTrack) {
+            moov.u64(0);
+            moov.u64(0);
+            moov.u32(trackId);
+            moov.u32(0);
+            moov.u64((uint64_t)trackDuration);
+        }
+        else {
+            moov.u32(0);
+            moov.u32(0);
+            moov.u32(trackId);
+            moov.u32(0);
+            moov.u32((uint32_t)trackDuration);
+        }
+        moov.zeros(8);
+        moov.u16(0);                        // layer
+        moov.u16(0);                        // alternate group
+        moov.u16(isVideo ? 0 : 0x0100);     // volume
+        moov.u16(0);
+        moov.matrix();
+        moov.u32(isVideo ? (uint32_t)video_.width << 16 : 0);
+        moov.u32(isVideo ? (uint32_t)video_.height << 16 : 0);
+        moov.end(tkhd);
+
+        size_t mdia = moov.begin("mdia");
+
+        bool longMedia = mediaDuration > UINT32_MAX;
+        size_t mdhd = moov.beginFull("mdhd", longMedia ? 1 : 0, 0);
+        if (longMedia) {
+            moov.u64(0);
+            moov.u64(0);
+            moov.u32((uint32_t)timescale);
+            moov.u64((uint64_t)mediaDuration);
+        }
+        else {
+            moov.u32(0);
+            moov.u32(0);
+            moov.u32((uint32_t)timescale);
+            moov.u32((uint32_t)mediaDuration);
+        }
+        moov.u16(0);    // language
+        moov.u16(0);    // quality
+        moov.end(mdhd);
+
+        size_t hdlr = moov.beginFull("hdlr", 0, 0);
+        moov.fourcc("mhlr");
+        moov.fourcc(isVideo ? "vide" : "soun");
+        moov.zeros(12);
+        moov.pascal(isVideo ? "VideoHandler" : "SoundHandler");
+        moov.end(hdlr);
+
+        size_t minf = moov.begin("minf");
+        if (isVideo) {
+            size_t vmhd = moov.beginFull("vmhd", 0, 1);
+            moov.u16(0x40);     // graphics mode: dither copy
+            moov.u16(0x8000);
+            moov.u16(0x8000);
+            moov.u16(0x8000);
+            moov.end(vmhd);
+        }
+        else {
+            size_t smhd = moov.beginFull("smhd", 0, 0);
+            moov.u16(0);        // balance
+            moov.u16(0);
+            moov.end(smhd);
+        }
+
+        size_t dataHandler = moov.beginFull("hdlr", 0, 0);
+        moov.fourcc("dhlr");
+        moov.fourcc("alis");
+        moov.zeros(12);
+        moov.pascal("DataHandler");
+        moov.end(dataHandler);
+
+        size_t dinf = moov.begin("dinf");
+        size_t dref = moov.beginFull("dref", 0, 0);
+        moov.u32(1);
+        size_t alis = moov.beginFull("alis", 0, 1);  // in this file
+        moov.end(alis);
+        moov.end(dref);
+        moov.end(dinf);
+
+        size_t stbl = moov.begin("stbl");
+
+        size_t stsd = moov.beginFull("stsd", 0, 0);
+        moov.u32(1);
+        if (isVideo) {
+            size_t entry = moov.begin(video_.format.data());
+            moov.zeros(6);
+            moov.u16(1);            // data reference
+            moov.u16(0);            // version
+            moov.u16(0);            // revision
+            moov.zeros(4);          // vendor
+            moov.u32(0);            // temporal quality
+            moov.u32(0x400);        // spatial quality: normal
+            moov.u16((uint16_t)video_.width);
+            moov.u16((uint16_t)video_.height);
+            moov.u32(0x00480000);   // 72dpi
+            moov.u32(0x00480000);
+            moov.u32(0);            // data size
+            moov.u16(1);            // frames per sample
+            moov.pascal(video_.encoderName, 32);
+            moov.u16((uint16_t)video_.encodedBitDepth);
+            moov.u16(0xffff);       // no color table
+            moov.end(entry);
+        }
+        else {
+            // version 2 'lpcm', which describes every integer layout we write
+            size_t entry = moov.begin("lpcm");
+            moov.zeros(6);
+            moov.u16(1);            // data reference
+            moov.u16(2);            // version
+            moov.u16(0);            // revision
+            moov.zeros(4);          // vendor
+            moov.u16(3);
+            moov.u16(16);
+            moov.u16(0xfffe);
+            moov.u16(0);
+            moov.u32(0x00010000);
+            moov.u32(72);           // size of this structure
+            double sampleRate = (double)audio_->sampleRate;
+            uint64_t sampleRateBits;
+            std::memcpy(&sampleRateBits, &sampleRate, sizeof(sampleRateBits));
+            moov.u64(sampleRateBits);
+            moov.u32((uint32_t)audio_->numChannels);
+            moov.u32(0x7f000000);
+            moov.u32((uint32_t)audio_->bytesPerSample * 8);
+            // packed little endian; signed unless unsigned PCM
+            moov.u32(0x08 | ((audio_->encoding == AudioEncoding_Signed_PCM) ? 0x04 : 0));
+            moov.u32((uint32_t)(audio_->bytesPerSample * audio_->numChannels));
+            moov.u32(1);            // samples per packet
+            moov.end(entry);
+        }
+        moov.end(stsd);
+
+        size_t stts = moov.beginFull("stts", 0, 0);
+        moov.u32(track.samples ? 1 : 0);
+        if (track.samples) {
+            moov.u32((uint32_t)track.samples);
+            moov.u32(isVideo ? (uint32_t)frameDuration_ : 1);
+        }
+        moov.end(stts);
+
+        size_t stsc = moov.beginFull("stsc", 0, 0);
+        size_t stscCount = moov.data().size();
+        moov.u32(0);
+        uint32_t entries = 0;
+        for (size_t i = 0; i < track.chunks.size(); ++i) {
+            if (i == 0 || track.chunks[i].samples != track.chunks[i - 1].samples) {
+                moov.u32((uint32_t)i + 1);
+                moov.u32(track.chunks[i].samples);
+                moov.u32(1);        // sample description
+                ++entries;
+            }
+        }
+        for (int i = 0; i < 4; ++i)
+            moov.data()[stscCount + i] = (uint8_t)(entries >> (24 - 8 * i));
+        moov.end(stsc);
+
+        size_t stsz = moov.beginFull("stsz", 0, 0);
+        if (isVideo) {
+            bool uniform = !frameSizes_.empty()
+                && std::all_of(frameSizes_.begin(), frameSizes_.end(), [&](uint32_t size) { return size == frameSizes_.front(); });
+            moov.u32(uniform ? frameSizes_.front() : 0);
+            moov.u32((uint32_t)frameSizes_.size());
+            if (!uniform)
+                for (uint32_t size : frameSizes_)
+                    moov.u32(size);
+        }
+        else {
+            moov.u32((uint32_t)(audio_->bytesPerSample * audio_->numChannels));
+            moov.u32((uint32_t)track.samples);
+        }
+        moov.end(stsz);
+
+        bool co64 = !track.chunks.empty() && track.chunks.back().position + mediaShift > UINT32_MAX;
+        size_t stco = moov.beginFull(co64 ? "co64" : "stco", 0, 0);
+        moov.u32((uint32_t)track.chunks.size());
+        for (const Chunk& chunk : track.chunks) {
+            if (co64)
+                moov.u64((uint64_t)(chunk.position + mediaShift));
+            else
+                moov.u32((uint32_t)(chunk.position + mediaShift));
+        }
+        moov.end(stco);
+
+        moov.end(stbl);
+        moov.end(minf);
+        moov.end(mdia);
+        moov.end(trak);
+    };
+
+    writeTrack(1, videoTrack_, videoDuration, videoTimescale_, true);
+    if (audio_)
+        writeTrack(2, audioTrack_, audioDuration, audio_->sampleRate, false);
+
+    if (metadataSpace_ > 0 || frameAlignment_ > 1) {
+        size_t udta = moov.begin("udta");
+        if (frameAlignment_ > 1) {
+            size_t algn = moov.beginFull("algn", 0, 0);
+            moov.u32((uint32_t)frameAlignment_);
+            moov.end(algn);
+        }
+        if (metadataSpace_ > 0) {
+            size_t xmp = moov.begin("XMP_");
+            moov.data().insert(moov.data().end(), (size_t)metadataSpace_, ' ');
+            moov.end(xmp);
+        }
+        moov.end(udta);
+    }
+
+    moov.end(moovStart);
+    return std::move(moov.data());
+}
@@ -0,0 +1,87 @@
+#ifndef QUICKTIME_MUXER_HPP
+#define QUICKTIME_MUXER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "ffmpeg_helpers.hpp"
+
+// a QuickTime muxer for what we export: one all-intra video track at a fixed frame rate, and
+//   optionally one PCM track
+//   Samples are written to the mdat in the order they arrive, straight from the caller's buffer, with
+//   no queueing or copying. The sample tables are kept as compact arrays - a size per frame and a
+//   position and sample count per chunk, where consecutive samples of a track share a chunk - and the
+//   moov is built once, by writeTrailer.
+//   With a frameAlignment, each video frame is padded to start at a multiple of that many bytes in the
+//   file, for players that read frames unbuffered. The padding sits in the mdat between chunks, where
+//   no sample table refers to it, and the alignment is recorded in the moov's user data as 'algn'.
+class QuickTimeMuxer
+{
+public:
+    typedef std::function<void (const uint8_t *data, size_t size)> Write;                   // throws on failure
+    typedef std::function<void (int64_t position)> Seek;                                   // throws on failure
+    typedef std::function<void (int64_t source, int64_t destination, int64_t size)> Move;  // throws on failure
+
+    QuickTimeMuxer(const VideoDef& video, std::optional<AudioDef> audio, Write write, Seek seek,
+                   int64_t frameAlignment = 0);
+
+    // reserveMoovSize bytes are left ahead of the media for the moov, as a 'free' atom until it is
+    // written; metadataSpace bytes are left in the moov for Adobe's XMP
+    void writeHeader(int64_t reserveMoovSize, int32_t metadataSpace);
+    void writeVideoFrame(const uint8_t *data, size_t size);
+    void writeAudioFrame(const uint8_t *data, size_t size);  // whole multichannel samples, in order
+
+    // the moov goes in the reserved space if it fits. If it doesn't and move is set, the media is moved
+    // along to make room for the moov ahead of it; otherwise the moov goes after the media.
+    void writeTrailer(Move move);
+
+    // of the moov for what has been written so far, with the media mediaShift bytes later
+    int64_t moovSize(int64_t mediaShift = 0) const;
+
+    // where the samples are in the file, once writeTrailer has placed the moov
+    std::vector<int64_t> videoFramePositions() const;
+    std::vector<std::pair<int64_t, int64_t>> audioChunks() const;  // position and number of samples
+
+private:
+    struct Chunk
+    {
+        int64_t position;
+        uint32_t samples;
+    };
+
+    struct Track
+    {
+        std::vector<Chunk> chunks;
+        int64_t samples{ 0 };
+    };
+
+    void writeChunk(Track& track, const uint8_t *data, size_t size, uint32_t samples);
+    void pad(int64_t size);
+    std::vector<uint8_t> buildMoov(int64_t mediaShift) const;
+
+    VideoDef video_;
+    std::optional<AudioDef> audio_;
+    Write write_;
+    Seek seek_;
+
+    int64_t videoTimescale_;
+    int64_t frameDuration_;
+    int32_t metadataSpace_{ 0 };
+    int64_t frameAlignment_;
+
+    int64_t reservedPosition_{ 0 };
+    int64_t reservedSize_{ 0 };
+    int64_t mediaPosition_{ 0 };   // of the 'wide' atom ahead of mdat
+    int64_t position_{ 0 };        // the end of the media written so far
+    int64_t mediaShift_{ 0 };      // how far writeTrailer moved the media
+
+    Track videoTrack_;
+    Track audioTrack_;
+    std::vector<uint32_t> frameSizes_;
+    const Track *lastTrack_{ nullptr };   // of the chunk ending at position_
+};
+
+#endif
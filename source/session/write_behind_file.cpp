@@ -0,0 +1,303 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+#include "logging.hpp"
+#include "write_behind_file.hpp"
+
+using json = nlohmann::json;
+
+void from_json(const json& j, WriteBehindConfiguration& c) {
+    j.at("enabled").get_to(c.enabled);
+    j.at("bufferSize").get_to(c.bufferSize);
+    j.at("buffers").get_to(c.buffers);
+}
+
+WriteBehindConfiguration writeBehindConfiguration()
+{
+    WriteBehindConfiguration config;
+    try {
+        fdn::config().at("writeBehind").get_to(config);
+    }
+    catch (...)
+    {
+    }
+    return config;
+}
+
+namespace {
+
+// aligned so the underlying file can write whole pages
+class AlignedBuffer
+{
+public:
+    static const size_t Alignment = 4096;
+
+    AlignedBuffer(size_t size)
+        : storage_(new uint8_t[size + Alignment]), size_(size)
+    {
+        void *aligned = storage_.get();
+        size_t space = size + Alignment;
+        data_ = (uint8_t *)std::align(Alignment, size, aligned, space);
+    }
+
+    uint8_t *data() { return data_; }
+    size_t capacity() const { return size_; }
+
+private:
+    std::unique_ptr<uint8_t[]> storage_;
+    uint8_t *data_;
+    size_t size_;
+};
+
+class WriteBehindFile
+{
+public:
+    WriteBehindFile(MovieFile file, const WriteBehindConfiguration& configuration)
+        : file_(std::move(file))
+    {
+        for (int i = 0; i < std::max(2, configuration.buffers); ++i)
+            buffers_.push_back(std::make_unique<AlignedBuffer>((size_t)configuration.bufferSize));
+        for (auto& buffer : buffers_)
+            free_.push_back(buffer.get());
+    }
+
+    ~WriteBehindFile()
+    {
+        stop();
+    }
+
+    void open()
+    {
+        file_.onOpenForWrite();
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    int write(const uint8_t *data, size_t size)
+    {
+        if (failed())
+            return -1;
+
+        while (size) {
+            if (!filling_) {
+                filling_ = acquire();
+                filled_ = 0;
+            }
+            size_t n = std::min(size, filling_->capacity() - filled_);
+            std::memcpy(filling_->data() + filled_, data, n);
+            filled_ += n;
+            data += n;
+            size -= n;
+            if (filled_ == filling_->capacity())
+                submitFilling();
+        }
+        return 0;
+    }
+
+    int seek(int64_t offset, int whence)
+    {
+        if (failed())
+            return -1;
+
+        submitFilling();
+        push(Operation{ Operation::Seek, nullptr, 0, offset, whence, 0 });
+        return 0;
+    }
+
+    // queued behind the writes it must follow
+    int truncate(int64_t size)
+    {
+        if (failed())
+            return -1;
+
+        submitFilling();
+        push(Operation{ Operation::Truncate, nullptr, 0, size, 0, 0 });
+        return 0;
+    }
+
+    int move(int64_t source, int64_t destination, int64_t size)
+    {
+        if (failed())
+            return -1;
+
+        submitFilling();
+        push(Operation{ Operation::Move, nullptr, (size_t)size, source, 0, destination });
+        return 0;
+    }
+
+    int close()
+    {
+        stop();
+        int closeResult = file_.onClose();
+        return failed() ? -1 : closeResult;
+    }
+
+private:
+    struct Operation
+    {
+        enum Type { Write, Seek, Truncate, Move, Stop } type;
+        AlignedBuffer *buffer;
+        size_t size;
+        int64_t offset;
+        int whence;
+        int64_t destination;  // of a move from offset
+    };
+
+    static const char *operationName(Operation::Type type)
+    {
+        switch (type) {
+        case Operation::Write: return "write";
+        case Operation::Seek: return "seek";
+        case Operation::Truncate: return "truncate";
+        case Operation::Move: return "move";
+        default: return "stop";
+        }
+    }
+
+    bool failed()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        return failed_;
+    }
+
+    AlignedBuffer *acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        freed_.wait(lock, [&]() { return !free_.empty(); });
+        AlignedBuffer *buffer = free_.back();
+        free_.pop_back();
+        return buffer;
+    }
+
+    void submitFilling()
+    {
+        if (!filling_)
+            return;
+        push(Operation{ Operation::Write, filling_, filled_, 0, 0, 0 });
+        filling_ = nullptr;
+        filled_ = 0;
+    }
+
+    void push(Operation operation)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            queue_.push_back(operation);
+        }
+        queued_.notify_one();
+    }
+
+    void stop()
+    {
+        if (!thread_.joinable())
+            return;
+        submitFilling();
+        push(Operation{ Operation::Stop, nullptr, 0, 0, 0, 0 });
+        thread_.join();
+    }
+
+    void run()
+    {
+        FDN_DEBUG("write-behind thread started");
+        for (;;) {
+            Operation operation;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                queued_.wait(lock, [&]() { return !queue_.empty(); });
+                operation = queue_.front();
+                queue_.pop_front();
+            }
+
+            if (operation.type == Operation::Stop)
+                break;
+
+            // once failed, drain the queue without touching the file
+            bool ok = !failed();
+            try {
+                if (ok && operation.type == Operation::Write)
+                    ok = (file_.onWrite(operation.buffer->data(), (int)operation.size) == 0);
+                else if (ok && operation.type == Operation::Seek)
+                    ok = (file_.onSeek(operation.offset, operation.whence) >= 0);
+                else if (ok && operation.type == Operation::Truncate)
+                    ok = (file_.onTruncate(operation.offset) >= 0);
+                else if (ok && operation.type == Operation::Move)
+                    ok = (file_.onMove(operation.offset, operation.destination, (int64_t)operation.size) >= 0);
+            }
+            catch (const std::exception& ex) {
+                FDN_ERROR(ex.what());
+                ok = false;
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                if (!ok && !failed_) {
+                    FDN_ERROR("write-behind ", operationName(operation.type), " failed");
+                    failed_ = true;
+                }
+                if (operation.buffer)
+                    free_.push_back(operation.buffer);
+            }
+            freed_.notify_one();
+        }
+        FDN_DEBUG("write-behind thread finished");
+    }
+
+    MovieFile file_;
+
+    std::vector<std::unique_ptr<AlignedBuffer>> buffers_;
+
+    // producer side; only touched by the thread calling write / seek / close
+    AlignedBuffer *filling_{ nullptr };
+    size_t filled_{ 0 };
+
+    std::mutex mutex_;
+    std::condition_variable queued_;
+    std::condition_variable freed_;
+    std::deque<Operation> queue_;
+    std::vector<AlignedBuffer *> free_;
+    bool failed_{ false };
+
+    std::thread thread_;
+};
+
+}
+
+MovieFile createWriteBehindMovieFile(MovieFile file, const WriteBehindConfiguration& configuration)
+{
+    auto writeBehind = std::make_shared<WriteBehindFile>(file, configuration);
+
+    MovieFile wrapper(file);
+    wrapper.onOpenForWrite = [=]() {
+        FDN_INFO("writing behind with ", configuration.buffers, " buffers of ", configuration.bufferSize, " bytes");
+        writeBehind->open();
+    };
+    wrapper.onWrite = [=](const uint8_t* buffer, size_t size) {
+        return writeBehind->write(buffer, size);
+    };
+    wrapper.onSeek = [=](int64_t offset, int whence) {
+        return writeBehind->seek(offset, whence);
+    };
+    wrapper.onClose = [=]() {
+        return writeBehind->close();
+    };
+    // preallocation passes straight through, in the copy of file, so running out of space is reported
+    // immediately. Truncates and moves act on bytes already written, so are queued behind the writes
+    if (file.onTruncate) {
+        wrapper.onTruncate = [=](int64_t size) {
+            return writeBehind->truncate(size);
+        };
+    }
+    if (file.onMove) {
+        wrapper.onMove = [=](int64_t source, int64_t destination, int64_t size) {
+            return writeBehind->move(source, destination, size);
+        };
+    }
+
+    return wrapper;
+}
@@ -0,0 +1,24 @@
+#ifndef WRITE_BEHIND_FILE_HPP
+#define WRITE_BEHIND_FILE_HPP
+
+#include "ffmpeg_helpers.hpp"
+
+// write-behind for MovieFiles
+//   writes are copied into a ring of large buffers that a dedicated io thread writes out, so muxing
+//   continues while the disk (or network share) catches up. Seeks are queued behind the writes that
+//   precede them, so header and moov patch-ups land where they should.
+//   Errors from the io thread are reported by the next write, seek or close.
+
+struct WriteBehindConfiguration
+{
+    bool enabled{ true };
+    int64_t bufferSize{ 8 << 20 };  // bytes per buffer
+    int buffers{ 4 };
+};
+
+// from the "writeBehind" section of config.json, or defaults
+WriteBehindConfiguration writeBehindConfiguration();
+
+MovieFile createWriteBehindMovieFile(MovieFile file, const WriteBehindConfiguration& configuration);
+
+#endif
@@ -0,0 +1,642 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "util.hpp"
+
+// Conversions between host frames and RGBA are checked against a scalar reference that scales each
+// channel as the converters do, in double (in float for half float host frames), then clamps and
+// truncates to the destination.
+
+namespace {
+
+enum class Direction { HostToU8, HostToU16, U8ToHost, U16ToHost };
+
+const char *directionName(Direction direction)
+{
+    switch (direction) {
+    case Direction::HostToU8:  return "HostToRGBA_U8";
+    case Direction::HostToU16: return "HostToRGBA_U16";
+    case Direction::U8ToHost:  return "RGBA_U8ToHost";
+    case Direction::U16ToHost: return "RGBA_U16ToHost";
+    }
+    return "";
+}
+
+bool toHost(Direction direction)
+{
+    return direction == Direction::U8ToHost || direction == Direction::U16ToHost;
+}
+
+size_t rgbaChannelSize(Direction direction)
+{
+    return (direction == Direction::HostToU8 || direction == Direction::U8ToHost) ? 1 : 2;
+}
+
+const FrameFormat HostFormats[] = {
+    ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8,
+    ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U16_32k,
+    ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F16,
+    ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_F32,
+    ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8,
+    ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U16_32k,
+    ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F16,
+    ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F32,
+};
+
+// decoders only produce bottom-left BGRA host frames
+bool handled(Direction direction, FrameFormat format)
+{
+    return !toHost(direction) || ((format & (ChannelLayoutMask | FrameOriginMask)) == (ChannelLayout_BGRA | FrameOrigin_BottomLeft));
+}
+
+// IEEE 754 half <-> float, round to nearest even
+float halfToFloat(uint16_t half)
+{
+    int exponent = (half >> 10) & 0x1f;
+    int mantissa = half & 0x3ff;
+    float value = exponent ? std::ldexp((float)(mantissa | 0x400), exponent - 25) : std::ldexp((float)mantissa, -24);
+    return (half & 0x8000) ? -value : value;
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint16_t sign = std::signbit(value) ? 0x8000 : 0;
+    double magnitude = std::fabs((double)value);
+    if (magnitude < std::ldexp(1.0, -14))
+        return (uint16_t)(sign | (uint16_t)std::nearbyint(std::ldexp(magnitude, 24)));
+    int exponent;
+    double mantissa = std::frexp(magnitude, &exponent);  // [0.5, 1)
+    int bits = (int)std::nearbyint((mantissa * 2.0 - 1.0) * 1024.0);
+    if (bits == 1024) {
+        bits = 0;
+        ++exponent;
+    }
+    if (exponent - 1 + 15 >= 0x1f)
+        return (uint16_t)(sign | 0x7c00);
+    return (uint16_t)(sign | ((exponent - 1 + 15) << 10) | bits);
+}
+
+// host channel holding each RGBA channel
+int hostChannel(FrameFormat format, int rgbaChannel)
+{
+    static const int bgra[] = { 2, 1, 0, 3 };
+    static const int argb[] = { 1, 2, 3, 0 };
+    return ((format & ChannelLayoutMask) == ChannelLayout_BGRA) ? bgra[rgbaChannel] : argb[rgbaChannel];
+}
+
+// a channel in its own units
+double readChannel(const uint8_t *pixel, ChannelFormat format, int channel)
+{
+    switch (format) {
+    case ChannelFormat_U8:      return pixel[channel];
+    case ChannelFormat_U16_32k:
+    case ChannelFormat_U16:     return ((const uint16_t *)pixel)[channel];
+    case ChannelFormat_F16:     return halfToFloat(((const uint16_t *)pixel)[channel]);
+    case ChannelFormat_F32:     return ((const float *)pixel)[channel];
+    }
+    return 0.0;
+}
+
+template<typename T>
+void writeChannel(uint8_t *pixel, ChannelFormat format, int channel, T value)
+{
+    auto clamped = [&](T maxValue) { return (value > 0) ? ((value < maxValue) ? value : maxValue) : 0; };
+    switch (format) {
+    case ChannelFormat_U8:      pixel[channel] = (uint8_t)clamped(255); break;
+    case ChannelFormat_U16_32k:
+    case ChannelFormat_U16:     ((uint16_t *)pixel)[channel] = (uint16_t)clamped(65535); break;
+    case ChannelFormat_F16:     ((uint16_t *)pixel)[channel] = floatToHalf((float)value); break;
+    case ChannelFormat_F32:     ((float *)pixel)[channel] = (float)value; break;
+    }
+}
+
+// the scale from source to destination units, and the value of an opaque source alpha; these are the
+// scale factors of the converters themselves, written in T so that they round as the converters' do
+template<typename T>
+struct Scale
+{
+    T toDest;
+    T srcUnit;
+};
+
+template<typename T>
+Scale<T> scaleFor(Direction direction, ChannelFormat format)
+{
+    switch (direction) {
+    case Direction::HostToU16:
+        switch (format) {
+        case ChannelFormat_U16_32k: return { T(65535) / T(32768), T(32768) };
+        case ChannelFormat_U8:      return { T(257), T(255) };
+        default:                    return { T(65535), T(1) };
+        }
+    case Direction::U16ToHost:
+        switch (format) {
+        case ChannelFormat_U16_32k: return { T(32768) / T(65535), T(65535) };
+        case ChannelFormat_U8:      return { T(1) / T(256), T(65535) };
+        default:                    return { T(1) / T(65535), T(65535) };
+        }
+    case Direction::HostToU8:
+        switch (format) {
+        case ChannelFormat_U16_32k: return { T(255) / T(32768), T(32768) };
+        case ChannelFormat_U8:      return { T(1), T(255) };
+        default:                    return { T(255), T(1) };
+        }
+    case Direction::U8ToHost:
+        switch (format) {
+        case ChannelFormat_U16_32k: return { T(32768) / T(255), T(255) };
+        case ChannelFormat_U8:      return { T(1), T(255) };
+        default:                    return { T(1) / T(255), T(255) };
+        }
+    }
+    return { T(1), T(1) };
+}
+
+struct Frame
+{
+    Frame(Direction direction_, FrameFormat format, FrameAlpha hostAlpha, FrameAlpha rgbaAlpha_)
+        : direction(direction_),
+          def(FrameSize{ 37, 5 }, format, hostAlpha),
+          rgbaAlpha(rgbaAlpha_),
+          hostStride((def.size.width + 3) * def.bytesPerPixel()),
+          rgbaStride(def.size.width * 4 * rgbaChannelSize(direction)),
+          host(hostStride * def.size.height),
+          rgba(rgbaStride * def.size.height)
+    {
+        uint32_t seed = 12345;
+        auto next = [&]() { seed = seed * 1664525 + 1013904223; return seed >> 8; };
+        for (auto& byte : host)
+            byte = (uint8_t)next();
+        for (auto& byte : rgba)
+            byte = (uint8_t)next();
+
+        const ChannelFormat hostFormat = def.channelFormat();
+        for (int y = 0; y < def.size.height; ++y) {
+            for (int x = 0; x < def.size.width; ++x) {
+                // every fourth pixel is fully transparent, and the one after it opaque
+                size_t pixel = (size_t)y * def.size.width + x;
+                bool transparent = (pixel % 4 == 0), opaque = (pixel % 4 == 1);
+                if (toHost(direction)) {
+                    if (transparent || opaque)
+                        writeChannel(rgbaPixel(x, y), sourceFormat(), 3, opaque ? (double)rgbaUnit() : 0.0);
+                    continue;
+                }
+                const double unit = (hostFormat == ChannelFormat_U8) ? 255.0 : (hostFormat == ChannelFormat_U16_32k) ? 32768.0 : 1.0;
+                for (int c = 0; c < 4; ++c) {
+                    double value = (next() % 1001) / 1000.0;
+                    if (unit > 1.0)
+                        value = std::floor(value * unit);
+                    if (c == 3 && (transparent || opaque))
+                        value = opaque ? unit : 0.0;
+                    writeChannel(hostPixel(x, y), hostFormat, hostChannel(def.format, c), value);
+                }
+            }
+        }
+    }
+
+    FrameAlpha sourceAlpha() const { return toHost(direction) ? rgbaAlpha : def.alpha; }
+    FrameAlpha destAlpha() const { return toHost(direction) ? def.alpha : rgbaAlpha; }
+    ChannelFormat sourceFormat() const { return (rgbaChannelSize(direction) == 1) ? ChannelFormat_U8 : ChannelFormat_U16; }
+    double rgbaUnit() const { return (rgbaChannelSize(direction) == 1) ? 255.0 : 65535.0; }
+
+    // output pixel (x, y), whichever way up the host frame is
+    uint8_t *hostPixel(int x, int y)
+    {
+        int hostRow = (def.origin() == FrameOrigin_BottomLeft) ? def.size.height - 1 - y : y;
+        return host.data() + hostRow * hostStride + x * def.bytesPerPixel();
+    }
+    uint8_t *rgbaPixel(int x, int y) { return rgba.data() + y * rgbaStride + x * 4 * rgbaChannelSize(direction); }
+
+    void convert()
+    {
+        switch (direction) {
+        case Direction::HostToU8:
+            convertHostFrameTo_RGBA_Top_Left_U8(host.data(), hostStride, def, rgba.data(), rgbaStride, rgbaAlpha);
+            break;
+        case Direction::HostToU16:
+            convertHostFrameTo_RGBA_Top_Left_U16(host.data(), hostStride, def, (uint16_t *)rgba.data(), rgbaStride, rgbaAlpha);
+            break;
+        case Direction::U8ToHost:
+            convertRGBA_Top_Left_U8_ToHostFrame(rgba.data(), host.data(), hostStride, def, rgbaAlpha);
+            break;
+        case Direction::U16ToHost:
+            convertRGBA_Top_Left_U16_ToHostFrame((const uint16_t *)rgba.data(), host.data(), hostStride, def, rgbaAlpha);
+            break;
+        }
+    }
+
+    template<typename T>
+    void convertReference()
+    {
+        const Scale<T> scale = scaleFor<T>(direction, def.channelFormat());
+        for (int y = 0; y < def.size.height; ++y) {
+            for (int x = 0; x < def.size.width; ++x) {
+                T source[4];
+                for (int c = 0; c < 4; ++c)
+                    source[c] = toHost(direction) ? (T)readChannel(rgbaPixel(x, y), sourceFormat(), c)
+                                                  : (T)readChannel(hostPixel(x, y), def.channelFormat(), hostChannel(def.format, c));
+                T factor = 1;
+                if (sourceAlpha() == FrameAlpha_Straight && destAlpha() == FrameAlpha_Premultiplied)
+                    factor = source[3] / scale.srcUnit;
+                else if (sourceAlpha() == FrameAlpha_Premultiplied && destAlpha() == FrameAlpha_Straight)
+                    factor = (source[3] > 0) ? scale.srcUnit / source[3] : 0;
+
+                for (int c = 0; c < 4; ++c) {
+                    T value = source[c] * scale.toDest;
+                    if (c < 3 && sourceAlpha() != destAlpha())
+                        value = value * factor;
+                    if (toHost(direction))
+                        writeChannel(hostPixel(x, y), def.channelFormat(), hostChannel(def.format, c), value);
+                    else
+                        writeChannel(rgbaPixel(x, y), sourceFormat(), c, value);
+                }
+            }
+        }
+    }
+
+    void convertReference()
+    {
+        if (def.channelFormat() == ChannelFormat_F16)
+            convertReference<float>();
+        else
+            convertReference<double>();
+    }
+
+    Direction direction;
+    FrameDef def;
+    FrameAlpha rgbaAlpha;
+    size_t hostStride;
+    size_t rgbaStride;
+    std::vector<uint8_t> host;
+    std::vector<uint8_t> rgba;
+};
+
+std::string caseName(Direction direction, FrameFormat format, FrameAlpha hostAlpha, FrameAlpha rgbaAlpha)
+{
+    return std::string(directionName(direction)) + " format " + std::to_string(format)
+        + ((hostAlpha == FrameAlpha_Premultiplied) ? " premultiplied host" : " straight host")
+        + ((rgbaAlpha == FrameAlpha_Premultiplied) ? ", premultiplied RGBA" : ", straight RGBA");
+}
+
+}  // namespace
+
+TEST(ConversionTest, AlphaConversionMatchesScalarReference)
+{
+    const FrameAlpha alphas[][2] = {
+        { FrameAlpha_Straight,      FrameAlpha_Premultiplied },
+        { FrameAlpha_Premultiplied, FrameAlpha_Straight },
+    };
+    for (Direction direction : { Direction::HostToU8, Direction::HostToU16, Direction::U8ToHost, Direction::U16ToHost }) {
+        for (FrameFormat format : HostFormats) {
+            if (!handled(direction, format))
+                continue;
+            for (auto& alpha : alphas) {
+                SCOPED_TRACE(caseName(direction, format, alpha[0], alpha[1]));
+                Frame frame(direction, format, alpha[0], alpha[1]);
+                Frame expected = frame;
+                frame.convert();
+                expected.convertReference();
+                EXPECT_TRUE(frame.host == expected.host);
+                EXPECT_TRUE(frame.rgba == expected.rgba);
+            }
+        }
+    }
+}
+
+TEST(ConversionTest, AlphaConversionTruncates)
+{
+    // 201 * 128 / 255 = 100.89
+    const uint8_t bgra[] = { 0, 0, 201, 128 };
+    FrameDef def(FrameSize{ 1, 1 }, ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8, FrameAlpha_Straight);
+    uint8_t rgba[4];
+    convertHostFrameTo_RGBA_Top_Left_U8(bgra, 4, def, rgba, 4, FrameAlpha_Premultiplied);
+    EXPECT_EQ(100, rgba[0]);
+    EXPECT_EQ(0, rgba[1]);
+    EXPECT_EQ(0, rgba[2]);
+    EXPECT_EQ(128, rgba[3]);
+}
+
+TEST(ConversionTest, EightBitChannelsWidenToFull16Bit)
+{
+    const uint8_t bgra[] = { 0, 128, 255, 255 };
+    FrameDef def(FrameSize{ 1, 1 }, ChannelLayout_BGRA | FrameOrigin_BottomLeft | ChannelFormat_U8);
+    uint16_t rgba[4];
+    convertHostFrameTo_RGBA_Top_Left_U16(bgra, 4, def, rgba, 8);
+    EXPECT_EQ(65535, rgba[0]);
+    EXPECT_EQ(32896, rgba[1]);
+    EXPECT_EQ(0, rgba[2]);
+    EXPECT_EQ(65535, rgba[3]);
+}
+
+TEST(ConversionTest, ArgbFloatFramesAreSwizzledToRgba)
+{
+    const float argb[] = { 1.f, 0.5f, 0.25f, 0.125f };
+    FrameDef def(FrameSize{ 1, 1 }, ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_F32);
+
+    uint8_t rgba8[4];
+    convertHostFrameTo_RGBA_Top_Left_U8((const uint8_t *)argb, 16, def, rgba8, 4);
+    EXPECT_EQ(127, rgba8[0]);
+    EXPECT_EQ(63, rgba8[1]);
+    EXPECT_EQ(31, rgba8[2]);
+    EXPECT_EQ(255, rgba8[3]);
+
+    uint16_t rgba16[4];
+    convertHostFrameTo_RGBA_Top_Left_U16((const uint8_t *)argb, 16, def, rgba16, 8);
+    EXPECT_EQ(32767, rgba16[0]);
+    EXPECT_EQ(16383, rgba16[1]);
+    EXPECT_EQ(8191, rgba16[2]);
+    EXPECT_EQ(65535, rgba16[3]);
+}
+
+TEST(ConversionTest, OpaquePixelsAreUnchangedByAlphaConversion)
+{
+    for (FrameFormat format : HostFormats) {
+        SCOPED_TRACE(caseName(Direction::HostToU16, format, FrameAlpha_Straight, FrameAlpha_Premultiplied));
+        Frame frame(Direction::HostToU16, format, FrameAlpha_Straight, FrameAlpha_Premultiplied);
+        Frame plain(Direction::HostToU16, format, FrameAlpha_Straight, FrameAlpha_Straight);
+        frame.convert();
+        plain.convert();
+        for (int x = 1; x < frame.def.size.width; x += 4)
+            EXPECT_EQ(0, std::memcmp(frame.rgbaPixel(x, 0), plain.rgbaPixel(x, 0), 8)) << "pixel " << x;
+    }
+}
+
+TEST(ConversionTest, HostFrameAlphaMatchesScalarReference)
+{
+    for (FrameFormat format : HostFormats) {
+        for (FrameAlpha from : { FrameAlpha_Straight, FrameAlpha_Premultiplied }) {
+            FrameAlpha to = (from == FrameAlpha_Straight) ? FrameAlpha_Premultiplied : FrameAlpha_Straight;
+            SCOPED_TRACE(caseName(Direction::HostToU16, format, from, to));
+            Frame source(Direction::HostToU16, format, from, from);
+            Frame frame = source;
+            convertHostFrameAlpha(source.host.data(), source.hostStride, source.def, frame.host.data(), frame.hostStride, to);
+
+            // the reference, in the host frame's own units
+            const ChannelFormat channelFormat = source.def.channelFormat();
+            const double unit = (channelFormat == ChannelFormat_U8) ? 255.0 : (channelFormat == ChannelFormat_U16_32k) ? 32768.0 : 1.0;
+            Frame expected = source;
+            for (int y = 0; y < source.def.size.height; ++y) {
+                for (int x = 0; x < source.def.size.width; ++x) {
+                    const int alphaChannel = hostChannel(format, 3);
+                    double alpha = readChannel(source.hostPixel(x, y), channelFormat, alphaChannel);
+                    for (int c = 0; c < 4; ++c) {
+                        if (c == alphaChannel)
+                            continue;
+                        double value = readChannel(source.hostPixel(x, y), channelFormat, c);
+                        if (channelFormat == ChannelFormat_F16) {
+                            float factor = (to == FrameAlpha_Premultiplied) ? (float)alpha / 1.f : ((alpha > 0) ? 1.f / (float)alpha : 0.f);
+                            writeChannel(expected.hostPixel(x, y), channelFormat, c, (float)value * 1.f * factor);
+                        }
+                        else {
+                            double factor = (to == FrameAlpha_Premultiplied) ? alpha / unit : ((alpha > 0) ? unit / alpha : 0.0);
+                            writeChannel(expected.hostPixel(x, y), channelFormat, c, value * 1.0 * factor);
+                        }
+                    }
+                }
+            }
+            EXPECT_TRUE(frame.host == expected.host);
+        }
+    }
+}
+
+namespace {
+
+// keeps the frames it is given
+class RecordingEncoderJob : public EncoderJob
+{
+public:
+    std::vector<uint8_t> frame;
+    const uint8_t *data = nullptr;
+    size_t stride = 0;
+
+private:
+    void doCopyExternalToLocal(const uint8_t *data_, size_t stride_, FrameFormat /*format*/) override
+    {
+        data = data_;
+        stride = stride_;
+        frame.assign(data_, data_ + stride_ * 2);
+    }
+    void doEncode(EncodeOutput&) override {}
+};
+
+}  // namespace
+
+TEST(ConversionTest, EncoderJobIsGivenStraightFrames)
+{
+    // a premultiplied 2x2 ARGB frame, half transparent
+    const uint8_t premultiplied[] = {
+        128, 100, 50, 0,   255, 10, 20, 30,
+        0,   0,   0,  0,   64,  64, 32, 16,
+    };
+    FrameDef def(FrameSize{ 2, 2 }, ChannelLayout_ARGB | FrameOrigin_TopLeft | ChannelFormat_U8, FrameAlpha_Premultiplied);
+
+    RecordingEncoderJob job;
+    job.copyExternalToLocal(premultiplied, 8, def);
+    const uint8_t straight[] = {
+        128, 199, 99, 0,   255, 10,  20,  30,
+        0,   0,   0,  0,   64,  255, 127, 63,
+    };
+    ASSERT_EQ(sizeof(straight), job.frame.size());
+    EXPECT_EQ(0, std::memcmp(straight, job.frame.data(), sizeof(straight)));
+
+    // straight frames are passed on as they are
+    def.alpha = FrameAlpha_Straight;
+    job.copyExternalToLocal(premultiplied, 8, def);
+    EXPECT_EQ(premultiplied, job.data);
+    EXPECT_EQ(8u, job.stride);
+}
+
+namespace {
+
+// a host frame of in-range values, with stride padding that the converters mustn't touch
+std::vector<uint8_t> hostFrame(const FrameDef& def, size_t stride)
+{
+    std::vector<uint8_t> host(stride * def.size.height, 0xcd);
+    uint32_t seed = 54321;
+    auto next = [&]() { seed = seed * 1664525 + 1013904223; return seed >> 8; };
+    const ChannelFormat format = def.channelFormat();
+    const double unit = (format == ChannelFormat_U8) ? 255.0 : (format == ChannelFormat_U16_32k) ? 32768.0 : 1.0;
+    for (int y = 0; y < def.size.height; ++y) {
+        for (int x = 0; x < def.size.width; ++x) {
+            for (int c = 0; c < 4; ++c) {
+                double value = (next() % 1001) / 1000.0;
+                if (unit > 1.0)
+                    value = std::floor(value * unit);
+                writeChannel(host.data() + y * stride + x * def.bytesPerPixel(), format, c, value);
+            }
+        }
+    }
+    return host;
+}
+
+// a top-left RGBA frame in 4x4 blocks, the last column and row repeated into blocks that overhang the edges
+template<typename T>
+std::vector<T> toBlocks(const std::vector<T>& rgba, FrameSize size)
+{
+    const int blocksWide = (size.width + 3) / 4, blocksHigh = (size.height + 3) / 4;
+    std::vector<T> blocks((size_t)blocksWide * blocksHigh * 64);
+    for (int by = 0; by < blocksHigh; ++by)
+        for (int bx = 0; bx < blocksWide; ++bx)
+            for (int row = 0; row < 4; ++row)
+                for (int column = 0; column < 4; ++column) {
+                    int y = std::min(by * 4 + row, size.height - 1), x = std::min(bx * 4 + column, size.width - 1);
+                    for (int c = 0; c < 4; ++c)
+                        blocks[((size_t)(by * blocksWide + bx) * 16 + row * 4 + column) * 4 + c] = rgba[((size_t)y * size.width + x) * 4 + c];
+                }
+    return blocks;
+}
+
+const FrameSize BlockSizes[] = { { 1, 1 }, { 3, 2 }, { 5, 7 }, { 8, 4 }, { 37, 5 } };
+
+}  // namespace
+
+TEST(ConversionTest, BlocksMatchLinearConversion)
+{
+    for (FrameFormat format : HostFormats) {
+        for (FrameSize size : BlockSizes) {
+            SCOPED_TRACE("format " + std::to_string(format) + " " + std::to_string(size.width) + "x" + std::to_string(size.height));
+            FrameDef def(size, format);
+            const size_t stride = (size.width + 3) * def.bytesPerPixel();
+            const std::vector<uint8_t> host = hostFrame(def, stride);
+
+            std::vector<uint8_t> rgba8((size_t)size.width * size.height * 4);
+            std::vector<uint8_t> blocks8(blockLinearSizeInBytes(size, 4));
+            convertHostFrameTo_RGBA_Top_Left_U8(host.data(), stride, def, rgba8.data(), size.width * 4);
+            convertHostFrameTo_RGBA_Top_Left_U8_Blocks(host.data(), stride, def, blocks8.data());
+            EXPECT_TRUE(toBlocks(rgba8, size) == blocks8);
+
+            std::vector<uint16_t> rgba16((size_t)size.width * size.height * 4);
+            std::vector<uint16_t> blocks16(blockLinearSizeInBytes(size, 8) / 2);
+            convertHostFrameTo_RGBA_Top_Left_U16(host.data(), stride, def, rgba16.data(), size.width * 8);
+            convertHostFrameTo_RGBA_Top_Left_U16_Blocks(host.data(), stride, def, blocks16.data());
+            EXPECT_TRUE(toBlocks(rgba16, size) == blocks16);
+        }
+    }
+}
+
+TEST(ConversionTest, BlocksRoundTripToHostFrame)
+{
+    for (FrameFormat format : HostFormats) {
+        if (!handled(Direction::U8ToHost, format))
+            continue;
+        for (FrameSize size : BlockSizes) {
+            SCOPED_TRACE("format " + std::to_string(format) + " " + std::to_string(size.width) + "x" + std::to_string(size.height));
+            FrameDef def(size, format);
+            const size_t stride = (size.width + 3) * def.bytesPerPixel();
+            const std::vector<uint8_t> host = hostFrame(def, stride);
+
+            // back through blocks as back through linear RGBA, stride padding and all
+            std::vector<uint8_t> rgba8((size_t)size.width * size.height * 4);
+            std::vector<uint8_t> blocks8(blockLinearSizeInBytes(size, 4));
+            convertHostFrameTo_RGBA_Top_Left_U8(host.data(), stride, def, rgba8.data(), size.width * 4);
+            convertHostFrameTo_RGBA_Top_Left_U8_Blocks(host.data(), stride, def, blocks8.data());
+            std::vector<uint8_t> fromLinear8(host.size(), 0xcd), fromBlocks8(host.size(), 0xcd);
+            convertRGBA_Top_Left_U8_ToHostFrame(rgba8.data(), fromLinear8.data(), stride, def);
+            convertRGBA_Top_Left_U8_Blocks_ToHostFrame(blocks8.data(), fromBlocks8.data(), stride, def);
+            EXPECT_TRUE(fromLinear8 == fromBlocks8);
+
+            std::vector<uint16_t> rgba16((size_t)size.width * size.height * 4);
+            std::vector<uint16_t> blocks16(blockLinearSizeInBytes(size, 8) / 2);
+            convertHostFrameTo_RGBA_Top_Left_U16(host.data(), stride, def, rgba16.data(), size.width * 8);
+            convertHostFrameTo_RGBA_Top_Left_U16_Blocks(host.data(), stride, def, blocks16.data());
+            std::vector<uint8_t> fromLinear16(host.size(), 0xcd), fromBlocks16(host.size(), 0xcd);
+            convertRGBA_Top_Left_U16_ToHostFrame(rgba16.data(), fromLinear16.data(), stride, def);
+            convertRGBA_Top_Left_U16_Blocks_ToHostFrame(blocks16.data(), fromBlocks16.data(), stride, def);
+            EXPECT_TRUE(fromLinear16 == fromBlocks16);
+
+            // 8 bit frames come back as they went, through either
+            if (def.channelFormat() == ChannelFormat_U8) {
+                EXPECT_TRUE(host == fromBlocks8);
+                EXPECT_TRUE(host == fromBlocks16);
+            }
+        }
+    }
+}
+
+namespace {
+
+// random host frame data over each channel's full range; floats in [0, 1]
+std::vector<uint8_t> randomFrame(const FrameDef& def, size_t stride, uint32_t seed)
+{
+    std::vector<uint8_t> frame(stride * def.size.height, 0xcd);
+    auto next = [&]() { seed = seed * 1664525 + 1013904223; return seed >> 8; };
+    const ChannelFormat format = def.channelFormat();
+    for (int y = 0; y < def.size.height; ++y) {
+        uint8_t *row = frame.data() + y * stride;
+        for (int i = 0; i < def.size.width * 4; ++i) {
+            switch (format) {
+            case ChannelFormat_U8:  row[i] = (uint8_t)next(); break;
+            case ChannelFormat_U16: ((uint16_t *)row)[i] = (uint16_t)next(); break;
+            case ChannelFormat_F16: ((uint16_t *)row)[i] = floatToHalf((next() % 4097) / 4096.0f); break;
+            case ChannelFormat_F32: ((float *)row)[i] = (next() % 100001) / 100000.0f; break;
+            default: break;
+            }
+        }
+    }
+    return frame;
+}
+
+// a channel of the 2x2 box filter of the frame, at destination pixel x, y: integers rounded to nearest,
+// floats summed down the columns first
+double boxFilter(const std::vector<uint8_t>& frame, size_t stride, ChannelFormat format, int x, int y, int channel)
+{
+    const uint8_t *row0 = frame.data() + 2 * y * stride;
+    const uint8_t *row1 = row0 + stride;
+    const int i = 8 * x + channel, j = i + 4;
+    switch (format) {
+    case ChannelFormat_U8:
+        return (row0[i] + row1[i] + row0[j] + row1[j] + 2) >> 2;
+    case ChannelFormat_U16: {
+        auto r0 = (const uint16_t *)row0, r1 = (const uint16_t *)row1;
+        return ((uint32_t)r0[i] + r1[i] + r0[j] + r1[j] + 2) >> 2;
+    }
+    case ChannelFormat_F16: {
+        auto r0 = (const uint16_t *)row0, r1 = (const uint16_t *)row1;
+        float left = halfToFloat(r0[i]) + halfToFloat(r1[i]), right = halfToFloat(r0[j]) + halfToFloat(r1[j]);
+        return halfToFloat(floatToHalf((left + right) * 0.25f));
+    }
+    case ChannelFormat_F32: {
+        auto r0 = (const float *)row0, r1 = (const float *)row1;
+        return ((r0[i] + r1[i]) + (r0[j] + r1[j])) * 0.25f;
+    }
+    default:
+        return 0.0;
+    }
+}
+
+}  // namespace
+
+TEST(ConversionTest, DownscaleByHalfMatchesBoxFilter)
+{
+    const ChannelFormat formats[] = { ChannelFormat_U8, ChannelFormat_U16, ChannelFormat_F16, ChannelFormat_F32 };
+    // odd sizes drop their last row or column; widths run the vector loops into their scalar tails
+    const FrameSize sizes[] = { { 1, 1 }, { 2, 2 }, { 3, 5 }, { 7, 3 }, { 9, 4 }, { 17, 7 }, { 19, 2 }, { 66, 9 } };
+    for (ChannelFormat channelFormat : formats) {
+        for (FrameSize size : sizes) {
+            SCOPED_TRACE("format " + std::to_string(channelFormat) + " " + std::to_string(size.width) + "x" + std::to_string(size.height));
+            FrameDef def(size, ChannelLayout_BGRA | FrameOrigin_TopLeft | channelFormat);
+            const size_t stride = (size.width + 3) * def.bytesPerPixel();
+            const std::vector<uint8_t> source = randomFrame(def, stride, 777 + size.width);
+
+            FrameSize half = halfFrameSize(size);
+            EXPECT_EQ(size.width / 2, half.width);
+            EXPECT_EQ(size.height / 2, half.height);
+            // stride padding in the destination, which mustn't be touched
+            const size_t destStride = (half.width + 1) * def.bytesPerPixel();
+            std::vector<uint8_t> dest(destStride * half.height, 0xcd);
+            downscaleHostFrameByHalf(source.data(), stride, def, dest.data(), destStride);
+
+            for (int y = 0; y < half.height; ++y) {
+                const uint8_t *row = dest.data() + y * destStride;
+                for (int x = 0; x < half.width; ++x)
+                    for (int c = 0; c < 4; ++c)
+                        ASSERT_EQ(boxFilter(source, stride, channelFormat, x, y, c), readChannel(row + x * def.bytesPerPixel(), channelFormat, c))
+                            << "at " << x << ", " << y << " channel " << c;
+                for (size_t i = half.width * def.bytesPerPixel(); i < destStride; ++i)
+                    ASSERT_EQ(0xcd, row[i]) << "padding of row " << y;
+            }
+        }
+    }
+}
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+#include "io_uring_file.hpp"
+#include "write_behind_file.hpp"
+
+// MovieFile backends are checked against a file held in memory, which records the order of the
+// operations it is given
+
+namespace {
+
+struct RecordedFile
+{
+    std::vector<uint8_t> data;
+    int64_t position{ 0 };
+    std::vector<std::string> operations;
+    bool failWrites{ false };
+    bool throwOnWrite{ false };
+    std::chrono::milliseconds writeDelay{ 0 };  // a slow disk
+
+    MovieFile forWrite()
+    {
+        MovieFile file;
+        file.onOpenForWrite = [this]() { operations.push_back("open"); };
+        file.onWrite = [this](const uint8_t* buffer, int size) -> size_t {
+            operations.push_back("write");
+            std::this_thread::sleep_for(writeDelay);
+            if (throwOnWrite)
+                throw std::runtime_error("disk on fire");
+            if (failWrites)
+                return (size_t)-1;
+            if (position + size > (int64_t)data.size())
+                data.resize(position + size);
+            std::memcpy(&data[position], buffer, size);
+            position += size;
+            return 0;
+        };
+        file.onSeek = [this](int64_t offset, int whence) {
+            operations.push_back("seek");
+            if (whence == SEEK_SET)
+                position = offset;
+            else if (whence == SEEK_CUR)
+                position += offset;
+            else
+                position = (int64_t)data.size() + offset;
+            return 0;
+        };
+        file.onClose = [this]() { operations.push_back("close"); return 0; };
+        file.onTruncate = [this](int64_t size) {
+            operations.push_back("truncate");
+            data.resize(size);
+            return 0;
+        };
+        file.onMove = [this](int64_t source, int64_t destination, int64_t size) {
+            operations.push_back("move");
+            if (destination + size > (int64_t)data.size())
+                data.resize(destination + size);
+            std::memmove(&data[destination], &data[source], size);
+            return 0;
+        };
+        return file;
+    }
+
+    // the operations, without the writes between them
+    std::vector<std::string> withoutRepeatedWrites() const
+    {
+        std::vector<std::string> collapsed;
+        for (const auto& operation : operations)
+            if (collapsed.empty() || operation != "write" || collapsed.back() != "write")
+                collapsed.push_back(operation);
+        return collapsed;
+    }
+};
+
+std::vector<uint8_t> bytes(size_t size, uint32_t seed)
+{
+    std::vector<uint8_t> data(size);
+    for (auto& byte : data) {
+        seed = seed * 1664525 + 1013904223;
+        byte = (uint8_t)(seed >> 24);
+    }
+    return data;
+}
+
+WriteBehindConfiguration smallBuffers()
+{
+    WriteBehindConfiguration configuration;
+    configuration.bufferSize = 1000;
+    configuration.buffers = 2;
+    return configuration;
+}
+
+}  // namespace
+
+TEST(WriteBehindTest, WritesAndSeeksLandInOrder)
+{
+    // the same writes and seeks, directly and behind; sizes straddle the buffers
+    RecordedFile direct, behind;
+    MovieFile directFile = direct.forWrite();
+    MovieFile behindFile = createWriteBehindMovieFile(behind.forWrite(), smallBuffers());
+    directFile.onOpenForWrite();
+    behindFile.onOpenForWrite();
+
+    uint32_t seed = 1;
+    for (int i = 0; i < 300; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        if ((seed >> 16) % 10 == 0) {
+            int64_t offset = (seed >> 8) % 5000;
+            EXPECT_EQ(0, directFile.onSeek(offset, SEEK_SET));
+            EXPECT_EQ(0, behindFile.onSeek(offset, SEEK_SET));
+        }
+        else {
+            auto data = bytes((seed >> 8) % 4000, seed);
+            EXPECT_EQ(0u, directFile.onWrite(data.data(), (int)data.size()));
+            EXPECT_EQ(0u, behindFile.onWrite(data.data(), (int)data.size()));
+        }
+    }
+    EXPECT_EQ(0, behindFile.onClose());
+    EXPECT_EQ(direct.data, behind.data);
+}
+
+TEST(WriteBehindTest, CloseFlushesPartlyFilledBuffer)
+{
+    RecordedFile recorded;
+    MovieFile file = createWriteBehindMovieFile(recorded.forWrite(), smallBuffers());
+    file.onOpenForWrite();
+
+    auto data = bytes(300, 2);
+    EXPECT_EQ(0u, file.onWrite(data.data(), (int)data.size()));
+    // a buffer is only written out once it is full, or a seek or close follows it
+    EXPECT_TRUE(recorded.data.empty());
+
+    EXPECT_EQ(0, file.onClose());
+    EXPECT_EQ(data, recorded.data);
+    EXPECT_EQ("close", recorded.operations.back());
+}
+
+TEST(WriteBehindTest, WriterThreadErrorsAreReported)
+{
+    for (bool throws : { false, true }) {
+        SCOPED_TRACE(throws ? "throwing write" : "failing write");
+        RecordedFile recorded;
+        recorded.failWrites = !throws;
+        recorded.throwOnWrite = throws;
+        MovieFile file = createWriteBehindMovieFile(recorded.forWrite(), smallBuffers());
+        file.onOpenForWrite();
+
+        // each write fills more buffers than there are, so waits for the io thread to fail one
+        auto data = bytes(2500, 3);
+        int failedAt = -1;
+        for (int i = 0; i < 10 && failedAt < 0; ++i)
+            if ((int)file.onWrite(data.data(), (int)data.size()) != 0)
+                failedAt = i;
+        EXPECT_GE(failedAt, 0);
+        EXPECT_NE(0, file.onSeek(0, SEEK_SET));
+        EXPECT_NE(0, file.onClose());
+
+        // nothing more reached the file after the first failure
+        EXPECT_EQ(1, std::count(recorded.operations.begin(), recorded.operations.end(), "write"));
+    }
+}
+
+TEST(WriteBehindTest, TruncateAndMoveFollowQueuedWrites)
+{
+    RecordedFile recorded;
+    recorded.writeDelay = std::chrono::milliseconds(20);
+    MovieFile file = createWriteBehindMovieFile(recorded.forWrite(), smallBuffers());
+    file.onOpenForWrite();
+
+    // writes still queued when the truncate and move are queued
+    auto head = bytes(1500, 4);
+    auto tail = bytes(700, 5);
+    EXPECT_EQ(0u, file.onWrite(head.data(), (int)head.size()));
+    EXPECT_EQ(0u, file.onWrite(tail.data(), (int)tail.size()));
+    EXPECT_EQ(0, file.onTruncate(2000));
+    EXPECT_EQ(0, file.onMove(1000, 0, 1000));
+    EXPECT_EQ(0, file.onClose());
+
+    std::vector<std::string> expectedOperations{ "open", "write", "truncate", "move", "close" };
+    EXPECT_EQ(expectedOperations, recorded.withoutRepeatedWrites());
+
+    std::vector<uint8_t> expected = head;
+    expected.insert(expected.end(), tail.begin(), tail.end());
+    expected.resize(2000);
+    std::memmove(expected.data(), expected.data() + 1000, 1000);
+    EXPECT_EQ(expected, recorded.data);
+}
+
+#ifdef __linux__
+
+namespace {
+
+std::vector<uint8_t> readFile(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+}  // namespace
+
+TEST(IoUringTest, UnalignedWritesAndSeeksReadBackByteForByte)
+{
+    const std::string path = (std::filesystem::temp_directory_path() / "fdn_io_uring_test.bin").string();
+    for (bool directIo : { false, true }) {
+        SCOPED_TRACE(directIo ? "O_DIRECT" : "page cache");
+        FileIoConfiguration configuration;
+        configuration.backend = "io_uring";
+        configuration.directIo = directIo;
+        configuration.bufferSize = 64 << 10;
+        configuration.queueDepth = 4;
+
+        MovieFile file;
+        try {
+            file = createIoUringMovieFile(path, configuration);
+        }
+        catch (const std::exception& ex) {
+            GTEST_SKIP() << "io_uring unavailable: " << ex.what();
+        }
+
+        // sizes and offsets off the page size, within a buffer, across buffers and across the queue
+        std::vector<uint8_t> expected;
+        int64_t position = 0;
+        auto write = [&](int64_t offset, size_t size, uint32_t seed) {
+            if (offset != position)
+                ASSERT_EQ(0, file.onSeek(offset, SEEK_SET));
+            auto data = bytes(size, seed);
+            ASSERT_EQ(0u, file.onWrite(data.data(), (int)data.size()));
+            if (offset + size > expected.size())
+                expected.resize(offset + size);
+            std::memcpy(&expected[offset], data.data(), size);
+            position = offset + size;
+        };
+        file.onOpenForWrite();
+        write(0, 1, 1);
+        write(1, 4095, 2);
+        write(4096, 70001, 3);
+        write(74097, 333333, 4);
+        write(12345, 777, 5);       // back over the start, unaligned at both ends
+        write(407430, 4096, 6);     // aligned size at an unaligned end
+        write(200003, 65536, 7);    // a whole buffer's worth, unaligned
+        write(407430 + 4096, 3, 8);
+        ASSERT_EQ(0, file.onClose());
+
+        EXPECT_EQ(expected, readFile(path));
+
+        // and back through io_uring, from unaligned offsets
+        MovieFile reader = openIoUringMovieFileForRead(path, configuration);
+        ASSERT_EQ((int64_t)expected.size(), reader.fileSize);
+        std::vector<uint8_t> read(expected.size());
+        for (int64_t offset : { (int64_t)0, (int64_t)4097, (int64_t)12345, (int64_t)expected.size() - 3 }) {
+            ASSERT_EQ(0, reader.onSeek(offset, SEEK_SET));
+            size_t size = std::min((size_t)150001, expected.size() - (size_t)offset);
+            ASSERT_EQ(size, reader.onRead(read.data(), (int)size));
+            EXPECT_EQ(0, std::memcmp(read.data(), &expected[offset], size)) << "from " << offset;
+        }
+        EXPECT_EQ(0, reader.onClose());
+    }
+    std::filesystem::remove(path);
+}
+
+#endif
@@ -1,6 +1,17 @@
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 #include "gtest/gtest.h"
+#include "exporter.hpp"
+#include "movie_reader.hpp"
+#include "movie_segments.hpp"
 #include "movie_writer.hpp"
+#include "pcm_store.hpp"
 
 class SnapTest : public ::testing::Test {
  protected:
@@ -61,3 +72,848 @@ TEST_F(SnapTest, SnapWorks)
 		EXPECT_EQ(standard, SimplifyAndSnapToMpegFrameRate(deviated4));
 	}
 }
+
+// a movie held in memory, so that the writer and reader can be exercised without touching disk
+class MemoryMovie
+{
+public:
+    MovieFile forWrite(bool movable = false)
+    {
+        MovieFile file;
+        file.onOpenForWrite = [this]() { data.clear(); position = 0; moves = 0; };
+        file.onWrite = [this](const uint8_t* buffer, int size) {
+            if (position + size > (int64_t)data.size())
+                data.resize(position + size);
+            std::memcpy(&data[position], buffer, size);
+            position += size;
+            return 0;
+        };
+        file.onSeek = [this](int64_t offset, int whence) { return seek(offset, whence); };
+        file.onClose = []() { return 0; };
+        if (movable) {
+            file.onMove = [this](int64_t source, int64_t destination, int64_t size) {
+                ++moves;
+                if (destination + size > (int64_t)data.size())
+                    data.resize(destination + size);
+                std::memmove(&data[destination], &data[source], size);
+                return 0;
+            };
+        }
+        if (withSidecar) {
+            file.onWriteSidecar = [this](const uint8_t *buffer, size_t size) {
+                sidecar.assign(buffer, buffer + size);
+                return 0;
+            };
+        }
+        if (space) {
+            // as fallocate(FALLOC_FL_KEEP_SIZE), reserving without changing the size
+            file.onPreallocate = [this](int64_t size) {
+                if (size > space)
+                    return -1;
+                reserved = size;
+                return 0;
+            };
+            file.onTruncate = [this](int64_t size) {
+                truncations.push_back(size);
+                data.resize((size_t)size);
+                return 0;
+            };
+        }
+        return file;
+    }
+
+    MovieFile forRead()
+    {
+        MovieFile file;
+        position = 0;
+        reads.clear();
+        file.fileSize = (int64_t)data.size();
+        file.onRead = [this](uint8_t* buffer, int size) {
+            size_t n = std::min((size_t)size, data.size() - (size_t)position);
+            std::memcpy(buffer, &data[position], n);
+            reads.push_back(Range{ position, (int64_t)n });
+            position += n;
+            return n;
+        };
+        file.onSeek = [this](int64_t offset, int whence) { return seek(offset, whence); };
+        file.onClose = []() { return 0; };
+        if (!sidecar.empty()) {
+            file.onReadSidecar = [this](std::vector<uint8_t>& buffer) {
+                buffer = sidecar;
+                return 0;
+            };
+        }
+        return file;
+    }
+
+    struct Atom
+    {
+        std::string type;
+        int64_t offset;
+        int64_t size;
+    };
+
+    // the top level atoms, which must exactly cover the file
+    std::vector<Atom> atoms() const
+    {
+        std::vector<Atom> atoms;
+        int64_t offset = 0;
+        while (offset + 8 <= (int64_t)data.size()) {
+            int64_t size = read32(offset);
+            if (size == 1)
+                size = (read32(offset + 8) << 32) | read32(offset + 12);
+            atoms.push_back(Atom{ std::string((const char *)&data[offset + 4], 4), offset, size });
+            if (size < 8)
+                break;
+            offset += size;
+        }
+        EXPECT_EQ(offset, (int64_t)data.size());
+        return atoms;
+    }
+
+    struct Range
+    {
+        int64_t offset;
+        int64_t size;
+    };
+
+    // whether any read since forRead touched the atom
+    bool wasRead(const Atom& atom) const
+    {
+        return std::any_of(reads.begin(), reads.end(), [&](const Range& read) {
+            return read.offset < atom.offset + atom.size && atom.offset < read.offset + read.size;
+        });
+    }
+
+    std::vector<uint8_t> data;
+    int64_t position{ 0 };
+    int moves{ 0 };                 // by forWrite's file, when movable
+    std::vector<Range> reads;       // by forRead's file
+    bool withSidecar{ false };      // written by forWrite's file when set
+    std::vector<uint8_t> sidecar;   // read by forRead's file when not empty
+    int64_t space{ 0 };             // forWrite's file can preallocate up to this when set
+    int64_t reserved{ 0 };
+    std::vector<int64_t> truncations;
+
+private:
+    int seek(int64_t offset, int whence)
+    {
+        if (whence == SEEK_SET)
+            position = offset;
+        else if (whence == SEEK_CUR)
+            position += offset;
+        else if (whence == SEEK_END)
+            position = (int64_t)data.size() + offset;
+        else
+            return -1;
+        return 0;
+    }
+
+    int64_t read32(int64_t offset) const
+    {
+        return ((int64_t)data[offset] << 24) | (data[offset + 1] << 16) | (data[offset + 2] << 8) | data[offset + 3];
+    }
+};
+
+// how MovieTest::exportMovie writes a movie; the defaults are those of an export through libavformat
+struct TestExport
+{
+    enum Audio
+    {
+        NoAudio,
+        AudioPackets,    // writeAudioFrame, alongside the frames
+        AppendedAudio,   // appendAudio, alongside the frames; needs framesPerAudioChunk
+        PreloadedAudio   // preloadAudio, all of it ahead of the frames
+    };
+
+    explicit TestExport(int frames) : frames(frames), declaredFrames(frames) {}
+
+    int frames;
+    int64_t declaredFrames;         // the duration the host reports
+    int firstFrame{ 0 };            // of the frames numbered by MovieTest::frame, for a segment
+    VideoFormat format{ 'H', 'a', 'p', '1' };
+    int bitDepth{ 32 };
+    Audio audio{ AudioPackets };
+    bool writeMoovTagEarly{ true };
+    bool movable{ false };          // the file has onMove
+    double fragmentInterval{ 0 };
+    bool native{ false };
+    int64_t frameAlignment{ 0 };
+    int framesPerAudioChunk{ 0 };
+    int64_t reserveFileSize{ 0 };
+};
+
+class MovieTest : public ::testing::Test {
+ protected:
+  static const int FrameRate = 30;
+  static const int SampleRate = 8000;
+  static const int AudioPacketSamples = 100;
+
+  static std::vector<uint8_t> frame(int i)
+  {
+      return std::vector<uint8_t>(16 + i % 7, (uint8_t)i);
+  }
+
+  // mono 16 bit samples from pts on, each byte distinct from its neighbours
+  static std::vector<uint8_t> audioPacket(int64_t pts, int64_t samples)
+  {
+      std::vector<uint8_t> packet((size_t)samples * 2);
+      for (size_t i = 0; i < packet.size(); ++i)
+          packet[i] = (uint8_t)((pts * 2 + (int64_t)i) * 7);
+      return packet;
+  }
+
+  static int64_t samplesBefore(int64_t frame)
+  {
+      return frame * SampleRate / FrameRate;
+  }
+
+  static VideoDef videoDef(const TestExport& how)
+  {
+      return VideoDef{ 64, 64, how.format, "test", how.bitDepth, Rational{ FrameRate, 1 }, how.declaredFrames };
+  }
+
+  static AudioDef audioDef()
+  {
+      return AudioDef{ 1, SampleRate, 2, AudioEncoding_Signed_PCM };
+  }
+
+  // writes frames of varying size, with the audio for them in packets that don't line up with the
+  // frames. Through libavformat, the muxer's audio chunks then alternate between 2 and 3 packets - a
+  // sample-to-chunk entry per chunk, where guessMoovSize expects one per 60
+  static void exportMovie(MemoryMovie& to, const TestExport& how)
+  {
+      std::optional<AudioDef> audio;
+      if (how.audio != TestExport::NoAudio)
+          audio = audioDef();
+      MovieWriter writer(0, to.forWrite(how.movable), videoDef(how), audio, how.writeMoovTagEarly, 0,
+                         how.fragmentInterval, how.native, how.frameAlignment, how.framesPerAudioChunk);
+      writer.writeHeader(how.reserveFileSize);
+
+      // the samples are numbered from the movie's first frame, so that segments carry on from each other
+      const int64_t firstSample = samplesBefore(how.firstFrame);
+      const int64_t endSample = samplesBefore(how.firstFrame + how.frames);
+      auto packet = [&](int64_t position) {
+          return audioPacket(position, std::min<int64_t>(AudioPacketSamples, endSample - position));
+      };
+      if (how.audio == TestExport::PreloadedAudio) {
+          for (int64_t position = firstSample; position < endSample; position += AudioPacketSamples) {
+              auto samples = packet(position);
+              writer.preloadAudio(samples.data(), samples.size(), position - firstSample);
+          }
+      }
+
+      int64_t position = firstSample;
+      for (int i = how.firstFrame; i < how.firstFrame + how.frames; ++i) {
+          auto data = frame(i);
+          writer.writeVideoFrame(data.data(), data.size());
+          for (; position < samplesBefore(i + 1); position += AudioPacketSamples) {
+              auto samples = packet(position);
+              if (how.audio == TestExport::AudioPackets)
+                  writer.writeAudioFrame(samples.data(), samples.size(), position - firstSample);
+              else if (how.audio == TestExport::AppendedAudio)
+                  writer.appendAudio(samples.data(), samples.size());
+          }
+      }
+
+      writer.writeTrailer();
+      writer.close();
+  }
+
+  void exportMovie(const TestExport& how)
+  {
+      exportMovie(movie, how);
+  }
+
+  static std::unique_ptr<MovieReader> reopen(MemoryMovie& from, VideoFormat format = VideoFormat{ 'H', 'a', 'p', '1' })
+  {
+      return std::make_unique<MovieReader>(format, from.forRead());
+  }
+
+  // the frames and audio of the export, as the reader has them
+  static void expectReadBack(MovieReader& reader, const TestExport& how)
+  {
+      ASSERT_EQ(how.frames, reader.numFrames());
+      std::vector<uint8_t> read;
+      for (int i : { 0, 1, how.frames / 2, how.frames - 1 }) {
+          reader.readVideoFrame(i, read);
+          EXPECT_EQ(frame(how.firstFrame + i), read);
+      }
+
+      ASSERT_EQ(how.audio != TestExport::NoAudio, reader.hasAudio());
+      if (reader.hasAudio()) {
+          int64_t samples = samplesBefore(how.firstFrame + how.frames) - samplesBefore(how.firstFrame);
+          ASSERT_EQ(samples, reader.numAudioFrames());
+          reader.readAudio(0, (size_t)samples, read);
+          EXPECT_EQ(audioPacket(samplesBefore(how.firstFrame), samples), read);
+      }
+  }
+
+  // exports the movie and opens it again, checking that what was written reads back
+  std::unique_ptr<MovieReader> exportAndReopen(const TestExport& how)
+  {
+      exportMovie(how);
+      auto reader = reopen(movie);
+      expectReadBack(*reader, how);
+      return reader;
+  }
+
+  static int count(const std::vector<MemoryMovie::Atom>& atoms, const std::string& type)
+  {
+      return (int)std::count_if(atoms.begin(), atoms.end(), [&](const MemoryMovie::Atom& atom) { return atom.type == type; });
+  }
+
+  static int indexOf(const std::vector<MemoryMovie::Atom>& atoms, const std::string& type)
+  {
+      for (size_t i = 0; i < atoms.size(); ++i)
+          if (atoms[i].type == type)
+              return (int)i;
+      return -1;
+  }
+
+  // an encoded frame held by reference, counting its release
+  static AVBufferRef *reference(const std::vector<uint8_t>& data, int& released)
+  {
+      uint8_t *copy = (uint8_t *)av_malloc(data.size());
+      std::memcpy(copy, data.data(), data.size());
+      return av_buffer_create(copy, (int)data.size(),
+          [](void *opaque, uint8_t *data) { ++*reinterpret_cast<int *>(opaque); av_free(data); }, &released, 0);
+  }
+
+  MemoryMovie movie;
+};
+
+TEST_F(MovieTest, LongExportWithAudioKeepsMoovAheadOfMedia)
+{
+    TestExport how(FrameRate * 60 * 5);
+    exportAndReopen(how);
+
+    // measured before the trailer, the moov fits the space reserved, and the rest is left free
+    auto atoms = movie.atoms();
+    EXPECT_EQ(1, count(atoms, "moov"));
+    int moov = indexOf(atoms, "moov");
+    ASSERT_EQ(1, moov);
+    ASSERT_LT(moov + 1, (int)atoms.size());
+    EXPECT_EQ("free", atoms[moov + 1].type);
+    EXPECT_LT(moov + 1, indexOf(atoms, "mdat"));
+}
+
+TEST_F(MovieTest, ExportLongerThanReservedFallsBackToMoovAfterMedia)
+{
+    // as if the host reported a much shorter duration than it rendered
+    TestExport how(FrameRate * 60 * 5);
+    how.declaredFrames = 100;
+    exportAndReopen(how);
+
+    auto atoms = movie.atoms();
+    EXPECT_EQ(1, count(atoms, "moov"));
+    int moov = indexOf(atoms, "moov");
+    int free = indexOf(atoms, "free");
+    ASSERT_NE(-1, moov);
+    ASSERT_NE(-1, free);
+    EXPECT_GT(moov, indexOf(atoms, "mdat"));
+    // the space reserved for the moov is left as a free atom, as the measured moov didn't fit it
+    EXPECT_LT(free, indexOf(atoms, "mdat"));
+    EXPECT_LT(atoms[free].size, atoms[moov].size + 4096);
+}
+
+TEST_F(MovieTest, MoovWrittenAfterMediaIsMovedAheadOfIt)
+{
+    TestExport how(FrameRate * 60);
+    how.writeMoovTagEarly = false;
+    for (bool movable : { false, true }) {
+        SCOPED_TRACE(movable ? "movable" : "not movable");
+        how.movable = movable;
+        exportAndReopen(how);
+
+        // moved in place, in one go, when the file can move what it holds; left at the end otherwise
+        auto atoms = movie.atoms();
+        EXPECT_EQ(1, count(atoms, "moov"));
+        EXPECT_EQ(movable ? 1 : (int)atoms.size() - 1, indexOf(atoms, "moov"));
+        EXPECT_EQ(movable ? 1 : 0, movie.moves);
+    }
+}
+
+TEST_F(MovieTest, ExportLongerThanReservedMovesMoovAheadOfMedia)
+{
+    TestExport how(FrameRate * 60 * 5);
+    how.declaredFrames = 100;
+    how.movable = true;
+    exportAndReopen(how);
+
+    // the media moves along past the reserved space, which stays ahead of it
+    auto atoms = movie.atoms();
+    EXPECT_EQ(1, count(atoms, "moov"));
+    EXPECT_EQ(1, indexOf(atoms, "moov"));
+    EXPECT_EQ(1, movie.moves);
+    EXPECT_LT(indexOf(atoms, "free"), indexOf(atoms, "mdat"));
+}
+
+TEST_F(MovieTest, FragmentedExportReadsBackFromFragments)
+{
+    TestExport how(FrameRate * 10);
+    how.declaredFrames = 100;
+    how.fragmentInterval = 1.0;
+    auto reader = exportAndReopen(how);
+    EXPECT_TRUE(reader->fragmented());
+
+    // an empty moov, then a fragment a second, each a moof and the mdat it describes
+    auto atoms = movie.atoms();
+    EXPECT_EQ(1, indexOf(atoms, "moov"));
+    EXPECT_GE(count(atoms, "moof"), 9);
+    for (size_t i = 0; i < atoms.size(); ++i) {
+        if (atoms[i].type == "moof") {
+            EXPECT_TRUE(i + 1 < atoms.size() && atoms[i + 1].type == "mdat") << "moof " << i;
+        }
+    }
+}
+
+TEST_F(MovieTest, FragmentedExportCutShortReadsCompleteFragments)
+{
+    // as if the export crashed part way through writing a fragment
+    TestExport how(FrameRate * 10);
+    how.fragmentInterval = 1.0;
+    exportMovie(how);
+
+    auto atoms = movie.atoms();
+    auto lastMoof = std::find_if(atoms.rbegin(), atoms.rend(), [](const MemoryMovie::Atom& atom) { return atom.type == "moof"; });
+    ASSERT_NE(atoms.rend(), lastMoof);
+    movie.data.resize((size_t)(lastMoof->offset + lastMoof->size + 16));
+
+    auto reader = reopen(movie);
+    EXPECT_TRUE(reader->fragmented());
+    ASSERT_GT(reader->numFrames(), 0);
+    ASSERT_LT(reader->numFrames(), how.frames);
+    std::vector<uint8_t> read;
+    for (int i : { 0, (int)reader->numFrames() - 1 }) {
+        reader->readVideoFrame(i, read);
+        EXPECT_EQ(frame(i), read);
+    }
+}
+
+TEST_F(MovieTest, NativeMuxerWritesMoovInReservedSpace)
+{
+    TestExport how(FrameRate * 60);
+    how.native = true;
+    exportAndReopen(how);
+
+    auto atoms = movie.atoms();
+    EXPECT_EQ(1, count(atoms, "moov"));
+    EXPECT_EQ(1, indexOf(atoms, "moov"));
+    int mdat = indexOf(atoms, "mdat");
+    ASSERT_NE(-1, mdat);
+    EXPECT_EQ("wide", atoms[mdat - 1].type);
+
+    // samples go to the mdat as they arrive, so the first frame starts it
+    auto first = frame(0);
+    ASSERT_GE(atoms[mdat].size, 8 + (int64_t)first.size());
+    EXPECT_TRUE(std::equal(first.begin(), first.end(), movie.data.begin() + atoms[mdat].offset + 8));
+}
+
+TEST_F(MovieTest, NativeMuxerExportLongerThanReservedMovesMoovAheadOfMedia)
+{
+    TestExport how(FrameRate * 60 * 5);
+    how.declaredFrames = 100;
+    how.movable = true;
+    how.native = true;
+    exportAndReopen(how);
+
+    auto atoms = movie.atoms();
+    EXPECT_EQ(1, count(atoms, "moov"));
+    EXPECT_EQ(1, indexOf(atoms, "moov"));
+    EXPECT_EQ(1, movie.moves);
+    EXPECT_LT(indexOf(atoms, "moov"), indexOf(atoms, "mdat"));
+}
+
+TEST_F(MovieTest, ReferencedFramesAreReleasedOnceWritten)
+{
+    TestExport how(FrameRate * 10);
+    int released = 0;
+    {
+        MovieWriter writer(0, movie.forWrite(), videoDef(how), audioDef(), true);
+        writer.writeHeader();
+        std::vector<uint8_t> samples;
+        for (int i = 0; i < how.frames; ++i) {
+            writer.writeVideoFrame(reference(frame(i), released));
+            samples = audioPacket(samplesBefore(i), samplesBefore(i + 1) - samplesBefore(i));
+            writer.writeAudioFrame(reference(samples, released), samplesBefore(i));
+        }
+        writer.writeTrailer();
+        // every reference handed over is given back by the time the trailer is written
+        EXPECT_EQ(how.frames * 2, released);
+        writer.close();
+    }
+    EXPECT_EQ(how.frames * 2, released);
+
+    expectReadBack(*reopen(movie), how);
+}
+
+TEST_F(MovieTest, NativeMuxerAlignedFramesStayAlignedWhenMoovIsMoved)
+{
+    // small enough frames that each alignment boundary in the media starts the next frame
+    TestExport how(200);
+    how.writeMoovTagEarly = false;
+    how.movable = true;
+    how.native = true;
+    how.frameAlignment = 4096;
+    exportAndReopen(how);
+
+    auto atoms = movie.atoms();
+    EXPECT_EQ(1, indexOf(atoms, "moov"));
+    int mdat = indexOf(atoms, "mdat");
+    ASSERT_NE(-1, mdat);
+
+    std::vector<int> framesAtBoundaries;
+    int64_t mdatEnd = atoms[mdat].offset + atoms[mdat].size;
+    for (int64_t boundary = (atoms[mdat].offset + 8 + how.frameAlignment - 1) / how.frameAlignment * how.frameAlignment;
+         boundary < mdatEnd; boundary += how.frameAlignment)
+        framesAtBoundaries.push_back(movie.data[boundary]);
+    ASSERT_EQ(how.frames, (int)framesAtBoundaries.size());
+    for (int i = 0; i < how.frames; ++i)
+        EXPECT_EQ(frame(i)[0], framesAtBoundaries[i]);
+
+    const uint8_t algn[] = { 'a', 'l', 'g', 'n', 0, 0, 0, 0, 0, 0, 0x10, 0 };
+    EXPECT_NE(movie.data.end(), std::search(movie.data.begin(), movie.data.end(), std::begin(algn), std::end(algn)));
+}
+
+TEST_F(MovieTest, SidecarIndexOpensMovieWithoutParsingIt)
+{
+    TestExport how(FrameRate * 60);
+    movie.withSidecar = true;
+    exportMovie(how);
+    ASSERT_FALSE(movie.sidecar.empty());
+
+    auto reader = reopen(movie);
+    EXPECT_TRUE(reader->fromSidecar());
+    EXPECT_EQ(FrameRate, reader->frameRateNumerator());
+    // nothing of the moov was read to open it
+    auto atoms = movie.atoms();
+    int moov = indexOf(atoms, "moov");
+    ASSERT_NE(-1, moov);
+    EXPECT_FALSE(movie.wasRead(atoms[moov]));
+
+    expectReadBack(*reader, how);
+}
+
+TEST_F(MovieTest, SidecarIndexFollowsMediaMovedForMoov)
+{
+    TestExport how(FrameRate * 60);
+    how.writeMoovTagEarly = false;
+    how.movable = true;
+    movie.withSidecar = true;
+    for (bool native : { false, true }) {
+        SCOPED_TRACE(native ? "native muxer" : "libavformat");
+        how.native = native;
+        auto reader = exportAndReopen(how);
+        EXPECT_TRUE(reader->fromSidecar());
+        EXPECT_EQ(1, indexOf(movie.atoms(), "moov"));
+    }
+}
+
+TEST_F(MovieTest, SidecarIndexForDifferentMovieIsIgnored)
+{
+    TestExport how(FrameRate * 10);
+    movie.withSidecar = true;
+    exportMovie(how);
+    auto sidecar = movie.sidecar;
+    how = TestExport(how.frames + 1);
+    exportMovie(how);
+    movie.sidecar = sidecar;
+
+    auto reader = reopen(movie);
+    EXPECT_FALSE(reader->fromSidecar());
+    // opened by parsing the moov instead
+    auto atoms = movie.atoms();
+    int moov = indexOf(atoms, "moov");
+    ASSERT_NE(-1, moov);
+    EXPECT_TRUE(movie.wasRead(atoms[moov]));
+    expectReadBack(*reader, how);
+}
+
+TEST_F(MovieTest, PreloadedAudioIsWrittenInAChunkPerFrame)
+{
+    TestExport how(FrameRate * 20);
+    how.audio = TestExport::PreloadedAudio;
+    movie.withSidecar = true;
+    for (bool native : { false, true }) {
+        SCOPED_TRACE(native ? "native muxer" : "libavformat");
+        how.native = native;
+        exportAndReopen(how);
+
+        auto index = parseMovieIndex(movie.sidecar);
+        ASSERT_TRUE(index);
+        ASSERT_EQ(how.frames, (int)index->audioChunks.size());
+        for (int i = 0; i < how.frames; ++i)
+            EXPECT_EQ(samplesBefore(i + 1) - samplesBefore(i), index->audioChunks[i].samples);
+    }
+}
+
+TEST_F(MovieTest, PreloadedAudioFromAnotherThreadIsWrittenInOrder)
+{
+    TestExport how(FrameRate * 20);
+    const int64_t audioSamples = samplesBefore(how.frames);
+    for (bool native : { false, true }) {
+        SCOPED_TRACE(native ? "native muxer" : "libavformat");
+        {
+            MovieWriter writer(0, movie.forWrite(), videoDef(how), audioDef(), true, 0, 0, native);
+            writer.writeHeader();
+            // rendered alongside the video, with each pair of packets arriving in the wrong order
+            std::thread producer([&]() {
+                const int64_t packet = 1000;
+                for (int64_t pts = 0; pts < audioSamples; pts += 2 * packet) {
+                    for (int64_t at : { pts + packet, pts }) {
+                        if (at >= audioSamples)
+                            continue;
+                        auto samples = audioPacket(at, std::min(packet, audioSamples - at));
+                        writer.preloadAudio(samples.data(), samples.size(), at);
+                    }
+                }
+            });
+            for (int i = 0; i < how.frames; ++i) {
+                auto data = frame(i);
+                writer.writeVideoFrame(data.data(), data.size());
+            }
+            producer.join();
+            writer.writeTrailer();
+            writer.close();
+        }
+
+        // the samples in pts order, whatever order they arrived in
+        expectReadBack(*reopen(movie), how);
+    }
+}
+
+TEST_F(MovieTest, AppendedAudioIsRepacketizedIntoChunksOfFrames)
+{
+    TestExport how(FrameRate * 20);
+    how.audio = TestExport::AppendedAudio;
+    how.framesPerAudioChunk = 2;
+    movie.withSidecar = true;
+    for (bool native : { false, true }) {
+        SCOPED_TRACE(native ? "native muxer" : "libavformat");
+        how.native = native;
+        exportAndReopen(how);
+
+        auto atoms = movie.atoms();
+        EXPECT_LT(indexOf(atoms, "moov"), indexOf(atoms, "mdat"));
+
+        auto index = parseMovieIndex(movie.sidecar);
+        ASSERT_TRUE(index);
+        const int chunks = how.frames / how.framesPerAudioChunk;
+        ASSERT_EQ(chunks, (int)index->audioChunks.size());
+        for (int64_t i = 0; i < chunks; ++i)
+            EXPECT_EQ(samplesBefore((i + 1) * how.framesPerAudioChunk) - samplesBefore(i * how.framesPerAudioChunk),
+                      index->audioChunks[i].samples);
+    }
+}
+
+TEST_F(MovieTest, TeeDestinationsShareFramesAndFailIndependently)
+{
+    TestExport how(FrameRate * 10);
+    how.audio = TestExport::AppendedAudio;
+    int released = 0;
+
+    // a destination that runs out of space part way through
+    MemoryMovie full;
+    MovieFile fullFile = full.forWrite();
+    fullFile.onWrite = [&full, write = fullFile.onWrite](const uint8_t *buffer, int size) {
+        return (full.data.size() + size > 4096) ? -1 : write(buffer, size);
+    };
+
+    {
+        auto writer = std::make_unique<MovieWriter>(0, movie.forWrite(), videoDef(how), audioDef(), true);
+        writer->writeHeader();
+        ExporterTeeDestination destination(std::move(writer), "destination", 4);
+
+        auto fullWriter = std::make_unique<MovieWriter>(0, fullFile, videoDef(how), audioDef(), false, 0, 0, true);
+        fullWriter->writeHeader();
+        ExporterTeeDestination fullDestination(std::move(fullWriter), "full destination", 4);
+
+        for (int i = 0; i < how.frames; ++i) {
+            AVBufferRef *encoded = reference(frame(i), released);
+            fullDestination.writeVideoFrame(av_buffer_ref(encoded));
+            destination.writeVideoFrame(encoded);
+
+            auto samples = audioPacket(samplesBefore(i), samplesBefore(i + 1) - samplesBefore(i));
+            fullDestination.appendAudio(samples.data(), samples.size());
+            destination.appendAudio(samples.data(), samples.size());
+        }
+
+        fullDestination.close();
+        destination.close();
+        EXPECT_TRUE(fullDestination.failed());
+        EXPECT_FALSE(destination.failed());
+    }
+    // each frame was encoded once for both destinations
+    EXPECT_EQ(how.frames, released);
+
+    expectReadBack(*reopen(movie), how);
+}
+
+TEST_F(MovieTest, SegmentsAreStitchedIntoOneMovie)
+{
+    TestExport how(FrameRate * 10 + 1);
+    auto split = splitIntoSegments(how.frames, 3, Rational{ FrameRate, 1 }, SampleRate);
+    ASSERT_EQ(3u, split.size());
+
+    // each exported on its own, with the audio for its frames; the middle one by the native muxer
+    std::vector<MemoryMovie> segments(split.size());
+    for (size_t s = 0; s < split.size(); ++s) {
+        const MovieSegment& segment = split[s];
+        EXPECT_EQ(samplesBefore(segment.firstFrame), segment.firstAudioSample);
+        EXPECT_EQ(samplesBefore(segment.firstFrame + segment.frames) - segment.firstAudioSample, segment.audioSamples);
+
+        TestExport part((int)segment.frames);
+        part.firstFrame = (int)segment.firstFrame;
+        part.audio = TestExport::AppendedAudio;
+        part.framesPerAudioChunk = 1;
+        part.native = (s == 1);
+        exportMovie(segments[s], part);
+    }
+
+    std::vector<MovieFile> files;
+    for (auto& segment : segments)
+        files.push_back(segment.forRead());
+    stitchMovies(VideoFormat{ 'H', 'a', 'p', '1' }, files, movie.forWrite(true));
+
+    auto atoms = movie.atoms();
+    EXPECT_EQ(1, count(atoms, "moov"));
+    EXPECT_LT(indexOf(atoms, "moov"), indexOf(atoms, "mdat"));
+    // every frame and sample of the whole, across the segment boundaries
+    auto reader = reopen(movie);
+    expectReadBack(*reader, how);
+    std::vector<uint8_t> read;
+    for (const MovieSegment& segment : split) {
+        for (int64_t i : { segment.firstFrame - 1, segment.firstFrame }) {
+            if (i < 0)
+                continue;
+            reader->readVideoFrame((int)i, read);
+            EXPECT_EQ(frame((int)i), read);
+        }
+    }
+}
+
+TEST_F(MovieTest, SegmentsOfDifferentBitDepthsAreNotStitched)
+{
+    std::vector<int> bitDepths{ 32, 24 };
+    std::vector<MemoryMovie> segments(bitDepths.size());
+    for (size_t s = 0; s < bitDepths.size(); ++s) {
+        TestExport part(10);
+        part.bitDepth = bitDepths[s];
+        part.audio = TestExport::NoAudio;
+        part.native = true;
+        exportMovie(segments[s], part);
+    }
+
+    std::vector<MovieFile> files;
+    for (auto& segment : segments)
+        files.push_back(segment.forRead());
+    EXPECT_THROW(stitchMovies(VideoFormat{ 'H', 'a', 'p', '1' }, files, movie.forWrite(true)), std::runtime_error);
+}
+
+TEST_F(MovieTest, TrimmedRangesAreJoinedWithTheirAudio)
+{
+    const int frames = 100;
+    TestExport how(frames);
+    how.audio = TestExport::AppendedAudio;
+    how.framesPerAudioChunk = 1;
+    how.native = true;
+    MemoryMovie source;
+    exportMovie(source, how);
+    MemoryMovie copy;
+    copy.data = source.data;
+
+    // the tail from frame 45, then the first 10 frames
+    std::vector<MovieRange> ranges;
+    ranges.push_back(MovieRange{ reopen(source), 45, -1 });
+    ranges.push_back(MovieRange{ reopen(copy), 0, 10 });
+    joinMovies(ranges, movie.forWrite(true));
+
+    auto reader = reopen(movie);
+    ASSERT_EQ(65, reader->numFrames());
+    std::vector<uint8_t> read;
+    for (int i : { 0, 54, 55, 64 }) {
+        reader->readVideoFrame(i, read);
+        EXPECT_EQ(frame((i < 55) ? 45 + i : i - 55), read);
+    }
+
+    auto expected = audioPacket(samplesBefore(45), samplesBefore(frames) - samplesBefore(45));
+    auto head = audioPacket(0, samplesBefore(10));
+    expected.insert(expected.end(), head.begin(), head.end());
+    ASSERT_EQ((int64_t)expected.size() / 2, reader->numAudioFrames());
+    reader->readAudio(0, expected.size() / 2, read);
+    EXPECT_EQ(expected, read);
+}
+
+TEST_F(MovieTest, MoviesOfDifferentCodecsAreNotJoined)
+{
+    std::vector<VideoFormat> formats{ VideoFormat{ 'H', 'a', 'p', '1' }, VideoFormat{ 'H', 'a', 'p', '5' } };
+    std::vector<MemoryMovie> sources(formats.size());
+    for (size_t s = 0; s < formats.size(); ++s) {
+        TestExport how(10);
+        how.format = formats[s];
+        how.audio = TestExport::NoAudio;
+        how.native = true;
+        exportMovie(sources[s], how);
+    }
+
+    std::vector<MovieRange> ranges;
+    for (size_t s = 0; s < formats.size(); ++s)
+        ranges.push_back(MovieRange{ reopen(sources[s], formats[s]) });
+    EXPECT_THROW(joinMovies(ranges, movie.forWrite(true)), std::runtime_error);
+}
+
+TEST_F(MovieTest, PreallocatedExportIsTruncatedToWhatWasWritten)
+{
+    // the moov written after the media and moved ahead of it, so the truncate follows the move
+    TestExport how(FrameRate * 10);
+    how.writeMoovTagEarly = false;
+    how.movable = true;
+    how.reserveFileSize = 4 << 20;
+    movie.space = how.reserveFileSize;
+    for (bool native : { false, true }) {
+        SCOPED_TRACE(native ? "native muxer" : "libavformat");
+        how.native = native;
+        movie.truncations.clear();
+        exportAndReopen(how);
+
+        EXPECT_EQ(how.reserveFileSize, movie.reserved);
+        // truncated once, to exactly the atoms written; a shorter or longer file fails atoms()
+        ASSERT_EQ(1u, movie.truncations.size());
+        EXPECT_EQ((int64_t)movie.data.size(), movie.truncations[0]);
+        EXPECT_LT(movie.truncations[0], how.reserveFileSize);
+        EXPECT_EQ(1, indexOf(movie.atoms(), "moov"));
+    }
+
+    // without the space, the export fails before anything is written
+    MovieWriter writer(0, movie.forWrite(), videoDef(how), audioDef(), true);
+    EXPECT_THROW(writer.writeHeader(how.reserveFileSize + 1), std::runtime_error);
+    EXPECT_TRUE(movie.data.empty());
+}
+
+TEST(PcmStoreTest, ReadsBackInOrderAcrossMemoryLimit)
+{
+    PcmStore store(100);
+    uint8_t next = 0, expected = 0;
+    for (int i = 0; i < 50; ++i) {
+        std::vector<uint8_t> data(30 + i % 11);
+        for (auto& byte : data)
+            byte = next++;
+        store.append(data.data(), data.size());
+        if (i % 3 == 2) {
+            std::vector<uint8_t> read((size_t)store.size() / 2);
+            store.read(read.data(), read.size());
+            for (auto byte : read)
+                ASSERT_EQ(expected++, byte);
+        }
+    }
+    EXPECT_TRUE(store.spilled());
+
+    std::vector<uint8_t> read((size_t)store.size());
+    store.read(read.data(), read.size());
+    for (auto byte : read)
+        ASSERT_EQ(expected++, byte);
+    EXPECT_EQ(next, expected);
+    EXPECT_EQ(0, store.size());
+    EXPECT_THROW(store.read(read.data(), 1), std::runtime_error);
+}
@@ -0,0 +1,149 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "codec_registration.hpp"
+#include "movie_segments.hpp"
+
+// fdn-edit: trims and joins movies without re-encoding them
+//   every frame of our codecs is a keyframe, so any range of frames can be cut from a movie, and movies
+//   of the same size, rate and audio joined, by copying their compressed frames and PCM; see joinMovies
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "usage: fdn-edit [--format <4cc>] <output> <input>[:<first>[-<last>]] ...\n"
+        "       fdn-edit [--format <4cc>] --stitch <segments> <output>\n"
+        "  writes frames first to last, inclusive, of each input in turn to output, with their audio,\n"
+        "  without re-encoding. A range left out is the whole movie; a last left out is the last frame.\n"
+        "  --format  the video track's four character code; by default the codec's, or any of its subtypes\n"
+        "  --stitch  joins the segments of output exported by fdn-transcode --segment, <output>.segment000\n"
+        "            and on, into output\n"
+        "examples:\n"
+        "  fdn-edit trimmed.mov clip.mov:48-1247       drop the first 48 frames and those after 1247\n"
+        "  fdn-edit joined.mov a.mov b.mov c.mov:0-99  join a, b and the first 100 frames of c\n"
+        "  fdn-edit --stitch 8 movie.mov               join movie.segment000.mov to movie.segment007.mov\n");
+}
+
+static int64_t parseFrame(const std::string& text, const std::string& argument)
+{
+    size_t parsed = 0;
+    long long frame = -1;
+    try {
+        frame = std::stoll(text, &parsed);
+    }
+    catch (...)
+    {
+    }
+    if (text.empty() || parsed != text.size() || frame < 0)
+        throw std::runtime_error("couldn't read a frame number from " + argument);
+    return (int64_t)frame;
+}
+
+// the first format that opens path
+static std::unique_ptr<MovieReader> openInput(const std::vector<VideoFormat>& formats, const std::string& path)
+{
+    std::string errors;
+    for (const auto& format : formats)
+    {
+        try {
+            return createMovieReader(format, fs::path(path));
+        }
+        catch (const std::exception& ex) {
+            errors += std::string(errors.empty() ? "" : "; ") + std::string(format.data(), format.size()) + ": " + ex.what();
+        }
+    }
+    throw std::runtime_error("couldn't open " + path + " - " + errors);
+}
+
+// <path>[:<first>[-<last>]], where the path may itself contain ':'
+static MovieRange parseInput(const std::vector<VideoFormat>& formats, const std::string& argument)
+{
+    std::string path = argument;
+    int64_t first = 0;
+    int64_t last = -1;
+
+    size_t colon = argument.rfind(':');
+    if (colon != std::string::npos && colon + 1 < argument.size()
+        && argument.find_first_not_of("0123456789-", colon + 1) == std::string::npos)
+    {
+        path = argument.substr(0, colon);
+        std::string range = argument.substr(colon + 1);
+        size_t dash = range.find('-');
+        first = parseFrame(range.substr(0, dash), argument);
+        if (dash != std::string::npos && dash + 1 < range.size())
+            last = parseFrame(range.substr(dash + 1), argument);
+        if (last != -1 && last < first)
+            throw std::runtime_error("last frame is before first in " + argument);
+    }
+
+    MovieRange input{ openInput(formats, path), first, (last == -1) ? -1 : last - first + 1 };
+    std::fprintf(stderr, "%s: %lld frames\n", path.c_str(), (long long)input.reader->numFrames());
+    return input;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    std::vector<VideoFormat> formats;
+    if (args.size() >= 2 && args[0] == "--format")
+    {
+        if (args[1].size() != 4) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        formats.push_back(VideoFormat{ args[1][0], args[1][1], args[1][2], args[1][3] });
+        args.erase(args.begin(), args.begin() + 2);
+    }
+    int segments = 0;
+    if (!args.empty() && args[0] == "--stitch")
+    {
+        if (args.size() != 3 || args[1].empty() || args[1].find_first_not_of("0123456789") != std::string::npos
+            || (segments = std::atoi(args[1].c_str())) < 1) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        args.erase(args.begin(), args.begin() + 2);
+    }
+    if (args.size() < 2 && !segments) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    try {
+        if (formats.empty())
+        {
+            const auto& details = CodecRegistry::codec()->details();
+            formats.push_back(details.fileFormat);
+            for (const auto& subtype : details.subtypes)
+                if (subtype.first != details.fileFormat)
+                    formats.push_back(subtype.first);
+        }
+
+        if (segments)
+        {
+            // the segments were exported alike, so the first tells which format they all are
+            VideoFormat format = openInput(formats, segmentMoviePath(args[0], 0))->video().format;
+            stitchMovieSegments(format, args[0], segments);
+        }
+        else
+        {
+            std::vector<MovieRange> inputs;
+            for (size_t i = 1; i < args.size(); ++i)
+                inputs.push_back(parseInput(formats, args[i]));
+
+            joinMovies(inputs, createMovieFile(args[0]));
+        }
+    }
+    catch (const std::exception& ex) {
+        std::fprintf(stderr, "fdn-edit: %s\n", ex.what());
+        return EXIT_FAILURE;
+    }
+
+    std::fprintf(stderr, "wrote %s\n", args[0].c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,284 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "codec_registration.hpp"
+#include "exporter.hpp"
+#include "importer.hpp"
+#include "logging.hpp"
+#include "movie_segments.hpp"
+
+// fdn-transcode: re-encodes a movie with other settings, without a host
+//   frames are decoded by the Importer's workers, as they are for the Premiere importer, into buffers
+//   that are dispatched in order to an Exporter, as rendered frames are by the hosts; the audio is
+//   copied across as it is. A long movie can be transcoded a segment at a time, by processes or machines
+//   of their own, and the segments stitched with fdn-edit --stitch; see splitIntoSegments.
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "usage: fdn-transcode [options] <input> <output>\n"
+        "  decodes input and encodes it again to output, with its audio\n"
+        "  --subtype <4cc>   the codec subtype to encode; by default the codec's default\n"
+        "  --quality <n>     the encoder quality; by default the codec's default\n"
+        "  --chunks <n>      the number of chunks to a frame; 0, the default, chooses\n"
+        "  --alpha           encode the alpha channel, where the subtype has one\n"
+        "  --segment <i>/<n> encode only segment i, from 0, of n, to <output>.segment<iii>\n"
+        "  --format <4cc>    the input video track's four character code; by default the codec's, or any of its subtypes\n");
+}
+
+static int parseNumber(const std::string& text, const std::string& option)
+{
+    size_t parsed = 0;
+    int number = -1;
+    try {
+        number = std::stoi(text, &parsed);
+    }
+    catch (...)
+    {
+    }
+    if (text.empty() || parsed != text.size() || number < 0)
+        throw std::runtime_error("couldn't read a number for " + option + " from " + text);
+    return number;
+}
+
+static std::array<char, 4> parse4CC(const std::string& text, const std::string& option)
+{
+    if (text.size() != 4)
+        throw std::runtime_error(option + " takes a four character code, not " + text);
+    return std::array<char, 4>{ text[0], text[1], text[2], text[3] };
+}
+
+// the first format that opens path
+static std::unique_ptr<MovieReader> openInput(const std::vector<VideoFormat>& formats, const std::string& path)
+{
+    std::string errors;
+    for (const auto& format : formats)
+    {
+        try {
+            return createMovieReader(format, fs::path(path));
+        }
+        catch (const std::exception& ex) {
+            errors += std::string(errors.empty() ? "" : "; ") + std::string(format.data(), format.size()) + ": " + ex.what();
+        }
+    }
+    throw std::runtime_error("couldn't open " + path + " - " + errors);
+}
+
+// a decoded frame, and whether it has arrived
+struct DecodedFrame
+{
+    std::vector<uint8_t> data;
+    std::promise<bool> decoded;   // false if it couldn't be
+    std::future<bool> arrival;
+};
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::vector<std::string> paths;
+    std::string outputPath;
+
+    const auto& codec = *CodecRegistry::codec();
+    const auto& details = codec.details();
+
+    try {
+        Codec4CC subtype = details.hasSubTypes() ? details.defaultSubType : details.videoFormat;
+        int quality = details.quality.defaultQuality;
+        int chunks = 0;
+        bool includeAlpha = false;
+        int segment = 0;
+        int segments = 0;   // 0 for the whole movie
+        std::vector<VideoFormat> formats;
+
+        for (size_t i = 0; i < args.size(); ++i)
+        {
+            const std::string& arg = args[i];
+            bool hasValue = (i + 1 < args.size());
+            if (arg == "--alpha")
+                includeAlpha = true;
+            else if (arg.rfind("--", 0) != 0)
+                paths.push_back(arg);
+            else if (!hasValue) {
+                usage();
+                return EXIT_FAILURE;
+            }
+            else if (arg == "--subtype")
+                subtype = parse4CC(args[++i], arg);
+            else if (arg == "--quality")
+                quality = parseNumber(args[++i], arg);
+            else if (arg == "--chunks")
+                chunks = parseNumber(args[++i], arg);
+            else if (arg == "--format")
+                formats.push_back(parse4CC(args[++i], arg));
+            else if (arg == "--segment")
+            {
+                const std::string& value = args[++i];
+                size_t slash = value.find('/');
+                if (slash == std::string::npos)
+                    throw std::runtime_error(arg + " takes <i>/<n>, not " + value);
+                segment = parseNumber(value.substr(0, slash), arg);
+                segments = parseNumber(value.substr(slash + 1), arg);
+                if (segment >= segments)
+                    throw std::runtime_error(arg + " " + value + " is not a segment of " + std::to_string(segments));
+            }
+            else {
+                usage();
+                return EXIT_FAILURE;
+            }
+        }
+        if (paths.size() != 2) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        const std::string& inputPath = paths[0];
+        outputPath = paths[1];
+
+        if (!codec.createDecoder)
+            throw std::runtime_error("the codec has no decoder");
+        if (details.hasSubTypes()
+            && std::none_of(details.subtypes.begin(), details.subtypes.end(),
+                            [&](const CodecNamedSubType& named) { return named.first == subtype; }))
+            throw std::runtime_error("the codec has no subtype " + std::string(subtype.data(), subtype.size()));
+
+        CodecAlpha alpha = withoutAlpha;
+        if (includeAlpha)
+        {
+            alpha = details.alpha.hasPerSubtypeAlphaSupport ? details.alpha.subtypeAlphaSupport.at(subtype) : withAlpha;
+            if (alpha == withoutAlpha)
+                FDN_WARNING("subtype ", std::string(subtype.data(), subtype.size()), " has no alpha channel; encoding without");
+        }
+
+        if (formats.empty())
+        {
+            formats.push_back(details.fileFormat);
+            for (const auto& named : details.subtypes)
+                if (named.first != details.fileFormat)
+                    formats.push_back(named.first);
+        }
+
+        // one reader for the audio and the movie's description, and one for the Importer to own
+        std::unique_ptr<MovieReader> input = openInput(formats, inputPath);
+        VideoDef video = input->video();
+        std::optional<AudioDef> audio;
+        if (input->hasAudio())
+            audio = input->audioDef();
+        std::fprintf(stderr, "%s: %dx%d, %lld frames\n", inputPath.c_str(), video.width, video.height, (long long)video.maxFrames);
+        if (video.maxFrames < 1)
+            throw std::runtime_error(inputPath + " has no frames");
+
+        // the frames and audio to encode: the whole movie, or a segment of it
+        int64_t audioSamples = audio ? input->numAudioFrames() : 0;
+        MovieSegment range{ 0, video.maxFrames, 0, audioSamples };
+        if (segments)
+        {
+            auto split = splitIntoSegments(video.maxFrames, segments, video.frameRate, audio ? audio->sampleRate : 0);
+            if (segment >= (int)split.size())
+                throw std::runtime_error(inputPath + " has only " + std::to_string(split.size()) + " frames to split");
+            range = split[segment];
+            // the last segment takes the rest of the audio, so that the stitched movie has all of it
+            range.firstAudioSample = std::min(range.firstAudioSample, audioSamples);
+            range.audioSamples = (segment + 1 == (int)split.size())
+                                     ? audioSamples - range.firstAudioSample
+                                     : std::min(range.audioSamples, audioSamples - range.firstAudioSample);
+            outputPath = segmentMoviePath(outputPath, segment);
+            std::fprintf(stderr, "segment %d of %d: frames %lld to %lld\n", segment, segments,
+                         (long long)range.firstFrame, (long long)(range.firstFrame + range.frames - 1));
+        }
+
+        // frames go between decoder and encoder in the host's format, as Premiere asks for them
+        FrameSize frameSize{ video.width, video.height };
+        FrameFormat format((details.isHighBitDepth ? ChannelFormat_U16_32k : ChannelFormat_U8)
+                           | FrameOrigin_BottomLeft
+                           | ChannelLayout_BGRA);
+        size_t stride = frameSize.width * bytesPerPixel(format);
+        size_t frameBytes = stride * frameSize.height;
+
+        // frames are decoded this far ahead of the one being encoded, each into a buffer of its own:
+        // enough to keep the Importer's workers busy, within a memory budget, as a 4K U16 frame is
+        // ~66MB. The buffers outlive the Importer, whose workers fill them
+        const size_t windowBytes = size_t{ 512 } << 20;
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t window = std::clamp(windowBytes / frameBytes, size_t{ 2 }, 2 * threads);
+        std::vector<DecodedFrame> frames(window);
+
+        Importer importer(
+            openInput(formats, inputPath),
+            codec.createDecoder(std::make_unique<DecoderParametersBase>(FrameDef(frameSize, format))));
+
+        std::unique_ptr<Exporter> exporter = createExporter(
+            frameSize, alpha, subtype, HapChunkCounts{ (unsigned int)chunks, (unsigned int)chunks }, quality,
+            video.frameRate,
+            (int32_t)range.frames,
+            0,      // reserveMetadataSpace
+            createMovieFile(outputPath),
+            audio,
+            false   // writeMoovTagEarly
+        );
+
+        // frame i of the range
+        auto request = [&](int64_t i) {
+            DecodedFrame& frame = frames[i % window];
+            frame.data.resize(frameBytes);
+            frame.decoded = std::promise<bool>();
+            frame.arrival = frame.decoded.get_future();
+            importer.requestFrame(
+                (int32_t)(range.firstFrame + i),
+                [&frame, stride](const DecoderJob& job) {
+                    job.copyLocalToExternal(frame.data.data(), stride);
+                    frame.decoded.set_value(true);
+                },
+                [&frame](const DecoderJob&) {
+                    frame.decoded.set_value(false);
+                });
+        };
+
+        // the audio in packets of a second, ahead of the frames it goes with
+        int64_t audioWritten = 0;   // of the range
+        std::vector<uint8_t> samples;
+        auto writeAudioThrough = [&](int64_t end) {
+            end = std::min(end, range.audioSamples);
+            while (audioWritten < end)
+            {
+                int64_t size = std::min(end - audioWritten, (int64_t)audio->sampleRate);
+                input->readAudio((size_t)(range.firstAudioSample + audioWritten), (size_t)size, samples);
+                exporter->writeAudioFrame(samples.data(), samples.size(), audioWritten);
+                audioWritten += size;
+            }
+        };
+
+        for (int64_t i = 0; i < std::min(range.frames, (int64_t)window); ++i)
+            request(i);
+        for (int64_t i = 0; i < range.frames; ++i)
+        {
+            DecodedFrame& frame = frames[i % window];
+            if (!frame.arrival.get())
+                throw std::runtime_error("couldn't decode frame " + std::to_string(range.firstFrame + i));
+            if (audio)
+                writeAudioThrough((i + 2) * audio->sampleRate * video.frameRate.denominator / video.frameRate.numerator);
+            exporter->dispatchVideo(i, frame.data.data(), stride, format);  // copies the frame
+
+            if (i + (int64_t)window < range.frames)
+                request(i + window);
+        }
+        importer.close();
+        writeAudioThrough(std::numeric_limits<int64_t>::max());
+
+        exporter->close();
+    }
+    catch (const std::exception& ex) {
+        std::fprintf(stderr, "fdn-transcode: %s\n", ex.what());
+        return EXIT_FAILURE;
+    }
+
+    std::fprintf(stderr, "wrote %s\n", outputPath.c_str());
+    return EXIT_SUCCESS;
+}